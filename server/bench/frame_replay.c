@@ -0,0 +1,333 @@
+/*
+ * frame_replay: feed a recorded sensor byte stream through a pty into the
+ * reactor and the frame parser, as a serial port would
+ *
+ * usage: frame_replay [-p proto] [-c chunk] [-d us] [-v] file
+ *        frame_replay [-p proto] [-c chunk] [-d us] [-v] -g frames [-o file]
+ *
+ *   -p  protocol of frame.h (default shbin)
+ *   -c  bytes per write to the pty (default 64, a UART FIFO or USB packet)
+ *   -d  pause between writes (default 0)
+ *   -g  no recording: generate frames from the protocol table, with some
+ *       garbage and bad checksums in between, and check every sample
+ *   -o  with -g, also save the generated stream as a recording
+ *   -v  print every sample
+ *
+ * Prints frames, bad checksums, skipped bytes and the parse rate; with -g
+ * exits 1 if a good frame was lost or decoded wrong.
+ */
+
+#define _GNU_SOURCE	/* posix_openpt() and friends */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "common.h"
+#include "frame.h"
+#include "reactor.h"
+
+#define TAG "replay"
+
+typedef struct{
+	float temp;
+	float hum;
+}EXPECT_T;
+
+static const FRAME_PROTO_T *proto;
+static EXPECT_T *expect;
+static uint64_t nexpect;
+static uint64_t samples, wrong;
+static int verbose;
+static atomic_int closed;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void put_raw(uint8_t *d, int type, int64_t v)
+{
+	switch (type) {
+	case FRAME_U8:
+	case FRAME_S8:
+		d[0] = v;
+		break;
+	case FRAME_U16_BE:
+	case FRAME_S16_BE:
+		d[0] = v >> 8;
+		d[1] = v;
+		break;
+	case FRAME_U16_LE:
+	case FRAME_S16_LE:
+		d[0] = v;
+		d[1] = v >> 8;
+		break;
+	case FRAME_U32_BE:
+		d[0] = v >> 24;
+		d[1] = v >> 16;
+		d[2] = v >> 8;
+		d[3] = v;
+		break;
+	case FRAME_U32_LE:
+		d[0] = v;
+		d[1] = v >> 8;
+		d[2] = v >> 16;
+		d[3] = v >> 24;
+		break;
+	}
+}
+
+static uint16_t crc16_modbus(const uint8_t *d, unsigned len)
+{
+	uint16_t crc = 0xffff;
+	int i;
+
+	while (len--) {
+		crc ^= *d++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xa001 & -(crc & 1));
+	}
+	return crc;
+}
+
+/* one frame of proto carrying temp and hum, the reverse of frame_sample() */
+static unsigned encode(uint8_t *d, float temp, float hum)
+{
+	const FRAME_FIELD_T *f;
+	unsigned len = proto->minLen, i;
+	uint16_t crc;
+	uint8_t c = 0;
+	float v;
+
+	memset(d, 0, len);
+	memcpy(d, proto->sync, proto->syncLen);
+	if (proto->lenOff != FRAME_LEN_FIXED)
+		d[proto->lenOff] = len - proto->lenAdd;
+	for (i = 0; i < FRAME_MAX_FIELDS; i++) {
+		f = &proto->fields[i];
+		if (f->field == FRAME_FIELD_NONE || f->field == FRAME_FIELD_TIME)
+			continue;
+		v = ((f->field == FRAME_FIELD_TEMP ? temp : hum) - f->add) / f->scale;
+		put_raw(d + f->off, f->type, (int64_t)(v < 0 ? v - 0.5f : v + 0.5f));
+	}
+
+	switch (proto->csum) {
+	case FRAME_CSUM_SUM8:
+		for (i = proto->csumFrom; i < len - 1; i++)
+			c += d[i];
+		d[len - 1] = c;
+		break;
+	case FRAME_CSUM_XOR8:
+		for (i = proto->csumFrom; i < len - 1; i++)
+			c ^= d[i];
+		d[len - 1] = c;
+		break;
+	case FRAME_CSUM_CRC16_MODBUS:
+		crc = crc16_modbus(d + proto->csumFrom, len - 2 - proto->csumFrom);
+		d[len - 2] = crc;
+		d[len - 1] = crc >> 8;
+		break;
+	}
+	return len;
+}
+
+/* n good frames, a run of garbage after every 7th, a bad checksum every 13th */
+static uint8_t *generate(uint64_t n, size_t *size)
+{
+	uint8_t *buf, *d;
+	uint64_t k;
+	int j;
+
+	buf = malloc(n * (proto->minLen * 2 + 8));
+	expect = malloc(n * sizeof(*expect));
+	if (buf == NULL || expect == NULL)
+		return NULL;
+
+	d = buf;
+	for (k = 0; k < n; k++) {
+		expect[k].temp = -20 + (int)(k % 700) * 0.1f;
+		expect[k].hum = (int)(k % 1000) * 0.1f;
+		if (k % 13 == 12) {
+			d += encode(d, 99, 99);
+			d[-1] ^= 0x5a;
+		}
+		d += encode(d, expect[k].temp, expect[k].hum);
+		if (k % 7 == 6) {
+			/* noise on the line, including a stray first sync byte */
+			for (j = 0; j < 5; j++)
+				*d++ = j == 2 ? proto->sync[0] : (uint8_t)(k * 31 + j);
+		}
+	}
+	nexpect = n;
+	*size = d - buf;
+	return buf;
+}
+
+static uint8_t *load(const char *path, size_t *size)
+{
+	uint8_t *buf;
+	long n;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	rewind(fp);
+	buf = malloc(n > 0 ? n : 1);
+	if (buf && fread(buf, 1, n, fp) != (size_t)n) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	*size = n;
+	return buf;
+}
+
+static int on_frame(const FRAME_VIEW_T *view, void *arg)
+{
+	STATUS_FAST_T s;
+	float dt, dh;
+
+	(void)arg;
+	frame_sample(view, time(NULL), &s);
+	if (verbose)
+		printf("%llu: temp %.2f hum %.2f\n", (unsigned long long)samples, s.fTemp, s.fHum);
+
+	if (expect) {
+		if (samples < nexpect) {
+			dt = s.fTemp - expect[samples].temp;
+			dh = s.fHum - expect[samples].hum;
+			if (dt > 0.06f || dt < -0.06f || dh > 0.06f || dh < -0.06f)
+				wrong++;
+		} else {
+			wrong++;
+		}
+	}
+	samples++;
+	return 0;
+}
+
+static void on_close(int id, void *arg)
+{
+	(void)id;
+	(void)arg;
+	atomic_store(&closed, 1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: frame_replay [-p proto] [-c chunk] [-d us] [-v] file\n"
+			"       frame_replay [-p proto] [-c chunk] [-d us] [-v] -g frames [-o file]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = "shbin", *out = NULL;
+	REACTOR_STATS_T st;
+	uint64_t gen = 0, t0, t1;
+	size_t size = 0, off, n;
+	int chunk = 64, delay = 0, opt, master, slave, id;
+	uint8_t *buf;
+	ssize_t w;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "p:c:d:g:o:v")) != -1) {
+		switch (opt) {
+		case 'p': name = optarg; break;
+		case 'c': chunk = atoi(optarg); break;
+		case 'd': delay = atoi(optarg); break;
+		case 'g': gen = strtoull(optarg, NULL, 0); break;
+		case 'o': out = optarg; break;
+		case 'v': verbose = 1; break;
+		default: usage();
+		}
+	}
+	proto = frame_proto_find(name);
+	if (proto == NULL) {
+		fprintf(stderr, "unknown protocol %s\n", name);
+		return 2;
+	}
+	if (chunk <= 0 || (gen == 0 && optind >= argc))
+		usage();
+
+	buf = gen ? generate(gen, &size) : load(argv[optind], &size);
+	if (buf == NULL) {
+		fprintf(stderr, "no stream to replay\n");
+		return 2;
+	}
+	if (out) {
+		fp = fopen(out, "wb");
+		if (fp == NULL || fwrite(buf, 1, size, fp) != size)
+			fprintf(stderr, "save %s failed\n", out);
+		if (fp)
+			fclose(fp);
+	}
+
+	/* the slave is set raw before the first byte, or 0d would turn into 0a */
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("pty");
+		return 1;
+	}
+	slave = reactor_open_tty(ptsname(master), 115200);
+	if (slave < 0 || reactor_start() != 0) {
+		fprintf(stderr, "reactor failed\n");
+		return 1;
+	}
+	id = reactor_add_frames(name, slave, proto, on_frame, on_close, NULL);
+	if (id < 0) {
+		fprintf(stderr, "add failed\n");
+		return 1;
+	}
+
+	t0 = now_ns();
+	for (off = 0; off < size; off += w) {
+		n = size - off < (size_t)chunk ? size - off : (size_t)chunk;
+		w = write(master, buf + off, n);
+		if (w < 0) {
+			w = 0;
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			break;
+		}
+		if (delay)
+			usleep(delay);
+	}
+	/* everything read, then hang up */
+	do {
+		reactor_stats(id, &st);
+		usleep(1000);
+	} while (st.rxBytes < size && now_ns() - t0 < 10000000000ULL);
+	t1 = now_ns();
+	close(master);
+	while (!atomic_load(&closed) && now_ns() - t1 < 1000000000ULL)
+		usleep(1000);
+	reactor_stop();
+
+	printf("%s: %zu bytes in %.3f s, %.2f MB/s\n", name, size,
+	       (t1 - t0) / 1e9, size / ((t1 - t0) / 1e9) / 1e6);
+	printf("reads %llu, frames %llu, bad checksum %llu, skipped %llu bytes\n",
+	       (unsigned long long)st.reads, (unsigned long long)st.frames,
+	       (unsigned long long)st.badFrames, (unsigned long long)st.dropped);
+	if (expect) {
+		printf("expected %llu samples, got %llu, %llu wrong\n",
+		       (unsigned long long)nexpect, (unsigned long long)samples,
+		       (unsigned long long)wrong);
+		return samples != nexpect || wrong ? 1 : 0;
+	}
+	return 0;
+}
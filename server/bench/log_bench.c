@@ -0,0 +1,225 @@
+/*
+ * log_bench: throughput and per-call latency of the logger
+ *
+ * usage: log_bench [-n calls] [-t max_threads] [-o null|file|mmap] [-f path]
+ *                  [-a drop|block] [-b]
+ *
+ *   -n  calls per thread and per case (default 100000)
+ *   -t  threads are 1, 2, 4 ... up to max_threads (default 4)
+ *   -o  where stderr/the log goes: /dev/null, a plain file or the mmap sink
+ *   -f  file for -o file / -o mmap (default /tmp/log_bench.log)
+ *   -a  use the asynchronous mode with the given overflow policy
+ *   -b  with -a, use LOG_BINARY records
+ *
+ * Each case prints messages/s over all threads and the p50/p99/p999
+ * latency of a single call in ns.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+
+#define TAG "bench"
+
+enum{
+	CASE_LOG = 0,
+	CASE_ONCE,
+	CASE_FORMAT,
+};
+
+static const char *case_names[] = { "log", "log_once", "format_line2" };
+
+typedef struct{
+	int id;
+	int kind;
+	int level;
+	int size;
+	int calls;
+	uint32_t *lat;	/* ns per call */
+}BENCH_THREAD_T;
+
+static char payload[2048];
+static pthread_barrier_t barrier;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void format_one(int level, const char *fmt, ...)
+{
+	static __thread int print_prefix = 1;
+	char line[4096];
+	va_list vl;
+
+	va_start(vl, fmt);
+	log_format_line2(TAG, level, fmt, vl, line, sizeof(line), &print_prefix);
+	va_end(vl);
+}
+
+static void *bench_thread(void *arg)
+{
+	BENCH_THREAD_T *t = arg;
+	uint64_t t0, t1;
+	int i, state = 0;
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < t->calls; i++) {
+		t0 = now_ns();
+		switch (t->kind) {
+		case CASE_LOG:
+			log(TAG, t->level, "thread %d seq %d temp %.2f %.*s\n",
+			    t->id, i, 23.5 + i % 10, t->size, payload);
+			break;
+		case CASE_ONCE:
+			log_once(TAG, t->level, t->level, &state,
+				 "thread %d seq %d temp %.2f %.*s\n",
+				 t->id, i, 23.5 + i % 10, t->size, payload);
+			break;
+		case CASE_FORMAT:
+			format_one(t->level, "thread %d seq %d temp %.2f %.*s\n",
+				   t->id, i, 23.5 + i % 10, t->size, payload);
+			break;
+		}
+		t1 = now_ns();
+		t->lat[i] = t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0;
+	}
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_case(int kind, int threads, int size, int level, int calls)
+{
+	BENCH_THREAD_T t[threads];
+	pthread_t tid[threads];
+	uint32_t *all;
+	uint64_t start, elapsed;
+	size_t total = (size_t)threads * calls;
+	int i;
+
+	all = malloc(total * sizeof(*all));
+	if (all == NULL)
+		return;
+
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		t[i].id = i;
+		t[i].kind = kind;
+		t[i].level = level;
+		t[i].size = size;
+		t[i].calls = calls;
+		t[i].lat = all + (size_t)i * calls;
+		pthread_create(&tid[i], NULL, bench_thread, &t[i]);
+	}
+	start = now_ns();
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < threads; i++)
+		pthread_join(tid[i], NULL);
+	elapsed = now_ns() - start;
+	pthread_barrier_destroy(&barrier);
+
+	qsort(all, total, sizeof(*all), cmp_u32);
+	printf("%-13s %7d %6d %-8s %12.0f %8u %8u %8u\n",
+	       case_names[kind], threads, size,
+	       level <= log_get_level() ? "enabled" : "filtered",
+	       total / (elapsed / 1e9),
+	       all[total / 2], all[total * 99 / 100], all[total * 999 / 1000]);
+	fflush(stdout);
+	free(all);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n calls] [-t max_threads] [-o null|file|mmap] "
+		"[-f path] [-a drop|block] [-b]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 16, 128, 1024 };
+	const char *out = "null", *path = "/tmp/log_bench.log", *async = NULL;
+	int calls = 100000, max_threads = 4, binary = 0;
+	int opt, fd, threads, s, kind, flags = LOG_PRINT_LEVEL;
+
+	while ((opt = getopt(argc, argv, "n:t:o:f:a:b")) != -1) {
+		switch (opt) {
+		case 'n': calls = atoi(optarg);		break;
+		case 't': max_threads = atoi(optarg);	break;
+		case 'o': out = optarg;			break;
+		case 'f': path = optarg;		break;
+		case 'a': async = optarg;		break;
+		case 'b': binary = 1;			break;
+		default:  usage(argv[0]);
+		}
+	}
+	if (calls <= 0 || max_threads <= 0)
+		usage(argv[0]);
+
+	memset(payload, 'x', sizeof(payload));
+
+	if (!strcmp(out, "null") || !strcmp(out, "file")) {
+		fd = open(!strcmp(out, "null") ? "/dev/null" : path,
+			  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || dup2(fd, 2) < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	} else if (!strcmp(out, "mmap")) {
+		if (log_file_open(path, 64 * 1024 * 1024, 2, 1000) != 0) {
+			perror(path);
+			return 1;
+		}
+		flags |= LOG_TO_FILE;
+	} else {
+		usage(argv[0]);
+	}
+
+	if (binary)
+		flags |= LOG_BINARY;
+	log_set_flags(flags);
+	log_set_level(LOG_INFO);
+
+	if (async && log_async_start(1024 * 1024, !strcmp(async, "block") ?
+				     LOG_OVERFLOW_BLOCK : LOG_OVERFLOW_DROP) != 0) {
+		fprintf(stderr, "cannot start the log thread\n");
+		return 1;
+	}
+
+	printf("# out=%s async=%s binary=%d calls/thread=%d\n",
+	       out, async ? async : "no", binary, calls);
+	printf("%-13s %7s %6s %-8s %12s %8s %8s %8s\n",
+	       "case", "threads", "size", "level", "msgs/s", "p50(ns)", "p99(ns)", "p999(ns)");
+
+	for (kind = CASE_LOG; kind <= CASE_FORMAT; kind++) {
+		for (threads = 1; threads <= max_threads; threads *= 2) {
+			for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+				run_case(kind, threads, sizes[s], LOG_INFO, calls);
+			if (kind != CASE_FORMAT)
+				run_case(kind, threads, sizes[0], LOG_DEBUG, calls);
+		}
+	}
+
+	log_async_stop();
+	if (async)
+		printf("# dropped %llu\n", (unsigned long long)log_async_dropped());
+	log_file_close();
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * rollup_check: rollups of samples with missing readings
+ *
+ * usage: rollup_check [database]
+ *
+ * Feeds one 1 min bucket with samples where temperature or humidity is NaN,
+ * some of them late, through db_rollup_add(), writes it back, reloads the
+ * writer and adds one more sample, then reads the bucket with
+ * db_rollup_query(). Every field must only count the samples that have
+ * it: its min, max, first, last, sum and count. A field no sample had is
+ * NaN with a count of 0. The database defaults to :memory:.
+ * Exits 1 if anything differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_rollup.h"
+
+#define NAN_F	__builtin_nanf("")
+#define DEV	7
+
+GLOBAL_T *glb = NULL;
+
+typedef struct{
+	int64_t t;		/* from the start of the bucket */
+	float temp;
+	float hum;
+}SAMPLE_T;
+
+/* the first ones, written back and reloaded before the last */
+static const SAMPLE_T samples[] = {
+	{ 0,	NAN_F,	50 },
+	{ 10,	20,	NAN_F },
+	{ 20,	22,	60 },
+	{ 5,	18,	NAN_F },	/* late, first temperature */
+	{ 30,	NAN_F,	NAN_F },
+};
+static const SAMPLE_T last = { 40, 30, NAN_F };
+
+static int failed;
+static int found;
+
+static void expect(const char *what, double got, double want)
+{
+	int ok = want != want ? got != got : got == want;
+
+	if (!ok) {
+		printf("%-12s %g, expected %g\n", what, got, want);
+		failed = 1;
+	}
+}
+
+static int on_bucket(const DB_ROLLUP_T *r, void *arg)
+{
+	found++;
+	expect("count", r->count, 6);
+	expect("temp count", r->temp.count, 4);
+	expect("temp min", r->temp.min, 18);
+	expect("temp max", r->temp.max, 30);
+	expect("temp sum", r->temp.sum, 90);
+	expect("temp first", r->temp.first, 18);
+	expect("temp last", r->temp.last, 30);
+	expect("hum count", r->hum.count, 2);
+	expect("hum min", r->hum.min, 50);
+	expect("hum max", r->hum.max, 60);
+	expect("hum sum", r->hum.sum, 110);
+	expect("hum first", r->hum.first, 50);
+	expect("hum last", r->hum.last, 60);
+	return 0;
+}
+
+static int empty_bucket(const DB_ROLLUP_T *r, void *arg)
+{
+	found++;
+	expect("count", r->count, 1);
+	expect("temp count", r->temp.count, 0);
+	expect("temp min", r->temp.min, NAN_F);
+	expect("temp mean", r->temp.count ? r->temp.sum / r->temp.count : NAN_F, NAN_F);
+	expect("hum count", r->hum.count, 1);
+	expect("hum mean", r->hum.sum / r->hum.count, 40);
+	return 0;
+}
+
+static int feed(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db, int64_t base, const SAMPLE_T *s, unsigned n)
+{
+	STATUS_FAST_T f;
+	unsigned i;
+
+	if (db_sqlite_exec(db, "BEGIN;") != 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		f.dev = DEV;
+		f.time = base + s[i].t;
+		f.fTemp = s[i].temp;
+		f.fHum = s[i].hum;
+		if (db_rollup_add(w, db, &f) != 0)
+			return -1;
+	}
+	if (db_rollup_flush(w, db) != 0 || db_sqlite_exec(db, "COMMIT;") != 0)
+		return -1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	DB_ROLLUP_WRITER_T w = { NULL, 0 };
+	SAMPLE_T none = { 0, NAN_F, 40 };
+	DB_SQLITE_T db;
+	int64_t base;
+
+	log_set_level(LOG_WARNING);
+
+	memset(&db, 0, sizeof(db));
+	snprintf(db.name, sizeof(db.name), "%s", argc > 1 ? argv[1] : ":memory:");
+	snprintf(db.createSql, sizeof(db.createSql), "%s", CREATE_DATA_DB);
+	if (db_sqlite_open(&db) != 0)
+		return 1;
+
+	/* a recent bucket, inside the retention of the 1 min tier */
+	base = (time(NULL) - 600) / 60 * 60;
+	if (db_rollup_load(&w, &db) != 0 ||
+	    feed(&w, &db, base, samples, sizeof(samples) / sizeof(samples[0])) != 0 ||
+	    db_rollup_load(&w, &db) != 0 || feed(&w, &db, base, &last, 1) != 0 ||
+	    feed(&w, &db, base + 60, &none, 1) != 0) {
+		printf("rollup failed: %s\n", sqlite3_errmsg(db.sqlite));
+		return 1;
+	}
+
+	if (db_rollup_query(&db, DEV, base, base + 59, 60, on_bucket, NULL) != 0 ||
+	    db_rollup_query(&db, DEV, base + 60, base + 119, 60, empty_bucket, NULL) != 0) {
+		printf("query failed: %s\n", sqlite3_errmsg(db.sqlite));
+		return 1;
+	}
+	expect("buckets", found, 2);
+
+	db_rollup_release(&w);
+	db_sqlite_close(&db);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,162 @@
+/*
+ * status_stress: torn-read check and read cost of the glb->tStatus seqlock
+ *
+ * usage: status_stress [-w writers] [-r readers] [-s seconds] [-p us] [-u]
+ *
+ *   -w  writer threads (default 1, the collect thread)
+ *   -r  reader threads (default 3: GUI, upload, web)
+ *   -s  run time (default 2)
+ *   -p  pause of the writers between writes (default 0, back to back; the
+ *       ns/read of a real 1 s collect cycle is the one with a large -p)
+ *   -u  same test on a plain struct without the seqlock, to show that the
+ *       check does catch torn reads
+ *
+ * Every write derives all fields from one counter; a reader seeing fields
+ * from two different writes counts a torn read. Exits 1 if any was seen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "common.h"
+#include "status.h"
+
+typedef struct{
+	uint64_t reads;
+	uint64_t torn;
+	uint64_t ns;
+}READER_T;
+
+static STATUS_SEQ_T seq_status;
+static volatile STATUS_SNAPSHOT_T plain_status;
+static volatile int stop;
+static int unprotected;
+static int pause_us;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void make_snapshot(uint32_t k, STATUS_SNAPSHOT_T *v)
+{
+	k &= 0xffffff;
+	v->status = k;
+	v->tFastStatus.time = k;
+	v->tFastStatus.fTemp = (float)k;
+	v->tFastStatus.fHum = (float)(k ^ 0x555555);
+	v->tTemp = (float)k;
+}
+
+static int is_torn(const STATUS_SNAPSHOT_T *v)
+{
+	uint32_t k = v->status;
+
+	return v->tFastStatus.time != k ||
+	       v->tFastStatus.fTemp != (float)k ||
+	       v->tFastStatus.fHum != (float)(k ^ 0x555555) ||
+	       v->tTemp != (float)k;
+}
+
+static void *writer(void *arg)
+{
+	STATUS_SNAPSHOT_T v;
+	uint32_t k = (uintptr_t)arg << 20;
+
+	while (!stop) {
+		make_snapshot(k++, &v);
+		if (unprotected) {
+			plain_status.status = v.status;
+			plain_status.tFastStatus.time = v.tFastStatus.time;
+			plain_status.tFastStatus.fTemp = v.tFastStatus.fTemp;
+			plain_status.tFastStatus.fHum = v.tFastStatus.fHum;
+			plain_status.tTemp = v.tTemp;
+		} else {
+			status_set(&seq_status, &v);
+		}
+		if (pause_us)
+			usleep(pause_us);
+	}
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	READER_T *r = arg;
+	STATUS_SNAPSHOT_T v;
+	uint64_t t0 = now_ns(), reads = 0, torn = 0;
+
+	/* local counters, the READER_T of the threads share cache lines */
+	while (!stop) {
+		if (unprotected)
+			memcpy(&v, (const void *)&plain_status, sizeof(v));
+		else
+			status_get(&seq_status, &v);
+		torn += is_torn(&v);
+		reads++;
+	}
+	r->ns = now_ns() - t0;
+	r->reads = reads;
+	r->torn = torn;
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	STATUS_SNAPSHOT_T v;
+	int writers = 1, readers = 3, seconds = 2, opt, i;
+	uint64_t reads = 0, torn = 0, ns = 0;
+
+	while ((opt = getopt(argc, argv, "w:r:s:p:u")) != -1) {
+		switch (opt) {
+		case 'w': writers = atoi(optarg);	break;
+		case 'r': readers = atoi(optarg);	break;
+		case 's': seconds = atoi(optarg);	break;
+		case 'p': pause_us = atoi(optarg);	break;
+		case 'u': unprotected = 1;		break;
+		default:
+			fprintf(stderr, "usage: %s [-w writers] [-r readers] [-s seconds] [-p us] [-u]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (writers < 1 || readers < 1 || seconds < 1)
+		return 1;
+
+	pthread_t wt[writers], rt[readers];
+	READER_T r[readers];
+
+	make_snapshot(0, &v);
+	status_set(&seq_status, &v);
+	memcpy((void *)&plain_status, &v, sizeof(v));
+	memset(r, 0, sizeof(r));
+
+	for (i = 0; i < readers; i++)
+		pthread_create(&rt[i], NULL, reader, &r[i]);
+	for (i = 0; i < writers; i++)
+		pthread_create(&wt[i], NULL, writer, (void *)(uintptr_t)i);
+
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < writers; i++)
+		pthread_join(wt[i], NULL);
+	for (i = 0; i < readers; i++) {
+		pthread_join(rt[i], NULL);
+		reads += r[i].reads;
+		torn += r[i].torn;
+		ns += r[i].ns;
+	}
+
+	printf("%s: %d writers, %d readers, %llu reads, %.1f ns/read, %llu torn\n",
+	       unprotected ? "plain" : "seqlock", writers, readers,
+	       (unsigned long long)reads, reads ? (double)ns / reads : 0.0,
+	       (unsigned long long)torn);
+	return torn ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "common.h"
+#include "collect.h"
+#include "status.h"
+#include "history.h"
+#include "registry.h"
+#include "filter.h"
+#include "db_store.h"
+
+#define TAG "collect"
+
+#define NS_PER_MS	1000000LL
+#define NS_PER_S	1000000000LL
+
+typedef struct{
+	char name[16];
+	int64_t period;		/* ns */
+	int phaseMs;
+	int bus;
+	COLLECT_READ_CB read;
+	void *arg;
+
+	int64_t next;		/* absolute deadline, ns */
+	COLLECT_STATS_T st;
+	int64_t jitterSum;	/* us */
+}SENSOR_T;
+
+static SENSOR_T sensors[COLLECT_MAX_SENSORS];
+static int count;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the history, the registry and the filters have one writer at a time */
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static atomic_int running;
+static int tfd = -1, efd = -1, epfd = -1;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+int collect_add(const char *name, unsigned periodMs, int phaseMs, int bus,
+		COLLECT_READ_CB read, void *arg)
+{
+	SENSOR_T *s;
+
+	if (atomic_load(&running) || count == COLLECT_MAX_SENSORS || periodMs == 0 || read == NULL)
+		return -1;
+
+	s = &sensors[count];
+	memset(s, 0, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->period = periodMs * NS_PER_MS;
+	s->phaseMs = phaseMs;
+	s->bus = bus;
+	s->read = read;
+	s->arg = arg;
+	return count++;
+}
+
+/* first deadlines; automatic phases are spread over the sensors of the bus */
+static void plan(int64_t start)
+{
+	int64_t phase;
+	int i, j, k, n;
+
+	for (i = 0; i < count; i++) {
+		if (sensors[i].phaseMs >= 0) {
+			phase = sensors[i].phaseMs * NS_PER_MS % sensors[i].period;
+		} else if (sensors[i].bus == COLLECT_BUS_NONE) {
+			phase = 0;
+		} else {
+			/* k-th of n auto sensors on the bus */
+			for (j = 0, k = 0, n = 0; j < count; j++) {
+				if (sensors[j].bus != sensors[i].bus || sensors[j].phaseMs >= 0)
+					continue;
+				if (j < i)
+					k++;
+				n++;
+			}
+			phase = sensors[i].period * k / n;
+		}
+		sensors[i].next = start + phase;
+	}
+}
+
+static void arm(int64_t deadline)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / NS_PER_S;
+	its.it_value.tv_nsec = deadline % NS_PER_S;
+	timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* read the sensors that are due, returns the next deadline */
+static int64_t run_due(void)
+{
+	int64_t now, late, skip, next = INT64_MAX;
+	SENSOR_T *s;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		s = &sensors[i];
+		/* the reads before this one count in its lateness */
+		now = now_ns();
+		if (s->next <= now) {
+			late = (now - s->next) / 1000;
+			s->read(i, s->arg);
+
+			pthread_mutex_lock(&stats_lock);
+			s->st.reads++;
+			s->st.jitterLastUs = late;
+			if (late > s->st.jitterMaxUs)
+				s->st.jitterMaxUs = late;
+			s->jitterSum += late;
+			s->st.jitterMeanUs = s->jitterSum / (int64_t)s->st.reads;
+			/* deadlines passed meanwhile are skipped, never caught up */
+			s->next += s->period;
+			if (s->next <= now) {
+				skip = (now - s->next) / s->period + 1;
+				s->st.missed += skip;
+				s->next += skip * s->period;
+			}
+			pthread_mutex_unlock(&stats_lock);
+		}
+		if (s->next < next)
+			next = s->next;
+	}
+	return next;
+}
+
+static void *collect_thread(void *arg)
+{
+	struct epoll_event ev;
+	uint64_t v;
+	int64_t next;
+
+	next = run_due();
+	while (atomic_load(&running)) {
+		if (next != INT64_MAX)
+			arm(next);
+		if (epoll_wait(epfd, &ev, 1, -1) <= 0)
+			continue;
+		if (ev.data.fd == efd)
+			break;
+		if (read(tfd, &v, sizeof(v)) < 0)
+			continue;
+		next = run_due();
+	}
+	return NULL;
+}
+
+/* samples held back by the filters of devices that went silent */
+static int sweep_filters(int id, void *arg)
+{
+	time_t now = time(NULL);
+	STATUS_FAST_T s;
+	unsigned i, n;
+
+	pthread_mutex_lock(&ingest_lock);
+	n = glb->pRegistry ? registry_count(glb->pRegistry) : 0;
+	for (i = 0; i < n; i++) {
+		if (filter_sweep(i, now, &s))
+			db_store_push(&s);
+	}
+	pthread_mutex_unlock(&ingest_lock);
+	return 0;
+}
+
+/* what the filters hold back would be lost */
+static void flush_filters(void)
+{
+	STATUS_FAST_T s;
+	unsigned i, n;
+
+	pthread_mutex_lock(&ingest_lock);
+	n = glb->pRegistry ? registry_count(glb->pRegistry) : 0;
+	for (i = 0; i < n; i++) {
+		if (filter_flush(i, &s))
+			db_store_push(&s);
+	}
+	pthread_mutex_unlock(&ingest_lock);
+	filter_dump();
+}
+
+static void close_fds(void)
+{
+	if (epfd >= 0)
+		close(epfd);
+	if (tfd >= 0)
+		close(tfd);
+	if (efd >= 0)
+		close(efd);
+	epfd = tfd = efd = -1;
+}
+
+int collect_start(void)
+{
+	struct epoll_event ev;
+	int sweep;
+
+	if (atomic_load(&running))
+		return -1;
+	sweep = collect_add("filters", FILTER_SWEEP_MS, COLLECT_PHASE_AUTO, COLLECT_BUS_NONE,
+			    sweep_filters, NULL);
+	if (sweep < 0)
+		return -1;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (tfd < 0 || efd < 0 || epfd < 0)
+		goto err;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = tfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) != 0)
+		goto err;
+	ev.data.fd = efd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) != 0)
+		goto err;
+
+	plan(now_ns());
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, collect_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		goto err;
+	}
+
+	log(TAG, LOG_INFO, "%d sensors scheduled\n", count);
+	return 0;
+
+err:
+	log(TAG, LOG_ERROR, "collect_start failed\n");
+	count = sweep;
+	close_fds();
+	return -1;
+}
+
+void collect_stop(void)
+{
+	uint64_t one = 1;
+
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	if (write(efd, &one, sizeof(one)) != sizeof(one))
+		log(TAG, LOG_WARNING, "wake the collect thread failed\n");
+	pthread_join(thread, NULL);
+	close_fds();
+
+	flush_filters();
+	collect_dump();
+	count = 0;
+}
+
+int collect_ingest(uint64_t dev, const STATUS_FAST_T *sample, unsigned *refused)
+{
+	STATUS_FAST_T s = *sample, out[2];
+	int slot = -1, queued = 0;
+	unsigned n, i, full = 0;
+
+	/* the device goes with the sample to the filter, the journal and the store */
+	s.dev = dev;
+	status_set_fast(&glb->tStatus, &s);
+
+	pthread_mutex_lock(&ingest_lock);
+	/* a device past the registry's capacity is stored unfiltered, without history */
+	if (glb->pRegistry)
+		slot = registry_update(glb->pRegistry, dev, &s);
+	if (glb->pHistory)
+		history_push(glb->pHistory, slot, &s);
+	/* the filter takes them all as stored, a full queue does not stop the next one */
+	n = filter_apply(slot, &s, out);
+	for (i = 0; i < n; i++) {
+		if (db_store_push(&out[i]) != 0)
+			full++;
+		else
+			queued++;
+	}
+	pthread_mutex_unlock(&ingest_lock);
+	if (refused)
+		*refused = full;
+	return queued;
+}
+
+int collect_stats(int id, COLLECT_STATS_T *st)
+{
+	if (id < 0 || id >= count)
+		return -1;
+
+	pthread_mutex_lock(&stats_lock);
+	*st = sensors[id].st;
+	pthread_mutex_unlock(&stats_lock);
+	return 0;
+}
+
+void collect_dump(void)
+{
+	COLLECT_STATS_T st;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		collect_stats(i, &st);
+		log(TAG, LOG_INFO, "%s: %llu reads, %llu missed, jitter mean %lld us max %lld us\n",
+		    sensors[i].name, (unsigned long long)st.reads, (unsigned long long)st.missed,
+		    (long long)st.jitterMeanUs, (long long)st.jitterMaxUs);
+	}
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "common.h"
+#include "collect.h"
+#include "frame.h"
+#include "reactor.h"
+#include "device.h"
+
+#define TAG "device"
+
+typedef struct{
+	CONFIG_DEVICE_T cfg;
+	int id;			/* in the reactor, -1 if it did not open */
+	atomic_int closed;	/* hung up */
+	_Atomic uint64_t samples;
+	_Atomic uint64_t refused;	/* storage queue full */
+}DEVICE_T;
+
+static DEVICE_T devices[MAX_DEVICES];
+static int count;
+
+int device_parse(const char *spec, CONFIG_DEVICE_T *dev)
+{
+	char buf[192], *key, *val, *save = NULL;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->baud = DEVICE_DEFAULT_BAUD;
+	snprintf(dev->proto, sizeof(dev->proto), "%s", DEVICE_DEFAULT_PROTO);
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (key = strtok_r(buf, ",", &save); key; key = strtok_r(NULL, ",", &save)) {
+		val = strchr(key, '=');
+		if (val == NULL && dev->path[0] == 0) {
+			snprintf(dev->path, sizeof(dev->path), "%s", key);
+			continue;
+		}
+		if (val == NULL) {
+			log(TAG, LOG_ERROR, "%s: expected key=value\n", key);
+			return -1;
+		}
+		*val++ = 0;
+
+		if (!strcmp(key, "path")) {
+			snprintf(dev->path, sizeof(dev->path), "%s", val);
+		} else if (!strcmp(key, "baud")) {
+			dev->baud = strtol(val, NULL, 0);
+		} else if (!strcmp(key, "proto")) {
+			snprintf(dev->proto, sizeof(dev->proto), "%s", val);
+		} else if (!strcmp(key, "id")) {
+			dev->id = strtoull(val, NULL, 0);
+		} else {
+			log(TAG, LOG_ERROR, "unknown key %s\n", key);
+			return -1;
+		}
+	}
+
+	if (dev->path[0] == 0 || dev->id == 0 || dev->baud < 0 || frame_proto_find(dev->proto) == NULL) {
+		log(TAG, LOG_ERROR, "bad spec: %s\n", spec);
+		return -1;
+	}
+	return 0;
+}
+
+/* reactor thread */
+static int on_frame(const FRAME_VIEW_T *view, void *arg)
+{
+	DEVICE_T *d = arg;
+	STATUS_FAST_T s;
+	unsigned full;
+
+	frame_sample(view, time(NULL), &s);
+	atomic_fetch_add_explicit(&d->samples, 1, memory_order_relaxed);
+	collect_ingest(d->cfg.id, &s, &full);
+	if (full)
+		atomic_fetch_add_explicit(&d->refused, full, memory_order_relaxed);
+	return 0;
+}
+
+static void on_closed(int id, void *arg)
+{
+	DEVICE_T *d = arg;
+
+	/* not when device_stop() took it out */
+	if (!atomic_exchange(&d->closed, 1))
+		log(TAG, LOG_WARNING, "%s (device %llu) is gone\n", d->cfg.path, (unsigned long long)d->cfg.id);
+}
+
+static int open_node(const CONFIG_DEVICE_T *c)
+{
+	int fd;
+
+	if (c->baud)
+		return reactor_open_tty(c->path, c->baud);
+
+	fd = open(c->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		log(TAG, LOG_ERROR, "open %s failed: %s\n", c->path, strerror(errno));
+	return fd;
+}
+
+int device_start(const CONFIG_DEVICE_T *devs, int n)
+{
+	const char *name;
+	DEVICE_T *d;
+	int i, fd, started = 0;
+
+	if (count)
+		return -1;
+	if (n > MAX_DEVICES)
+		n = MAX_DEVICES;
+
+	for (i = 0; i < n; i++) {
+		d = &devices[i];
+		d->cfg = devs[i];
+		d->id = -1;
+		atomic_store(&d->closed, 0);
+		atomic_store(&d->samples, 0);
+		atomic_store(&d->refused, 0);
+
+		fd = open_node(&d->cfg);
+		if (fd < 0)
+			continue;
+		name = strrchr(d->cfg.path, '/');
+		name = name ? name + 1 : d->cfg.path;
+		d->id = reactor_add_frames(name, fd, frame_proto_find(d->cfg.proto), on_frame, on_closed, d);
+		if (d->id < 0) {
+			log(TAG, LOG_ERROR, "add %s failed\n", d->cfg.path);
+			close(fd);
+			continue;
+		}
+		log(TAG, LOG_INFO, "%s: %s at %d baud as device %llu\n", d->cfg.path, d->cfg.proto,
+		    d->cfg.baud, (unsigned long long)d->cfg.id);
+		started++;
+	}
+	count = n;
+	return started;
+}
+
+void device_stop(void)
+{
+	REACTOR_STATS_T st;
+	DEVICE_T *d;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		d = &devices[i];
+		if (d->id >= 0 && !atomic_exchange(&d->closed, 1)) {
+			if (reactor_stats(d->id, &st) == 0)
+				log(TAG, LOG_INFO, "%s: %llu bytes, %llu frames, %llu bad, %llu bytes dropped\n",
+				    d->cfg.path, (unsigned long long)st.rxBytes, (unsigned long long)st.frames,
+				    (unsigned long long)st.badFrames, (unsigned long long)st.dropped);
+			reactor_remove(d->id);
+		}
+		log(TAG, LOG_INFO, "%s: %llu samples, %llu refused\n", d->cfg.path,
+		    (unsigned long long)atomic_load(&d->samples), (unsigned long long)atomic_load(&d->refused));
+	}
+	count = 0;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "common.h"
+#include "filter.h"
+
+#define TAG "filter"
+
+/* all of it is touched by every sample of the device: one record per slot */
+typedef struct{
+	FILTER_PARAM_T par;
+	uint8_t have;		/* last is valid */
+	uint8_t pending;	/* held is valid */
+	STATUS_FAST_T last;	/* last stored */
+	STATUS_FAST_T held;	/* last received, not stored yet (FILTER_SWING) */
+	float lo[2], up[2];	/* slopes from last that keep every held sample in, temp and hum */
+}FILTER_STATE_T;
+
+static FILTER_STATE_T *states;
+static unsigned count;
+static _Atomic uint64_t in, stored, heartbeats, flushed;
+
+int filter_init(unsigned devs, const FILTER_PARAM_T *par)
+{
+	unsigned i;
+
+	if (states || devs == 0)
+		return -1;
+	states = calloc(devs, sizeof(*states));
+	if (states == NULL)
+		return -1;
+	count = devs;
+	for (i = 0; i < devs; i++)
+		states[i].par = *par;
+	return 0;
+}
+
+void filter_deinit(void)
+{
+	free(states);
+	states = NULL;
+	count = 0;
+}
+
+int filter_set(int slot, const FILTER_PARAM_T *par)
+{
+	if (slot < 0 || (unsigned)slot >= count)
+		return -1;
+	memset(&states[slot], 0, sizeof(states[slot]));
+	states[slot].par = *par;
+	return 0;
+}
+
+static float value(const STATUS_FAST_T *s, int k)
+{
+	return k ? s->fHum : s->fTemp;
+}
+
+static float error(const FILTER_STATE_T *f, int k)
+{
+	return k ? f->par.hum : f->par.temp;
+}
+
+/* v held at v0 is off by at most e; NaN only matches NaN */
+static int within(float v, float v0, float e)
+{
+	if (v != v || v0 != v0)
+		return (v != v) == (v0 != v0);
+	return v - v0 <= e && v0 - v <= e;
+}
+
+static void restart(FILTER_STATE_T *f, const STATUS_FAST_T *s)
+{
+	int k;
+
+	f->last = *s;
+	f->have = 1;
+	f->pending = 0;
+	for (k = 0; k < 2; k++) {
+		f->lo[k] = -__builtin_inff();
+		f->up[k] = __builtin_inff();
+	}
+}
+
+static int deadband(const FILTER_STATE_T *f, const STATUS_FAST_T *s)
+{
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		if (!within(value(s, k), value(&f->last, k), error(f, k)))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Whether the line from last to s stays within the error of every held
+ * sample, narrowing the door by s. Classic swinging door only checks that
+ * some line fits, which can end up further than the error from the line
+ * actually stored; checking the line to s keeps the bound exact.
+ */
+static int door(FILTER_STATE_T *f, const STATUS_FAST_T *s)
+{
+	int64_t dt = s->time - f->last.time;
+	float v, v0, e, m, lo[2], up[2];
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		v = value(s, k);
+		v0 = value(&f->last, k);
+		e = error(f, k);
+		lo[k] = f->lo[k];
+		up[k] = f->up[k];
+		/* same second as last, or no reading: nothing to interpolate */
+		if (dt <= 0 || v != v || v0 != v0) {
+			if (!within(v, v0, e))
+				return 0;
+			continue;
+		}
+		m = (v - v0) / dt;
+		if (m < lo[k] || m > up[k])
+			return 0;
+		if ((v - e - v0) / dt > lo[k])
+			lo[k] = (v - e - v0) / dt;
+		if ((v + e - v0) / dt < up[k])
+			up[k] = (v + e - v0) / dt;
+	}
+	memcpy(f->lo, lo, sizeof(lo));
+	memcpy(f->up, up, sizeof(up));
+	return 1;
+}
+
+unsigned filter_apply(int slot, const STATUS_FAST_T *s, STATUS_FAST_T out[2])
+{
+	FILTER_STATE_T *f;
+	STATUS_FAST_T held;
+	unsigned n = 0;
+	int fits;
+
+	atomic_fetch_add_explicit(&in, 1, memory_order_relaxed);
+	if (slot < 0 || (unsigned)slot >= count || states[slot].par.mode == FILTER_NONE) {
+		out[n++] = *s;
+		goto done;
+	}
+	f = &states[slot];
+	if (!f->have) {
+		restart(f, s);
+		out[n++] = *s;
+		goto done;
+	}
+
+	/* twice at most: a closed door stores the held sample and s tries the new one */
+	for (;;) {
+		fits = f->par.mode == FILTER_DEADBAND ? deadband(f, s) : door(f, s);
+		if (fits) {
+			if (f->par.silence && s->time - f->last.time >= f->par.silence) {
+				/* s is on a line that fits, storing it keeps the bound */
+				restart(f, s);
+				out[n++] = *s;
+				atomic_fetch_add_explicit(&heartbeats, 1, memory_order_relaxed);
+			} else if (f->par.mode == FILTER_SWING) {
+				f->held = *s;
+				f->pending = 1;
+			}
+			break;
+		}
+		if (f->pending) {
+			held = f->held;
+			restart(f, &held);
+			out[n++] = held;
+			continue;
+		}
+		restart(f, s);
+		out[n++] = *s;
+		break;
+	}
+
+done:
+	atomic_fetch_add_explicit(&stored, n, memory_order_relaxed);
+	return n;
+}
+
+unsigned filter_flush(int slot, STATUS_FAST_T *out)
+{
+	FILTER_STATE_T *f;
+
+	if (slot < 0 || (unsigned)slot >= count || !states[slot].pending)
+		return 0;
+	f = &states[slot];
+	*out = f->held;
+	restart(f, out);
+	atomic_fetch_add_explicit(&stored, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&flushed, 1, memory_order_relaxed);
+	return 1;
+}
+
+unsigned filter_sweep(int slot, time_t now, STATUS_FAST_T *out)
+{
+	FILTER_STATE_T *f;
+
+	if (slot < 0 || (unsigned)slot >= count)
+		return 0;
+	f = &states[slot];
+	if (!f->pending || f->par.silence == 0 || now - f->held.time < f->par.silence)
+		return 0;
+	return filter_flush(slot, out);
+}
+
+void filter_stats(FILTER_STATS_T *st)
+{
+	st->in = atomic_load(&in);
+	st->stored = atomic_load(&stored);
+	st->heartbeats = atomic_load(&heartbeats);
+	st->flushed = atomic_load(&flushed);
+}
+
+void filter_dump(void)
+{
+	FILTER_STATS_T st;
+
+	filter_stats(&st);
+	log(TAG, LOG_INFO, "%llu samples in, %llu stored (%.1f:1), %llu heartbeats, %llu flushed\n",
+	    (unsigned long long)st.in, (unsigned long long)st.stored,
+	    st.stored ? (double)st.in / st.stored : 0.0,
+	    (unsigned long long)st.heartbeats, (unsigned long long)st.flushed);
+}
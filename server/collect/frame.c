@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "frame.h"
+
+#define TAG "frame"
+
+/*
+ * AA 55, length, id, temp s16 LE (0.01 C), hum u16 LE (0.01 %), sum8 of the
+ * length and payload; the length counts the payload, 5 bytes or more.
+ */
+static const FRAME_PROTO_T proto_shbin = {
+	.name = "shbin",
+	.sync = { 0xaa, 0x55 },
+	.syncLen = 2,
+	.lenOff = 2,
+	.lenAdd = 4,
+	.minLen = 9,
+	.maxLen = 64,
+	.csum = FRAME_CSUM_SUM8,
+	.csumFrom = 2,
+	.fields = {
+		{ FRAME_FIELD_TEMP, FRAME_S16_LE, 4, 0.01f, 0 },
+		{ FRAME_FIELD_HUM, FRAME_U16_LE, 6, 0.01f, 0 },
+	},
+};
+
+/*
+ * Reply of the common RS485 temperature/humidity probes to "read holding
+ * registers 0..1" at address 1: 01 03 04, hum u16 BE (0.1 %), temp s16 BE
+ * (0.1 C), CRC16 Modbus.
+ */
+static const FRAME_PROTO_T proto_modbus_th = {
+	.name = "modbus-th",
+	.sync = { 0x01, 0x03 },
+	.syncLen = 2,
+	.lenOff = 2,
+	.lenAdd = 5,
+	.minLen = 9,
+	.maxLen = FRAME_MAX_LEN,
+	.csum = FRAME_CSUM_CRC16_MODBUS,
+	.csumFrom = 0,
+	.fields = {
+		{ FRAME_FIELD_HUM, FRAME_U16_BE, 3, 0.1f, 0 },
+		{ FRAME_FIELD_TEMP, FRAME_S16_BE, 5, 0.1f, 0 },
+	},
+};
+
+const FRAME_PROTO_T *const frame_protos[] = {
+	&proto_shbin,
+	&proto_modbus_th,
+	NULL,
+};
+
+const FRAME_PROTO_T *frame_proto_find(const char *name)
+{
+	int i;
+
+	for (i = 0; frame_protos[i]; i++) {
+		if (!strcmp(frame_protos[i]->name, name))
+			return frame_protos[i];
+	}
+	return NULL;
+}
+
+int frame_parser_init(FRAME_PARSER_T *p, const FRAME_PROTO_T *proto, unsigned size)
+{
+	uint32_t n = 1;
+
+	memset(p, 0, sizeof(*p));
+	/* maxLen is a byte: no frame is longer than FRAME_MAX_LEN and the scratch */
+	if (proto == NULL || proto->minLen == 0 || proto->maxLen < proto->minLen)
+		return -1;
+
+	/* room for a frame being received behind one being parsed */
+	while (n < size || n < 2 * FRAME_MAX_LEN)
+		n <<= 1;
+
+	p->ring = malloc(n);
+	if (p->ring == NULL)
+		return -1;
+	p->proto = proto;
+	p->mask = n - 1;
+	return 0;
+}
+
+void frame_parser_free(FRAME_PARSER_T *p)
+{
+	free(p->ring);
+	p->ring = NULL;
+}
+
+ssize_t frame_read(FRAME_PARSER_T *p, int fd)
+{
+	uint32_t size = p->mask + 1, space = size - (p->head - p->tail);
+	uint32_t at = p->head & p->mask;
+	struct iovec iov[2];
+	ssize_t n;
+
+	if (space == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	iov[0].iov_base = p->ring + at;
+	iov[0].iov_len = space < size - at ? space : size - at;
+	iov[1].iov_base = p->ring;
+	iov[1].iov_len = space - iov[0].iov_len;
+
+	n = readv(fd, iov, iov[1].iov_len ? 2 : 1);
+	if (n > 0) {
+		p->head += n;
+		p->st.bytes += n;
+	}
+	return n;
+}
+
+size_t frame_feed(FRAME_PARSER_T *p, const void *data, size_t len)
+{
+	uint32_t size = p->mask + 1, space = size - (p->head - p->tail);
+	uint32_t at = p->head & p->mask, first;
+
+	if (len > space)
+		len = space;
+	first = len < size - at ? len : size - at;
+	memcpy(p->ring + at, data, first);
+	memcpy(p->ring, (const uint8_t *)data + first, len - first);
+	p->head += len;
+	p->st.bytes += len;
+	return len;
+}
+
+static uint16_t crc16_modbus(const uint8_t *d, unsigned len)
+{
+	uint16_t crc = 0xffff;
+	int i;
+
+	while (len--) {
+		crc ^= *d++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xa001 & -(crc & 1));
+	}
+	return crc;
+}
+
+static int csum_ok(const FRAME_PROTO_T *proto, const uint8_t *d, unsigned len)
+{
+	uint8_t c = 0;
+	unsigned i;
+
+	switch (proto->csum) {
+	case FRAME_CSUM_SUM8:
+		for (i = proto->csumFrom; i < len - 1; i++)
+			c += d[i];
+		return c == d[len - 1];
+	case FRAME_CSUM_XOR8:
+		for (i = proto->csumFrom; i < len - 1; i++)
+			c ^= d[i];
+		return c == d[len - 1];
+	case FRAME_CSUM_CRC16_MODBUS:
+		return len >= proto->csumFrom + 2 &&
+		       crc16_modbus(d + proto->csumFrom, len - 2 - proto->csumFrom) ==
+		       (d[len - 2] | d[len - 1] << 8);
+	default:
+		return 1;
+	}
+}
+
+static uint8_t byte_at(const FRAME_PARSER_T *p, uint32_t i)
+{
+	return p->ring[i & p->mask];
+}
+
+/* garbage at the tail: up to the next possible first sync byte */
+static uint32_t garbage(const FRAME_PARSER_T *p)
+{
+	uint32_t at = p->tail & p->mask, n = p->head - p->tail;
+	const uint8_t *hit;
+
+	if (n > p->mask + 1 - at)
+		n = p->mask + 1 - at;
+	/* the byte at the tail is the one known to be bad */
+	hit = memchr(p->ring + at + 1, p->proto->sync[0], n - 1);
+	return hit ? (uint32_t)(hit - (p->ring + at)) : n;
+}
+
+unsigned frame_parse(FRAME_PARSER_T *p, FRAME_CB cb, void *arg)
+{
+	const FRAME_PROTO_T *proto = p->proto;
+	FRAME_VIEW_T view;
+	uint32_t avail, at, len, first, skip;
+	unsigned i, frames = 0;
+
+	while ((avail = p->head - p->tail) >= proto->minLen) {
+		skip = 0;
+		for (i = 0; i < proto->syncLen; i++) {
+			if (byte_at(p, p->tail + i) != proto->sync[i]) {
+				skip = i ? 1 : garbage(p);
+				break;
+			}
+		}
+		if (skip == 0) {
+			len = proto->lenOff == FRAME_LEN_FIXED ? proto->minLen :
+			      byte_at(p, p->tail + proto->lenOff) + proto->lenAdd;
+			if (len < proto->minLen || len > proto->maxLen)
+				skip = 1;
+		}
+		if (skip) {
+			p->tail += skip;
+			p->st.skipped += skip;
+			continue;
+		}
+		if (avail < len)
+			break;
+
+		/* in place, unless it wraps */
+		at = p->tail & p->mask;
+		if (at + len <= p->mask + 1) {
+			view.data = p->ring + at;
+		} else {
+			first = p->mask + 1 - at;
+			memcpy(p->scratch, p->ring + at, first);
+			memcpy(p->scratch + first, p->ring, len - first);
+			view.data = p->scratch;
+			p->st.wrapped++;
+		}
+		if (!csum_ok(proto, view.data, len)) {
+			/* a sync inside the bad frame may start a good one */
+			p->st.badCsum++;
+			p->st.skipped++;
+			p->tail++;
+			continue;
+		}
+
+		view.proto = proto;
+		view.len = len;
+		p->tail += len;
+		p->st.frames++;
+		frames++;
+		if (cb && cb(&view, arg))
+			break;
+	}
+	return frames;
+}
+
+uint32_t frame_drop(FRAME_PARSER_T *p)
+{
+	uint32_t n = p->head - p->tail;
+
+	p->tail = p->head;
+	p->st.skipped += n;
+	return n;
+}
+
+static int64_t raw_of(const uint8_t *d, int type)
+{
+	switch (type) {
+	case FRAME_U8:		return d[0];
+	case FRAME_S8:		return (int8_t)d[0];
+	case FRAME_U16_BE:	return (uint16_t)(d[0] << 8 | d[1]);
+	case FRAME_S16_BE:	return (int16_t)(d[0] << 8 | d[1]);
+	case FRAME_U16_LE:	return (uint16_t)(d[1] << 8 | d[0]);
+	case FRAME_S16_LE:	return (int16_t)(d[1] << 8 | d[0]);
+	case FRAME_U32_BE:	return (uint32_t)d[0] << 24 | d[1] << 16 | d[2] << 8 | d[3];
+	case FRAME_U32_LE:	return (uint32_t)d[3] << 24 | d[2] << 16 | d[1] << 8 | d[0];
+	default:		return 0;
+	}
+}
+
+static unsigned size_of(int type)
+{
+	if (type <= FRAME_S8)
+		return 1;
+	return type <= FRAME_S16_LE ? 2 : 4;
+}
+
+void frame_sample(const FRAME_VIEW_T *view, time_t time, STATUS_FAST_T *s)
+{
+	const FRAME_FIELD_T *f;
+	float v;
+	int i;
+
+	s->time = time;
+	/* a reading the protocol does not carry */
+	s->fTemp = __builtin_nanf("");
+	s->fHum = __builtin_nanf("");
+	for (i = 0; i < FRAME_MAX_FIELDS; i++) {
+		f = &view->proto->fields[i];
+		if (f->field == FRAME_FIELD_NONE || f->off + size_of(f->type) > view->len)
+			continue;
+		v = raw_of(view->data + f->off, f->type) * f->scale + f->add;
+		if (f->field == FRAME_FIELD_TEMP)
+			s->fTemp = v;
+		else if (f->field == FRAME_FIELD_HUM)
+			s->fHum = v;
+		else if (f->field == FRAME_FIELD_TIME)
+			s->time = (time_t)raw_of(view->data + f->off, f->type);
+	}
+}
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "common.h"
+#include "reactor.h"
+
+#define TAG "reactor"
+
+#define MAX_EVENTS	16
+
+typedef struct{
+	int used;		/* slot taken, under lock */
+	atomic_int closing;	/* set by anyone, acted on by the reactor thread */
+	int fd;
+	char name[16];
+	REACTOR_FRAME_CB frame;
+	REACTOR_CLOSE_CB closed;
+	void *arg;
+	FRAME_CB onFrame;
+	FRAME_PARSER_T *parser;	/* reactor_add_frames() devices, instead of rx */
+
+	/* reactor thread only */
+	size_t len;
+	uint8_t rx[REACTOR_RX_BUF];
+
+	REACTOR_STATS_T st;	/* under lock */
+}DEV_T;
+
+static DEV_T devs[REACTOR_MAX_DEVS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static atomic_int running;
+static atomic_int closing;	/* some device is marked */
+static int epfd = -1, efd = -1;
+
+static void wake(void)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) != sizeof(one))
+		log(TAG, LOG_WARNING, "wake the reactor failed\n");
+}
+
+static void stat_add(DEV_T *d, size_t rx, size_t dropped)
+{
+	pthread_mutex_lock(&lock);
+	d->st.reads++;
+	d->st.rxBytes += rx;
+	d->st.dropped += dropped;
+	pthread_mutex_unlock(&lock);
+}
+
+static void hang_up(DEV_T *d, ssize_t n)
+{
+	/* EOF, or a dead device: EIO on a pty */
+	log(TAG, LOG_INFO, "%s closed: %s\n", d->name, n ? strerror(errno) : "EOF");
+	atomic_store(&d->closing, 1);
+	atomic_store(&closing, 1);
+}
+
+/* big reads into the frame ring, frames handed over in place */
+static void on_frames(DEV_T *d)
+{
+	FRAME_PARSER_T *p = d->parser;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < REACTOR_READS_PER_EVENT && !atomic_load(&d->closing); i++) {
+		n = frame_read(p, d->fd);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n == 0 || (n < 0 && errno != ENOBUFS)) {
+			hang_up(d, n);
+			return;
+		}
+		/* ENOBUFS: the callback stopped a parse and the ring filled up behind it */
+		frame_parse(p, d->onFrame, d->arg);
+		if (n < 0 && p->head - p->tail > p->mask)
+			frame_drop(p);
+
+		pthread_mutex_lock(&lock);
+		d->st.reads++;
+		d->st.rxBytes = p->st.bytes;
+		d->st.dropped = p->st.skipped;
+		d->st.frames = p->st.frames;
+		d->st.badFrames = p->st.badCsum;
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/* read what is there, bounded, and hand it to the framing */
+static void on_readable(int id)
+{
+	DEV_T *d = &devs[id];
+	size_t used, drop;
+	ssize_t n;
+	int i;
+
+	if (d->parser) {
+		on_frames(d);
+		return;
+	}
+
+	for (i = 0; i < REACTOR_READS_PER_EVENT && !atomic_load(&d->closing); i++) {
+		n = read(d->fd, d->rx + d->len, sizeof(d->rx) - d->len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			hang_up(d, n);
+			return;
+		}
+
+		d->len += n;
+		used = d->frame(id, d->rx, d->len, d->arg);
+		if (used > d->len)
+			used = d->len;
+		drop = 0;
+		if (used == 0 && d->len == sizeof(d->rx)) {
+			/* no frame fits, resync on what comes next */
+			drop = d->len;
+			used = d->len;
+		}
+		d->len -= used;
+		if (d->len && used)
+			memmove(d->rx, d->rx + used, d->len);
+		stat_add(d, n, drop);
+	}
+}
+
+/* close the devices marked, in the reactor thread only */
+static void sweep(void)
+{
+	DEV_T *d;
+	int i, marked;
+
+	if (!atomic_exchange(&closing, 0))
+		return;
+
+	for (i = 0; i < REACTOR_MAX_DEVS; i++) {
+		d = &devs[i];
+		pthread_mutex_lock(&lock);
+		marked = d->used && atomic_load(&d->closing);
+		pthread_mutex_unlock(&lock);
+		if (!marked)
+			continue;
+		epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+		if (d->closed)
+			d->closed(i, d->arg);
+		close(d->fd);
+		if (d->parser) {
+			frame_parser_free(d->parser);
+			free(d->parser);
+		}
+
+		pthread_mutex_lock(&lock);
+		d->parser = NULL;
+		d->used = 0;
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+static void *reactor_thread(void *arg)
+{
+	struct epoll_event ev[MAX_EVENTS];
+	uint64_t v;
+	int i, n, id;
+
+	while (atomic_load(&running)) {
+		n = epoll_wait(epfd, ev, MAX_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.u32 == REACTOR_MAX_DEVS) {
+				/* stop, or a device removed */
+				if (read(efd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+					log(TAG, LOG_WARNING, "eventfd: %s\n", strerror(errno));
+				continue;
+			}
+			id = ev[i].data.u32;
+			if (ev[i].events & (EPOLLIN | EPOLLPRI))
+				on_readable(id);
+			/* data still pending is read first, then the hang-up is seen as EOF */
+			else if (ev[i].events & (EPOLLHUP | EPOLLERR)) {
+				atomic_store(&devs[id].closing, 1);
+				atomic_store(&closing, 1);
+			}
+		}
+		sweep();
+	}
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < REACTOR_MAX_DEVS; i++) {
+		if (devs[i].used)
+			atomic_store(&devs[i].closing, 1);
+	}
+	pthread_mutex_unlock(&lock);
+	atomic_store(&closing, 1);
+	sweep();
+	return NULL;
+}
+
+int reactor_start(void)
+{
+	struct epoll_event ev;
+
+	if (atomic_load(&running))
+		return -1;
+
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd < 0 || epfd < 0)
+		goto err;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = REACTOR_MAX_DEVS;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) != 0)
+		goto err;
+
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, reactor_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		goto err;
+	}
+	return 0;
+
+err:
+	log(TAG, LOG_ERROR, "reactor_start failed\n");
+	if (epfd >= 0)
+		close(epfd);
+	if (efd >= 0)
+		close(efd);
+	epfd = efd = -1;
+	return -1;
+}
+
+void reactor_stop(void)
+{
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	wake();
+	pthread_join(thread, NULL);
+	close(epfd);
+	close(efd);
+	epfd = efd = -1;
+}
+
+static int dev_add(const char *name, int fd, REACTOR_FRAME_CB frame, FRAME_PARSER_T *parser,
+		FRAME_CB onFrame, REACTOR_CLOSE_CB closed, void *arg)
+{
+	struct epoll_event ev;
+	DEV_T *d = NULL;
+	int id, flags;
+
+	if (!atomic_load(&running) || fd < 0)
+		return -1;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+		return -1;
+
+	pthread_mutex_lock(&lock);
+	for (id = 0; id < REACTOR_MAX_DEVS; id++) {
+		if (!devs[id].used) {
+			d = &devs[id];
+			break;
+		}
+	}
+	if (d == NULL) {
+		pthread_mutex_unlock(&lock);
+		log(TAG, LOG_ERROR, "no room for %s\n", name);
+		return -1;
+	}
+	memset(d, 0, sizeof(*d));
+	d->used = 1;
+	d->fd = fd;
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->frame = frame;
+	d->parser = parser;
+	d->onFrame = onFrame;
+	d->closed = closed;
+	d->arg = arg;
+	pthread_mutex_unlock(&lock);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP;
+	ev.data.u32 = id;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		log(TAG, LOG_ERROR, "watch %s failed: %s\n", name, strerror(errno));
+		pthread_mutex_lock(&lock);
+		d->parser = NULL;
+		d->used = 0;
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	log(TAG, LOG_DEBUG, "%s added as %d\n", d->name, id);
+	return id;
+}
+
+int reactor_add(const char *name, int fd, REACTOR_FRAME_CB frame, REACTOR_CLOSE_CB closed, void *arg)
+{
+	if (frame == NULL)
+		return -1;
+	return dev_add(name, fd, frame, NULL, NULL, closed, arg);
+}
+
+int reactor_add_frames(const char *name, int fd, const FRAME_PROTO_T *proto,
+		FRAME_CB frame, REACTOR_CLOSE_CB closed, void *arg)
+{
+	FRAME_PARSER_T *p;
+	int id;
+
+	if (frame == NULL)
+		return -1;
+	p = malloc(sizeof(*p));
+	if (p == NULL || frame_parser_init(p, proto, FRAME_RING_DEFAULT) != 0) {
+		free(p);
+		return -1;
+	}
+
+	id = dev_add(name, fd, NULL, p, frame, closed, arg);
+	if (id < 0) {
+		frame_parser_free(p);
+		free(p);
+	}
+	return id;
+}
+
+int reactor_remove(int id)
+{
+	int ok;
+
+	if (id < 0 || id >= REACTOR_MAX_DEVS)
+		return -1;
+
+	pthread_mutex_lock(&lock);
+	ok = devs[id].used;
+	if (ok) {
+		atomic_store(&devs[id].closing, 1);
+		atomic_store(&closing, 1);
+	}
+	pthread_mutex_unlock(&lock);
+	if (!ok)
+		return -1;
+	wake();
+	return 0;
+}
+
+ssize_t reactor_write(int id, const void *data, size_t len)
+{
+	ssize_t n = -1;
+
+	if (id < 0 || id >= REACTOR_MAX_DEVS)
+		return -1;
+
+	/* under the lock: the reactor cannot close the fd meanwhile */
+	pthread_mutex_lock(&lock);
+	if (devs[id].used && !atomic_load(&devs[id].closing)) {
+		do {
+			n = write(devs[id].fd, data, len);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			n = 0;
+	}
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+static speed_t baud_of(int baud)
+{
+	switch (baud) {
+	case 9600:	return B9600;
+	case 19200:	return B19200;
+	case 38400:	return B38400;
+	case 57600:	return B57600;
+	case 115200:	return B115200;
+	case 230400:	return B230400;
+	default:	return B0;
+	}
+}
+
+int reactor_open_tty(const char *path, int baud)
+{
+	struct termios tio;
+	speed_t speed = baud_of(baud);
+	int fd;
+
+	if (speed == B0) {
+		log(TAG, LOG_ERROR, "%s: unsupported baud %d\n", path, baud);
+		return -1;
+	}
+
+	fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		log(TAG, LOG_ERROR, "open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) != 0) {
+		log(TAG, LOG_ERROR, "%s is not a tty\n", path);
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	/* VMIN 0 would make an empty read return 0, taken for a hang-up */
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		log(TAG, LOG_ERROR, "%s: set %d baud failed\n", path, baud);
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	return fd;
+}
+
+int reactor_stats(int id, REACTOR_STATS_T *st)
+{
+	int ok;
+
+	if (id < 0 || id >= REACTOR_MAX_DEVS)
+		return -1;
+
+	pthread_mutex_lock(&lock);
+	ok = devs[id].used;
+	if (ok)
+		*st = devs[id].st;
+	pthread_mutex_unlock(&lock);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "common.h"
+#include "collect.h"
+#include "db_store.h"
+#include "registry.h"
+#include "sim.h"
+
+#define TAG "sim"
+
+#define NS_PER_S	1000000000LL
+#define BASE_TEMP	22.0
+#define BASE_HUM	50.0
+
+typedef enum{
+	WAVE_SINE = 0,
+	WAVE_SQUARE,
+	WAVE_RAMP,
+	WAVE_WALK,
+}WAVE_E;
+
+static const char *wave_names[] = { "sine", "square", "ramp", "walk" };
+
+typedef struct{
+	unsigned sensors;
+	double rate;
+	int wave;		/* WAVE_E */
+	double period;		/* s */
+	double amp;
+	double noise;
+	unsigned drop;		/* per mille */
+	unsigned burst;		/* s, 0 for none */
+	double burstx;
+	char trace[128];
+	unsigned report;	/* s */
+}SIM_CONFIG_T;
+
+typedef struct{
+	float walk;		/* WAVE_WALK position, -1..1 */
+	uint32_t silent;	/* own samples still left out */
+	uint32_t traceAt;
+}VSENSOR_T;
+
+/* injected samples up to a tick, and when */
+typedef struct{
+	uint64_t injected;
+	int64_t ns;
+}MARK_T;
+
+static SIM_CONFIG_T cfg;
+static VSENSOR_T *fleet;
+static STATUS_FAST_T *trace;
+static unsigned traceLen;
+static unsigned next;		/* round robin */
+static double tokens;
+static uint32_t seed = 2463534242u;
+static int64_t startNs, lastNs, reportNs;
+static uint64_t storedBase;
+
+/* the lag, oldest first */
+static MARK_T marks[SIM_MARKS];
+static unsigned markHead, markTail;
+
+static SIM_STATS_T st, reported;
+static int64_t intervalMaxMs;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/* xorshift32, -1..1 */
+static double uniform(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed / 2147483648.0 - 1;
+}
+
+static double clamp(double v, double lo, double hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* sin(2 pi x), libm through the builtin: <math.h> does not go with the log() macro */
+static double wave_sin(double x)
+{
+	return __builtin_sin(6.283185307179586 * x);
+}
+
+static int parse(const char *spec)
+{
+	char buf[256], *key, *val, *save = NULL;
+	int i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.sensors = SIM_DEFAULT_SENSORS;
+	cfg.rate = SIM_DEFAULT_RATE;
+	cfg.period = 600;
+	cfg.amp = 5;
+	cfg.noise = 0.1;
+	cfg.burstx = 10;
+	cfg.report = SIM_REPORT_S;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (key = strtok_r(buf, ",", &save); key; key = strtok_r(NULL, ",", &save)) {
+		val = strchr(key, '=');
+		if (val == NULL) {
+			log(TAG, LOG_ERROR, "%s: expected key=value\n", key);
+			return -1;
+		}
+		*val++ = 0;
+
+		if (!strcmp(key, "sensors")) {
+			cfg.sensors = strtoul(val, NULL, 0);
+		} else if (!strcmp(key, "rate")) {
+			cfg.rate = strtod(val, NULL);
+		} else if (!strcmp(key, "wave")) {
+			for (i = 0; i < 4 && strcmp(val, wave_names[i]); i++)
+				;
+			if (i == 4) {
+				log(TAG, LOG_ERROR, "unknown wave %s\n", val);
+				return -1;
+			}
+			cfg.wave = i;
+		} else if (!strcmp(key, "period")) {
+			cfg.period = strtod(val, NULL);
+		} else if (!strcmp(key, "amp")) {
+			cfg.amp = strtod(val, NULL);
+		} else if (!strcmp(key, "noise")) {
+			cfg.noise = strtod(val, NULL);
+		} else if (!strcmp(key, "drop")) {
+			cfg.drop = strtoul(val, NULL, 0);
+		} else if (!strcmp(key, "burst")) {
+			cfg.burst = strtoul(val, NULL, 0);
+		} else if (!strcmp(key, "burstx")) {
+			cfg.burstx = strtod(val, NULL);
+		} else if (!strcmp(key, "trace")) {
+			snprintf(cfg.trace, sizeof(cfg.trace), "%s", val);
+		} else if (!strcmp(key, "report")) {
+			cfg.report = strtoul(val, NULL, 0);
+		} else {
+			log(TAG, LOG_ERROR, "unknown key %s\n", key);
+			return -1;
+		}
+	}
+
+	if (cfg.sensors == 0 || cfg.sensors > SIM_MAX_SENSORS || cfg.rate <= 0 ||
+	    cfg.period <= 0 || cfg.burstx <= 0 || cfg.drop > 1000 || cfg.report == 0) {
+		log(TAG, LOG_ERROR, "bad spec: %s\n", spec);
+		return -1;
+	}
+	return 0;
+}
+
+/* a field of the export CSV, empty is NaN */
+static const char *field(const char *p, float *v)
+{
+	char *end;
+
+	if (*p == ',' || *p == '\n' || *p == '\r' || *p == 0) {
+		*v = __builtin_nanf("");
+		return p;
+	}
+	*v = strtof(p, &end);
+	return end == p ? NULL : end;
+}
+
+/* time,temp,hum lines as written by db_export(), the header and the dev column are skipped */
+static int load_trace(const char *path)
+{
+	STATUS_FAST_T *t;
+	unsigned size = 0;
+	char line[128];
+	const char *p;
+	char *end;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		log(TAG, LOG_ERROR, "open trace %s failed\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (traceLen == size) {
+			size = size ? size * 2 : 1024;
+			t = realloc(trace, size * sizeof(*trace));
+			if (t == NULL)
+				break;
+			trace = t;
+		}
+		t = &trace[traceLen];
+		t->time = strtoll(line, &end, 10);
+		if (end == line || *end != ',')
+			continue;
+		p = field(end + 1, &t->fTemp);
+		if (p == NULL || *p != ',' || field(p + 1, &t->fHum) == NULL)
+			continue;
+		traceLen++;
+	}
+	fclose(fp);
+
+	if (traceLen == 0) {
+		log(TAG, LOG_ERROR, "no samples in trace %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void make(unsigned i, double t, time_t now, STATUS_FAST_T *s)
+{
+	VSENSOR_T *v = &fleet[i];
+	double x, w;
+
+	if (trace) {
+		*s = trace[v->traceAt];
+		if (++v->traceAt == traceLen)
+			v->traceAt = 0;
+		s->time = now;
+		return;
+	}
+
+	/* the sensors are spread over one period of the waveform */
+	x = t / cfg.period + (double)i / cfg.sensors;
+	x -= (uint64_t)x;
+	switch (cfg.wave) {
+	case WAVE_SQUARE:
+		w = x < 0.5 ? 1 : -1;
+		break;
+	case WAVE_RAMP:
+		w = 2 * x - 1;
+		break;
+	case WAVE_WALK:
+		v->walk = clamp(v->walk + 0.05 * uniform(), -1, 1);
+		w = v->walk;
+		break;
+	default:
+		w = wave_sin(x);
+		break;
+	}
+	s->time = now;
+	s->fTemp = BASE_TEMP + cfg.amp * w + cfg.noise * uniform();
+	s->fHum = clamp(BASE_HUM + 2 * cfg.amp * w + cfg.noise * uniform(), 0, 100);
+}
+
+static void mark(uint64_t injected, int64_t now)
+{
+	MARK_T *m;
+
+	if (markHead != markTail && marks[(markHead - 1) % SIM_MARKS].injected == injected)
+		return;
+	/* full, a backlog of seconds: the last mark covers this tick too */
+	if (markHead - markTail == SIM_MARKS) {
+		marks[(markHead - 1) % SIM_MARKS].injected = injected;
+		return;
+	}
+	m = &marks[markHead++ % SIM_MARKS];
+	m->injected = injected;
+	m->ns = now;
+}
+
+/* lag of the samples committed since the last tick */
+static void lag(int64_t now)
+{
+	DB_STORE_STATS_T ds;
+	int64_t last = -1, pending = 0;
+	uint64_t done;
+
+	db_store_stats(&ds);
+	done = ds.stored + ds.failed - storedBase;
+	while (markHead != markTail && marks[markTail % SIM_MARKS].injected <= done)
+		last = now - marks[markTail++ % SIM_MARKS].ns;
+	/* a stalled store shows as the age of what still waits */
+	if (markHead != markTail)
+		pending = now - marks[markTail % SIM_MARKS].ns;
+
+	pthread_mutex_lock(&stats_lock);
+	st.stored = done;
+	if (last >= 0)
+		st.lagLastMs = last / 1000000;
+	if (st.lagLastMs > intervalMaxMs)
+		intervalMaxMs = st.lagLastMs;
+	if (pending / 1000000 > intervalMaxMs)
+		intervalMaxMs = pending / 1000000;
+	if (intervalMaxMs > st.lagMaxMs)
+		st.lagMaxMs = intervalMaxMs;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void report(int64_t now)
+{
+	SIM_STATS_T s;
+	double dt = (double)(now - reportNs) / NS_PER_S;
+
+	pthread_mutex_lock(&stats_lock);
+	s = st;
+	pthread_mutex_unlock(&stats_lock);
+
+	log(TAG, LOG_INFO, "%u sensors at %.0f/s: injected %.0f/s stored %.0f/s, "
+	    "filtered %llu refused %llu silent %llu, backlog %llu, lag %lld ms max %lld ms\n",
+	    cfg.sensors, cfg.rate,
+	    (s.injected - reported.injected) / dt, (s.stored - reported.stored) / dt,
+	    (unsigned long long)(s.filtered - reported.filtered),
+	    (unsigned long long)(s.refused - reported.refused),
+	    (unsigned long long)(s.silent - reported.silent),
+	    (unsigned long long)(s.injected - s.stored),
+	    (long long)s.lagLastMs, (long long)intervalMaxMs);
+
+	reported = s;
+	reportNs = now;
+	intervalMaxMs = 0;
+}
+
+static int tick(int id, void *arg)
+{
+	uint64_t n, due, silent = 0, injected = 0, filtered = 0, refused = 0;
+	int64_t now = now_ns();
+	time_t wall = time(NULL);
+	int queued;
+	unsigned full;
+	STATUS_FAST_T s;
+	double rate = cfg.rate, t;
+	VSENSOR_T *v;
+	unsigned i;
+
+	if (startNs == 0) {
+		DB_STORE_STATS_T ds;
+
+		db_store_stats(&ds);
+		storedBase = ds.stored + ds.failed;
+		startNs = lastNs = reportNs = now;
+	}
+
+	/* the last second of every burst period runs burstx faster */
+	t = (double)(now - startNs) / NS_PER_S;
+	if (cfg.burst && (uint64_t)t % cfg.burst == cfg.burst - 1)
+		rate *= cfg.burstx;
+	/* a late tick catches up, by one second at most */
+	tokens += rate * (now - lastNs) / NS_PER_S;
+	if (tokens > rate)
+		tokens = rate;
+	lastNs = now;
+	n = due = (uint64_t)tokens;
+	tokens -= n;
+
+	while (n--) {
+		i = next;
+		if (++next == cfg.sensors)
+			next = 0;
+		v = &fleet[i];
+		if (v->silent) {
+			v->silent--;
+			silent++;
+			continue;
+		}
+		if (cfg.drop && (uniform() + 1) * 500 < cfg.drop)
+			v->silent = SIM_DROP_SAMPLES;
+
+		make(i, t, wall, &s);
+		/* virtual sensor i is device i + 1 */
+		queued = collect_ingest(i + 1, &s, &full);
+		if (queued == 0 && full == 0)
+			filtered++;
+		injected += queued;
+		refused += full;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	st.generated += due;
+	st.silent += silent;
+	st.injected += injected;
+	st.filtered += filtered;
+	st.refused += refused;
+	injected = st.injected;
+	pthread_mutex_unlock(&stats_lock);
+
+	mark(injected, now);
+	lag(now);
+	if (now - reportNs >= (int64_t)cfg.report * NS_PER_S)
+		report(now);
+	return 0;
+}
+
+int sim_start(const char *spec)
+{
+	unsigned i;
+
+	if (fleet || parse(spec) != 0)
+		return -1;
+	if (cfg.trace[0] && load_trace(cfg.trace) != 0)
+		goto err;
+
+	fleet = calloc(cfg.sensors, sizeof(*fleet));
+	if (fleet == NULL)
+		goto err;
+	for (i = 0; i < cfg.sensors; i++) {
+		fleet[i].walk = uniform();
+		if (trace)
+			fleet[i].traceAt = (uint64_t)i * traceLen / cfg.sensors;
+	}
+
+	if (collect_add("sim", SIM_TICK_MS, 0, COLLECT_BUS_NONE, tick, NULL) < 0)
+		goto err;
+
+	log(TAG, LOG_INFO, "%u virtual sensors, %.0f samples/s, %s%s\n", cfg.sensors, cfg.rate,
+	    trace ? "trace " : wave_names[cfg.wave], trace ? cfg.trace : "");
+	if (glb->pRegistry && cfg.sensors > glb->pRegistry->cap)
+		log(TAG, LOG_WARNING, "the registry tracks only %u of them\n", glb->pRegistry->cap);
+	return 0;
+
+err:
+	log(TAG, LOG_ERROR, "sim_start failed\n");
+	free(fleet);
+	free(trace);
+	fleet = NULL;
+	trace = NULL;
+	traceLen = 0;
+	return -1;
+}
+
+void sim_stop(void)
+{
+	SIM_STATS_T s;
+	double dt;
+
+	if (fleet == NULL)
+		return;
+
+	sim_stats(&s);
+	dt = startNs ? (double)(lastNs - startNs) / NS_PER_S : 0;
+	log(TAG, LOG_INFO, "%llu samples in %.1f s: injected %.0f/s stored %.0f/s, "
+	    "filtered %llu refused %llu silent %llu, lag max %lld ms\n",
+	    (unsigned long long)s.generated, dt,
+	    dt > 0 ? s.injected / dt : 0, dt > 0 ? s.stored / dt : 0,
+	    (unsigned long long)s.filtered, (unsigned long long)s.refused, (unsigned long long)s.silent,
+	    (long long)s.lagMaxMs);
+
+	free(fleet);
+	free(trace);
+	fleet = NULL;
+	trace = NULL;
+	traceLen = 0;
+	next = 0;
+	tokens = 0;
+	startNs = 0;
+	markHead = markTail = 0;
+	memset(&st, 0, sizeof(st));
+	memset(&reported, 0, sizeof(reported));
+	intervalMaxMs = 0;
+}
+
+void sim_stats(SIM_STATS_T *s)
+{
+	pthread_mutex_lock(&stats_lock);
+	*s = st;
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -2,6 +2,10 @@
 
 
 #include "common.h"
+#include "history.h"
+#include "registry.h"
+#include "filter.h"
+#include "db_backend.h"
 
 #define TAG "common"
 
@@ -14,9 +18,32 @@ int parse_config()
 {
 	log(TAG, LOG_INFO, "config parse\n");
 
+	if (glb->pConfig == NULL) {
+		glb->pConfig = (CONFIG_COMMON_T *)calloc(1, sizeof(CONFIG_COMMON_T));
+		if (glb->pConfig == NULL)
+			return -1;
+	}
+	/* 默认参数 */
+	glb->pConfig->historyLen = HISTORY_DEFAULT_LEN;
+	glb->pConfig->registryDevs = REGISTRY_DEFAULT_DEVS;
+	//入库前过滤：温湿度没有超出误差的样本不存，最长filterSilence秒存一次
+	glb->pConfig->filterMode = FILTER_DEFAULT_MODE;
+	glb->pConfig->filterTemp = FILTER_DEFAULT_TEMP;
+	glb->pConfig->filterHum = FILTER_DEFAULT_HUM;
+	glb->pConfig->filterSilence = FILTER_DEFAULT_SILENCE;
+	//样本存储引擎：sqlite落盘，memory仅内存（测试台/性能测试）
+	snprintf(glb->pConfig->dbBackend, sizeof(glb->pConfig->dbBackend), "%s", DB_BACKEND_DEFAULT);
+	glb->pConfig->memSamples = DB_MEMORY_SAMPLES;
+	//模拟传感器(压测用)，默认不开
+	glb->pConfig->simSpec[0] = 0;
+	//串口/hidraw/蓝牙传感器，默认没有(-d添加)
+	glb->pConfig->deviceCount = 0;
+
 
 	/* 使用XML 配置文件*/
 
+	glb->pConfig->isInit = 1;
+
 	return 0;
 
 }
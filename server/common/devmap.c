@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "devmap.h"
+
+#define DEVMAP_MIN	64
+
+typedef struct{
+	uint64_t id;
+	void *rec;		/* NULL while free */
+}DEVMAP_ENTRY_T;
+
+struct DEVMAP_T{
+	size_t size;
+	uint32_t mask;
+	unsigned count;
+	DEVMAP_ENTRY_T *slots;
+};
+
+/* same mix as the registry: IDs are often sequential */
+static uint32_t hash_of(uint64_t id)
+{
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	id *= 0xc4ceb9fe1a85ec53ULL;
+	id ^= id >> 33;
+	return (uint32_t)id;
+}
+
+static DEVMAP_ENTRY_T *probe(DEVMAP_ENTRY_T *slots, uint32_t mask, uint64_t id)
+{
+	uint32_t i = hash_of(id) & mask;
+
+	while (slots[i].rec && slots[i].id != id)
+		i = (i + 1) & mask;
+	return &slots[i];
+}
+
+DEVMAP_T *devmap_create(size_t size)
+{
+	DEVMAP_T *m = calloc(1, sizeof(*m));
+
+	if (m == NULL)
+		return NULL;
+	m->slots = calloc(DEVMAP_MIN, sizeof(*m->slots));
+	if (m->slots == NULL) {
+		free(m);
+		return NULL;
+	}
+	m->size = size;
+	m->mask = DEVMAP_MIN - 1;
+	return m;
+}
+
+void devmap_destroy(DEVMAP_T *m)
+{
+	if (m == NULL)
+		return;
+	devmap_clear(m);
+	free(m->slots);
+	free(m);
+}
+
+static int grow(DEVMAP_T *m)
+{
+	uint32_t size = (m->mask + 1) * 2, i;
+	DEVMAP_ENTRY_T *slots = calloc(size, sizeof(*slots));
+
+	if (slots == NULL)
+		return -1;
+	for (i = 0; i <= m->mask; i++) {
+		if (m->slots[i].rec)
+			*probe(slots, size - 1, m->slots[i].id) = m->slots[i];
+	}
+	free(m->slots);
+	m->slots = slots;
+	m->mask = size - 1;
+	return 0;
+}
+
+void *devmap_get(DEVMAP_T *m, uint64_t id, int create)
+{
+	DEVMAP_ENTRY_T *e = probe(m->slots, m->mask, id);
+
+	if (e->rec || !create)
+		return e->rec;
+
+	if (2 * (m->count + 1) > m->mask + 1) {
+		if (grow(m) != 0)
+			return NULL;
+		e = probe(m->slots, m->mask, id);
+	}
+	e->rec = calloc(1, m->size);
+	if (e->rec == NULL)
+		return NULL;
+	e->id = id;
+	m->count++;
+	return e->rec;
+}
+
+int devmap_each(DEVMAP_T *m, int (*cb)(uint64_t id, void *rec, void *arg), void *arg)
+{
+	uint32_t i;
+	int rc;
+
+	for (i = 0; i <= m->mask; i++) {
+		if (m->slots[i].rec && (rc = cb(m->slots[i].id, m->slots[i].rec, arg)) != 0)
+			return rc;
+	}
+	return 0;
+}
+
+void devmap_clear(DEVMAP_T *m)
+{
+	uint32_t i;
+
+	for (i = 0; i <= m->mask; i++) {
+		free(m->slots[i].rec);
+		m->slots[i].rec = NULL;
+	}
+	m->count = 0;
+}
+
+unsigned devmap_count(DEVMAP_T *m)
+{
+	return m->count;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "history.h"
+
+#define CACHE_LINE 64
+
+/* STATUS_FAST_T without the device, 16 bytes */
+typedef struct{
+	int64_t time;
+	float temp;
+	float hum;
+}HISTORY_SAMPLE_T;
+
+typedef struct{
+	/* samples pushed, slot of sample i is i & mask */
+	_Atomic uint64_t head __attribute__((aligned(CACHE_LINE)));
+	uint64_t dev;
+	HISTORY_SAMPLE_T samples[] __attribute__((aligned(CACHE_LINE)));
+}HISTORY_RING_T;
+
+struct HISTORY_T{
+	uint32_t mask;
+	unsigned slots;
+	HISTORY_RING_T *_Atomic *rings;	/* NULL until the first sample of the slot */
+};
+
+HISTORY_T *history_create(unsigned slots, unsigned len)
+{
+	HISTORY_T *h;
+	uint32_t size = 2;
+
+	while (size < len && size < (1u << 24))
+		size <<= 1;
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL)
+		return NULL;
+	h->rings = calloc(slots ? slots : 1, sizeof(*h->rings));
+	if (h->rings == NULL) {
+		free(h);
+		return NULL;
+	}
+	h->mask = size - 1;
+	h->slots = slots;
+	return h;
+}
+
+void history_destroy(HISTORY_T *h)
+{
+	unsigned i;
+
+	if (h == NULL)
+		return;
+	for (i = 0; i < h->slots; i++)
+		free(atomic_load_explicit(&h->rings[i], memory_order_relaxed));
+	free(h->rings);
+	free(h);
+}
+
+/* ring of slot, NULL if none */
+static HISTORY_RING_T *ring_of(HISTORY_T *h, int slot)
+{
+	if (slot < 0 || (unsigned)slot >= h->slots)
+		return NULL;
+	return atomic_load_explicit(&h->rings[slot], memory_order_acquire);
+}
+
+void history_push(HISTORY_T *h, int slot, const STATUS_FAST_T *s)
+{
+	HISTORY_RING_T *r = ring_of(h, slot);
+	HISTORY_SAMPLE_T *e;
+	uint64_t head;
+
+	if (r == NULL) {
+		if (slot < 0 || (unsigned)slot >= h->slots)
+			return;
+		if (posix_memalign((void **)&r, CACHE_LINE,
+				   sizeof(*r) + (h->mask + 1) * sizeof(HISTORY_SAMPLE_T)))
+			return;
+		atomic_init(&r->head, 0);
+		r->dev = s->dev;
+		/* readers see the ring only once it is initialized */
+		atomic_store_explicit(&h->rings[slot], r, memory_order_release);
+	}
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	e = &r->samples[head & h->mask];
+	e->time = s->time;
+	e->temp = s->fTemp;
+	e->hum = s->fHum;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+unsigned history_read(HISTORY_T *h, int slot, STATUS_FAST_T *out, unsigned max)
+{
+	HISTORY_RING_T *r = ring_of(h, slot);
+	const HISTORY_SAMPLE_T *e;
+	uint64_t head, last, first, i;
+	unsigned size = h->mask + 1;
+
+	if (r == NULL)
+		return 0;
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+	if (max > size)
+		max = size;
+	if (max > head)
+		max = head;
+	first = head - max;
+
+	for (i = first; i < head; i++) {
+		e = &r->samples[i & h->mask];
+		out[i - first].time = e->time;
+		out[i - first].fTemp = e->temp;
+		out[i - first].fHum = e->hum;
+		out[i - first].dev = r->dev;
+	}
+
+	/*
+	 * While we copied, the writer may have stored samples up to last and be
+	 * storing sample last, so the slots of samples before last + 1 - size
+	 * may hold newer data: drop them.
+	 */
+	atomic_thread_fence(memory_order_acquire);
+	last = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (last + 1 > first + size) {
+		i = last + 1 - size - first;
+		if (i >= max)
+			return 0;
+		memmove(out, out + i, (max - i) * sizeof(*out));
+		max -= i;
+	}
+	return max;
+}
+
+unsigned history_since(HISTORY_T *h, int slot, time_t since, STATUS_FAST_T *out, unsigned max)
+{
+	unsigned n = history_read(h, slot, out, max), i = 0;
+
+	while (i < n && out[i].time < since)
+		i++;
+	if (i > 0)
+		memmove(out, out + i, (n - i) * sizeof(*out));
+	return n - i;
+}
+
+uint64_t history_count(HISTORY_T *h, int slot)
+{
+	HISTORY_RING_T *r = ring_of(h, slot);
+
+	return r ? atomic_load_explicit(&r->head, memory_order_acquire) : 0;
+}
+
+unsigned history_len(HISTORY_T *h)
+{
+	return h->mask + 1;
+}
@@ -24,9 +24,7 @@
  * logging functions
  */
 
-#if HAVE_UNISTD_H
 #include <unistd.h>
-#endif
 #if HAVE_IO_H
 #include <io.h>
 #endif
@@ -41,9 +39,13 @@
 #include <limits.h>
 #include <errno.h>
 #include <time.h>
+#include <stdatomic.h>
 #include "error.h"
 
 #include "log.h"
+#include "log_ring.h"
+#include "log_binary.h"
+#include "log_mmap.h"
 
 typedef enum {
     CLASS_CATEGORY_NA = 0,
@@ -116,37 +118,14 @@ typedef enum {
 
 
 
-void *realloc(void *ptr, size_t size)
+static void *log_realloc(void *ptr, size_t size)
 {
-	void *ret;
-
-#define ATOMIC_VAR_INIT(value) (value)
-	/* NOTE: if you want to override these functions with your own
-	 * implementations (not recommended) you have to link libav* as
-	 * dynamic libraries and remove -Wl,-Bsymbolic from the linker flags.
-	 * Note that this will cost performance. */
-
-	static intptr_t max_alloc_size = ATOMIC_VAR_INIT(2147483647);
+    static const size_t max_alloc_size = 2147483647;
 
-#define atomic_load(object) \
-	(*(object))
-#define atomic_load_explicit(object, order) \
-	atomic_load(object)
+    if (size > max_alloc_size)
+        return NULL;
 
-
-	if (size > atomic_load_explicit(&max_alloc_size, memory_order_relaxed))
-		return NULL;
-
-#if HAVE_ALIGNED_MALLOC
-    ret = _aligned_realloc(ptr, size + !size, ALIGN);
-#else
-    ret = realloc(ptr, size + !size);
-#endif
-#if CONFIG_MEMORY_POISONING
-    if (ret && !ptr)
-        memset(ret, FF_MEMORY_POISON, size);
-#endif
-    return ret;
+    return realloc(ptr, size + !size);
 }
 
 static void *memdup(const void *p, size_t size)
@@ -389,7 +368,7 @@ static int bprint_alloc(AVBPrint *buf, unsigned room)
     if (new_size < min_size)
         new_size = FFMIN(buf->size_max, min_size);
     old_str = bprint_is_allocated(buf) ? buf->str : NULL;
-    new_str = realloc(old_str, new_size);
+    new_str = log_realloc(old_str, new_size);
     if (!new_str)
         return AVERROR(ENOMEM);
     if (!old_str)
@@ -582,7 +561,7 @@ int bprint_finalize(AVBPrint *buf, char **ret_str)
 
     if (ret_str) {
         if (bprint_is_allocated(buf)) {
-            str = realloc(buf->str, real_size);
+            str = log_realloc(buf->str, real_size);
             if (!str)
                 str = buf->str;
             buf->str = NULL;
@@ -608,7 +587,7 @@ int bprint_finalize(AVBPrint *buf, char **ret_str)
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-#define LINE_SZ 1024
+#define LINE_SZ 4096
 
 #if HAVE_VALGRIND_VALGRIND_H
 #include <valgrind/valgrind.h>
@@ -808,35 +787,13 @@ static void check_color_terminal(void)
         use_color *= 256;
 }
 
-static void ansi_fputs(int level, int tint, const char *str, int local_use_color)
-{
-	if (local_use_color == 1) {
-		fprintf(stderr,
-				"\033[%"PRIu32";3%"PRIu32"m%s\033[0m",
-				(color[level] >> 4) & 15,
-				color[level] & 15,
-				str);
-	} else if (tint && use_color == 256) {
-		fprintf(stderr,
-				"\033[48;5;%"PRIu32"m\033[38;5;%dm%s\033[0m",
-				(color[level] >> 16) & 0xff,
-				tint,
-				str);
-	} else if (local_use_color == 256) {
-		fprintf(stderr,
-				"\033[48;5;%"PRIu32"m\033[38;5;%"PRIu32"m%s\033[0m",
-				(color[level] >> 16) & 0xff,
-				(color[level] >> 8) & 0xff,
-				str);
-	} else
-		fputs(str, stderr);
-}
-
-static void colored_fputs(int level, int tint, const char *str)
+/**
+ * Escape sequence starting a part of the given color class.
+ * @return length written to dst, 0 if the part is not colored
+ */
+static int color_start(char *dst, int level, int tint)
 {
     int local_use_color;
-    if (!*str)
-        return;
 
     if (use_color < 0)
         check_color_terminal();
@@ -850,28 +807,38 @@ static void colored_fputs(int level, int tint, const char *str)
 	local_use_color = 1;
 #endif
 
-#if defined(_WIN32) && HAVE_SETCONSOLETEXTATTRIBUTE && HAVE_GETSTDHANDLE
-    if (con != INVALID_HANDLE_VALUE) {
-        if (local_use_color)
-            SetConsoleTextAttribute(con, background | color[level]);
-        win_console_puts(str);
-        if (local_use_color)
-            SetConsoleTextAttribute(con, attr_orig);
-    } else {
-        ansi_fputs(level, tint, str, local_use_color);
-    }
-#else
-    ansi_fputs(level, tint, str, local_use_color);
-#endif
-
+	if (local_use_color == 1) {
+		return sprintf(dst, "\033[%"PRIu32";3%"PRIu32"m",
+				(color[level] >> 4) & 15,
+				color[level] & 15);
+	} else if (tint && use_color == 256) {
+		return sprintf(dst, "\033[48;5;%"PRIu32"m\033[38;5;%dm",
+				(color[level] >> 16) & 0xff,
+				tint);
+	} else if (local_use_color == 256) {
+		return sprintf(dst, "\033[48;5;%"PRIu32"m\033[38;5;%"PRIu32"m",
+				(color[level] >> 16) & 0xff,
+				(color[level] >> 8) & 0xff);
+	}
+	return 0;
 }
 
-static void sanitize(uint8_t *line){
-    while(*line){
-        if(*line < 0x08 || (*line > 0x0D && *line < 0x20))
-            *line='?';
-        line++;
+#define COLOR_END       "\033[0m"
+#define COLOR_MAX       32
+
+/**
+ * Append str to dst, replacing control characters the way sanitize() did.
+ */
+static char *sanitize_copy(char *dst, const char *str, int len)
+{
+    const uint8_t *p = (const uint8_t *)str;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        uint8_t c = p[i];
+        *dst++ = (c < 0x08 || (c > 0x0D && c < 0x20)) ? '?' : c;
     }
+    return dst;
 }
 
 static const char *get_level_str(int level)
@@ -900,28 +867,104 @@ static const char *get_level_str(int level)
     }
 }
 
-static void format_line(void *name, int level, const char *fmt, va_list vl,
-                        AVBPrint part[4], int *print_prefix, int type[2])
+/**
+ * A formatted line: the 4 parts of the default callback stored back to back
+ * in str, which is LINE_SZ bytes long when allocated with LOG_LINE_ALLOC.
+ */
+typedef struct LogLine {
+    int level;
+    unsigned tint;
+    int type[2];
+    int print_prefix;
+    int start;          ///< the line begins a new message
+    int len[4];         ///< length of each part of str
+    char str[];         ///< the parts without separators, 0-terminated
+} LogLine;
+
+#define LOG_LINE_ALLOC (sizeof(LogLine) + LINE_SZ)
+
+/** per thread line buffer, so formatting never needs the heap or the mutex */
+static __thread uint64_t tls_line[(LOG_LINE_ALLOC + 7) / 8];
+
+static int append_str(char *dst, int size, int pos, const char *str)
 {
-    bprint_init(part+0, 0, BPRINT_SIZE_AUTOMATIC);
-    bprint_init(part+1, 0, BPRINT_SIZE_AUTOMATIC);
-    bprint_init(part+2, 0, BPRINT_SIZE_AUTOMATIC);
-    bprint_init(part+3, 0, 65536);
+    int len = strlen(str);
 
-    if(type) type[0] = type[1] = CLASS_CATEGORY_NA + 16;
+    if (pos < size)
+        memcpy(dst + pos, str, FFMIN(len, size - pos));
+    return pos + len;
+}
 
-	if (*print_prefix && name) {
-		bprintf(part+1, "[%s @ %s] ", (char *)name, "reserve");
-	}
-    if (*print_prefix && (level > LOG_QUIET) && (flags & LOG_PRINT_LEVEL))
-        bprintf(part+2, "[%s] ", get_level_str(level));
+/**
+ * Write the name and level prefixes of a line.
+ * @return the full length of the prefix, which may exceed size
+ */
+static int format_prefix(void *name, int level, int print_prefix,
+                         char *dst, int size, int len[4])
+{
+    int pos = 0;
 
-    vbprintf(part+3, fmt, vl);
+    len[0] = 0;
+    if (print_prefix && name) {
+        pos = append_str(dst, size, pos, "[");
+        pos = append_str(dst, size, pos, name);
+        pos = append_str(dst, size, pos, " @ reserve] ");
+    }
+    len[1] = pos;
+    if (print_prefix && (level > LOG_QUIET) && (flags & LOG_PRINT_LEVEL)) {
+        pos = append_str(dst, size, pos, "[");
+        pos = append_str(dst, size, pos, get_level_str(level));
+        pos = append_str(dst, size, pos, "] ");
+    }
+    len[2] = pos - len[1];
 
-    if(*part[0].str || *part[1].str || *part[2].str || *part[3].str) {
-        char lastc = part[3].len && part[3].len <= part[3].size ? part[3].str[part[3].len - 1] : 0;
-        *print_prefix = lastc == '\n' || lastc == '\r';
+    /* only count what fits in the buffer */
+    len[1] = FFMIN(len[1], FFMAX(size - 1, 0));
+    len[2] = FFMIN(len[2], FFMAX(size - 1 - len[1], 0));
+    return pos;
+}
+
+static void update_prefix(const char *msg, int len, int complete, const char *fmt,
+                          int prefix_len, int *print_prefix)
+{
+    char lastc;
+    size_t fmt_len;
+
+    if (complete) {
+        lastc = len ? msg[len - 1] : 0;
+    } else {
+        /* truncated, the end of the format is the best guess we have */
+        fmt_len = strlen(fmt);
+        lastc = fmt_len ? fmt[fmt_len - 1] : 0;
     }
+    if (prefix_len || len)
+        *print_prefix = lastc == '\n' || lastc == '\r';
+}
+
+/**
+ * Format a line into dst, which is always 0-terminated when size > 0.
+ * @return the length of the full line, as snprintf()
+ */
+static int format_line(void *name, int level, const char *fmt, va_list vl,
+                       char *dst, int size, int len[4], int *print_prefix)
+{
+    int pos, room, ret;
+    va_list vl2;
+
+    pos = format_prefix(name, level, *print_prefix, dst, size, len);
+    room = pos < size ? size - pos : 0;
+
+    va_copy(vl2, vl);
+    ret = vsnprintf(room ? dst + pos : NULL, room, fmt, vl2);
+    va_end(vl2);
+    if (ret < 0)
+        ret = 0;
+    if (size > 0 && pos >= size)
+        dst[size - 1] = 0;
+
+    len[3] = FFMIN(ret, FFMAX(room - 1, 0));
+    update_prefix(dst + pos, len[3], ret < room, fmt, pos, print_prefix);
+    return pos + ret;
 }
 
 void log_format_line(void *name, int level, const char *fmt, va_list vl,
@@ -933,75 +976,890 @@ void log_format_line(void *name, int level, const char *fmt, va_list vl,
 int log_format_line2(void *name, int level, const char *fmt, va_list vl,
                         char *line, int line_size, int *print_prefix)
 {
-    AVBPrint part[4];
-    int ret;
+    int len[4];
 
-    format_line(name, level, fmt, vl, part, print_prefix, NULL);
-    ret = snprintf(line, line_size, "%s%s%s%s", part[0].str, part[1].str, part[2].str, part[3].str);
-    bprint_finalize(part+3, NULL);
-    return ret;
+    return format_line(name, level, fmt, vl, line, line_size, len, print_prefix);
 }
 
-void log_default_callback(void *name, int level, const char* fmt, va_list vl)
+static void write_all(const char *buf, int len)
 {
-    static int print_prefix = 1;
-    static int count;
-    static char prev[LINE_SZ];
-    AVBPrint part[4];
-    char line[LINE_SZ];
-    static int is_atty;
-    int type[2];
-    unsigned tint = 0;
+    ssize_t n;
 
-    if (level >= 0) {
-        tint = level & 0xff00;
-        level &= 0xff;
+    while (len > 0) {
+        n = write(2, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static LOG_MMAP_T *log_file;       ///< LOG_TO_FILE destination, under the mutex
+
+static int file_active(void)
+{
+    return (flags & LOG_TO_FILE) && log_file;
+}
+
+/**
+ * Append a line to the log file, without colors and with a timestamp at the
+ * start of each message. Errors and above are synced right away.
+ * Must be called with the mutex held.
+ */
+static void file_line(const LogLine *line)
+{
+    static char out[LINE_SZ + 32];
+    static time_t stamp_sec = -1;
+    static char stamp[24];
+    int len = line->len[0] + line->len[1] + line->len[2] + line->len[3];
+    struct timespec ts;
+    struct tm tm;
+    char *p = out;
+
+    if (line->start) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (ts.tv_sec != stamp_sec) {
+            localtime_r(&ts.tv_sec, &tm);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+            stamp_sec = ts.tv_sec;
+        }
+        p += sprintf(p, "%s.%03d ", stamp, (int)(ts.tv_nsec / 1000000));
     }
+    p = sanitize_copy(p, line->str, len);
+    log_mmap_write(log_file, out, p - out, line->level <= LOG_ERROR);
+}
+
+/**
+ * Print a message of the logger itself.
+ * Must be called with the mutex held.
+ */
+static void output_notice(const char *str)
+{
+    if (file_active())
+        log_mmap_write(log_file, str, strlen(str), 0);
+    else
+        write_all(str, strlen(str));
+}
 
-    if (level > log_level)
+/**
+ * Sanitize, colorize and print a line with a single write.
+ * Must be called with the mutex held.
+ */
+static void emit_line(const LogLine *line)
+{
+    static char out[LINE_SZ + 4 * (COLOR_MAX + sizeof(COLOR_END))];
+    int cls[4] = {
+        line->type[0], line->type[1],
+        clip(line->level >> 3, 0, NB_LEVELS - 1),
+        clip(line->level >> 3, 0, NB_LEVELS - 1),
+    };
+    int tint[4] = { 0, 0, line->tint >> 8, line->tint >> 8 };
+    const char *str = line->str;
+    char *p = out;
+    int i, n;
+
+    if (file_active()) {
+        file_line(line);
         return;
+    }
 
-	pthread_mutex_lock(&mutex);
-    format_line(name, level, fmt, vl, part, &print_prefix, type);
-    snprintf(line, sizeof(line), "%s%s%s%s", part[0].str, part[1].str, part[2].str, part[3].str);
+    for (i = 0; i < 4; str += line->len[i], i++) {
+        if (!line->len[i])
+            continue;
+#if defined(_WIN32) && HAVE_SETCONSOLETEXTATTRIBUTE && HAVE_GETSTDHANDLE
+        if (con != INVALID_HANDLE_VALUE) {
+            char part[LINE_SZ];
+            *sanitize_copy(part, str, line->len[i]) = 0;
+            SetConsoleTextAttribute(con, background | color[cls[i]]);
+            win_console_puts(part);
+            SetConsoleTextAttribute(con, attr_orig);
+            continue;
+        }
+#endif
+        n = color_start(p, cls[i], tint[i]);
+        p = sanitize_copy(p + n, str, line->len[i]);
+        if (n) {
+            memcpy(p, COLOR_END, sizeof(COLOR_END) - 1);
+            p += sizeof(COLOR_END) - 1;
+        }
+    }
+    write_all(out, p - out);
+}
+
+/**
+ * Print one formatted line, taking care of repeated lines.
+ * Must be called with the mutex held.
+ */
+static void log_output(const LogLine *line)
+{
+    static int count;
+    static char prev[LINE_SZ];
+    static int is_atty;
+    int len = line->len[0] + line->len[1] + line->len[2] + line->len[3];
+    char notice[64];
 
     if (!is_atty)
         is_atty = isatty(2) ? 1 : -1;
 
-    if (print_prefix && (flags & LOG_SKIP_REPEATED) && !strcmp(line, prev) &&
-        *line && line[strlen(line) - 1] != '\r'){
+    if (line->print_prefix && (flags & LOG_SKIP_REPEATED) &&
+        !strcmp(line->str, prev) && len && line->str[len - 1] != '\r'){
         count++;
-        if (is_atty == 1)
+        if (is_atty == 1 && !file_active())
             fprintf(stderr, "    Last message repeated %d times\r", count);
-        goto end;
+        return;
     }
     if (count > 0) {
-        fprintf(stderr, "    Last message repeated %d times\n", count);
+        snprintf(notice, sizeof(notice), "    Last message repeated %d times\n", count);
+        output_notice(notice);
         count = 0;
     }
-    strcpy(prev, line);
-    sanitize((uint8_t *)part[0].str);
-    colored_fputs(type[0], 0, part[0].str);
-    sanitize((uint8_t *)part[1].str);
-    colored_fputs(type[1], 0, part[1].str);
-    sanitize((uint8_t *)part[2].str);
-    colored_fputs(clip(level >> 3, 0, NB_LEVELS - 1), tint >> 8, part[2].str);
-    sanitize((uint8_t *)part[3].str);
-    colored_fputs(clip(level >> 3, 0, NB_LEVELS - 1), tint >> 8, part[3].str);
+    memcpy(prev, line->str, len + 1);
+    emit_line(line);
 
 #if CONFIG_VALGRIND_BACKTRACE
-    if (level <= BACKTRACE_LOGLEVEL)
+    if (line->level <= BACKTRACE_LOGLEVEL)
         VALGRIND_PRINTF_BACKTRACE("%s", "");
 #endif
-end:
-    bprint_finalize(part+3, NULL);
+}
 
-	pthread_mutex_unlock(&mutex);
+/******************************************************************************************************/
+
+/* asynchronous mode: callers push formatted lines, the log thread prints them */
+
+#define ASYNC_BATCH     64
+#define ASYNC_IDLE_NS   (2 * 1000 * 1000)
+#define ASYNC_BLOCK_NS  (50 * 1000)
+
+static atomic_int async_running;
+static atomic_int async_producers;  ///< callers between async_enter() and async_leave()
+static atomic_int async_stop_req;
+static int async_overflow;
+static unsigned async_ring_size;
+static uint64_t async_reported;     ///< drops already reported, under the mutex
+static pthread_t async_thread;
+static LOG_BIN_FILE_T *bin_file;    ///< binary records go here when set, under the mutex
+
+static void rate_poll(void);
+static void rate_report(int64_t age, void (*callback)(void*, int, const char*, va_list));
+
+static void sleep_ns(long ns)
+{
+    struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Enter the asynchronous path; once async_running is cleared, log_async_stop()
+ * waits for the callers that got in before it drains the rings for the last time.
+ * @return 1 if the caller may push, and has to call async_leave() then
+ */
+static int async_enter(void)
+{
+    if (!atomic_load_explicit(&async_running, memory_order_relaxed))
+        return 0;
+    atomic_fetch_add(&async_producers, 1);
+    if (atomic_load(&async_running))
+        return 1;
+    atomic_fetch_sub(&async_producers, 1);
+    return 0;
+}
+
+static void async_leave(void)
+{
+    atomic_fetch_sub_explicit(&async_producers, 1, memory_order_release);
+}
+
+/**
+ * Clear async_running and wait for the callers still pushing, a blocked one
+ * gives up within ASYNC_BLOCK_NS and prints its line itself.
+ * @return 0 if the asynchronous mode was not running
+ */
+static int async_quiesce(void)
+{
+    if (!atomic_exchange(&async_running, 0))
+        return 0;
+    while (atomic_load_explicit(&async_producers, memory_order_acquire))
+        sleep_ns(ASYNC_BLOCK_NS);
+    return 1;
+}
+
+/**
+ * Reserve a record in the ring, applying the overflow policy.
+ * @return 1 if *rec can be filled, 0 if the message was dropped, a negative
+ *         value if the caller has to print the line itself
+ */
+static int async_reserve(LOG_RING_T *ring, unsigned size, unsigned type, void **rec)
+{
+    while (!(*rec = log_ring_reserve(ring, size, type))) {
+        if (async_overflow != LOG_OVERFLOW_BLOCK) {
+            log_ring_drop(ring);
+            return 0;
+        }
+        if (!atomic_load_explicit(&async_running, memory_order_relaxed))
+            return AVERROR(EAGAIN);
+        sleep_ns(ASYNC_BLOCK_NS);
+    }
+    return 1;
+}
+
+/**
+ * Copy a formatted line into the ring of the calling thread.
+ * @return 0 if the record was queued or dropped, a negative value if the
+ *         caller has to print the line itself
+ */
+static int async_push(const LogLine *line)
+{
+    LOG_RING_T *ring = log_ring_local(async_ring_size);
+    unsigned size = sizeof(*line) + line->len[0] + line->len[1] +
+                    line->len[2] + line->len[3] + 1;
+    void *rec;
+    int ret;
+
+    if (!ring)
+        return AVERROR(ENOMEM);
+
+    ret = async_reserve(ring, size, LOG_REC_TEXT, &rec);
+    if (ret <= 0)
+        return ret;
+    memcpy(rec, line, size);
+    log_ring_commit(ring);
+    return 0;
+}
+
+/**
+ * Capture the raw arguments of a message into the ring of the calling thread,
+ * formatting is left to the log thread or to tools/logdecode.
+ * @return 0 if the record was queued or dropped, a negative value if the
+ *         message has to go through the text path
+ */
+static int async_push_binary(void *name, int level, const char *fmt, va_list vl,
+                             int *print_prefix)
+{
+    LOG_RING_T *ring = log_ring_local(async_ring_size);
+    uint8_t args[LOG_BIN_MAX_ARGS];
+    LOG_BIN_REC_T *rec;
+    struct timespec ts;
+    size_t fmt_len;
+    int size, ret;
+
+    if (!ring)
+        return AVERROR(ENOMEM);
+    size = log_bin_capture(args, sizeof(args), fmt, vl);
+    if (size < 0)
+        return AVERROR(EINVAL);
+
+    ret = async_reserve(ring, sizeof(*rec) + size, LOG_REC_BINARY, (void **)&rec);
+    if (ret <= 0)
+        return ret;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->fmt          = fmt;
+    rec->name         = name;
+    rec->time         = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    rec->level        = level;
+    rec->print_prefix = *print_prefix;
+    rec->size         = size;
+    memcpy(rec->args, args, size);
+    log_ring_commit(ring);
+
+    fmt_len = strlen(fmt);
+    *print_prefix = fmt_len && (fmt[fmt_len - 1] == '\n' || fmt[fmt_len - 1] == '\r');
+    return 0;
+}
+
+/**
+ * Format a binary record the way format_line() would have.
+ */
+static void binary_output(const LOG_BIN_REC_T *rec)
+{
+    LogLine *line = (LogLine *)tls_line;
+    int pos, room, ret;
+
+    line->level = rec->level;
+    line->tint  = 0;
+    if (line->level >= 0) {
+        line->tint   = line->level & 0xff00;
+        line->level &= 0xff;
+    }
+    line->type[0] = line->type[1] = CLASS_CATEGORY_NA + 16;
+    line->print_prefix = rec->print_prefix;
+    line->start = rec->print_prefix;
+
+    pos = FFMIN(format_prefix((void *)rec->name, line->level, rec->print_prefix,
+                              line->str, LINE_SZ, line->len), LINE_SZ - 1);
+    room = LINE_SZ - pos;
+    ret = log_bin_format(line->str + pos, room, rec->fmt, rec->args, rec->size);
+    line->len[3] = FFMIN(ret, room - 1);
+    line->str[pos + line->len[3]] = 0;
+    update_prefix(line->str + pos, line->len[3], ret < room, rec->fmt, pos,
+                  &line->print_prefix);
+
+    log_output(line);
+}
+
+static void async_output(void *opaque, unsigned type, const void *data, unsigned size)
+{
+    if (type == LOG_REC_BINARY) {
+        if (bin_file)
+            log_bin_file_write(bin_file, data);
+        else
+            binary_output(data);
+    } else if (type == LOG_REC_TEXT) {
+        log_output(data);
+    }
+}
+
+static void async_report_dropped(void)
+{
+    uint64_t dropped = log_ring_dropped();
+    char notice[64];
+
+    if (dropped > async_reported) {
+        snprintf(notice, sizeof(notice), "    %"PRIu64" log messages dropped\n",
+                 dropped - async_reported);
+        output_notice(notice);
+        async_reported = dropped;
+    }
+}
+
+static void *async_thread_main(void *arg)
+{
+    int n;
+
+    for (;;) {
+        pthread_mutex_lock(&mutex);
+        n = log_ring_drain(ASYNC_BATCH, async_output, NULL);
+        async_report_dropped();
+        if (n && bin_file)
+            log_bin_file_flush(bin_file);
+        if (log_file)
+            log_mmap_poll(log_file);
+        pthread_mutex_unlock(&mutex);
+        rate_poll();
+
+        if (n)
+            continue;
+        if (atomic_load(&async_stop_req))
+            break;
+        sleep_ns(ASYNC_IDLE_NS);
+    }
+    return NULL;
+}
+
+/**
+ * Print what is left in the rings, once no one pushes any more.
+ */
+static void async_flush(void)
+{
+    pthread_mutex_lock(&mutex);
+    while (log_ring_drain(ASYNC_BATCH, async_output, NULL))
+        ;
+    async_report_dropped();
+    if (bin_file)
+        log_bin_file_flush(bin_file);
+    pthread_mutex_unlock(&mutex);
+}
+
+int log_async_start(unsigned ring_size, int overflow)
+{
+    int ret;
+
+    if (atomic_load(&async_running))
+        return AVERROR(EBUSY);
+
+    async_ring_size = ring_size;
+    async_overflow  = overflow;
+    atomic_store(&async_stop_req, 0);
+
+    /* before the thread exists, so none of its lines bypass the ring */
+    atomic_store(&async_running, 1);
+    ret = pthread_create(&async_thread, NULL, async_thread_main, NULL);
+    if (ret) {
+        async_quiesce();
+        async_flush();
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+void log_async_stop(void)
+{
+    if (!async_quiesce())
+        return;
+
+    atomic_store(&async_stop_req, 1);
+    pthread_join(async_thread, NULL);
+
+    /* lines pushed while the thread was exiting */
+    async_flush();
+    /* after them, synchronous again */
+    rate_report(0, NULL);
+}
+
+int log_binary_open(const char *path)
+{
+    LOG_BIN_FILE_T *file = log_bin_file_open(path);
+
+    if (!file)
+        return AVERROR(errno ? errno : ENOMEM);
+
+    pthread_mutex_lock(&mutex);
+    log_bin_file_close(bin_file);
+    bin_file = file;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+void log_binary_close(void)
+{
+    pthread_mutex_lock(&mutex);
+    log_bin_file_close(bin_file);
+    bin_file = NULL;
+    pthread_mutex_unlock(&mutex);
+}
+
+int log_file_open(const char *path, unsigned segment_size, int segments, int sync_ms)
+{
+    LOG_MMAP_T *file = log_mmap_open(path, segment_size, segments, sync_ms);
+
+    if (!file)
+        return AVERROR(errno ? errno : ENOMEM);
+
+    pthread_mutex_lock(&mutex);
+    log_mmap_close(log_file);
+    log_file = file;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+void log_file_close(void)
+{
+    pthread_mutex_lock(&mutex);
+    log_mmap_close(log_file);
+    log_file = NULL;
+    pthread_mutex_unlock(&mutex);
+}
+
+uint64_t log_async_dropped(void)
+{
+    return log_ring_dropped();
+}
+
+/******************************************************************************************************/
+
+void log_default_callback(void *name, int level, const char* fmt, va_list vl)
+{
+    static __thread int print_prefix = 1;
+    LogLine *line = (LogLine *)tls_line;
+    int async, ret;
+
+    line->tint = 0;
+    if (level >= 0) {
+        line->tint = level & 0xff00;
+        level &= 0xff;
+    }
+    line->level = level;
+    line->type[0] = line->type[1] = CLASS_CATEGORY_NA + 16;
+
+    async = async_enter();
+    if (async && (flags & LOG_BINARY) &&
+        async_push_binary(name, level | line->tint, fmt, vl, &print_prefix) >= 0) {
+        async_leave();
+        return;
+    }
+
+    line->start = print_prefix;
+    format_line(name, level, fmt, vl, line->str, LINE_SZ, line->len, &print_prefix);
+    line->print_prefix = print_prefix;
+
+    if (async) {
+        ret = async_push(line);
+        async_leave();
+        if (ret >= 0)
+            return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    log_output(line);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Print a message at once, never through the rings: the log thread would
+ * wait on its own ring when it is full with LOG_OVERFLOW_BLOCK.
+ */
+static void direct_callback(void *name, int level, const char *fmt, va_list vl)
+{
+    LogLine *line = (LogLine *)tls_line;
+    int print_prefix = 1;
+
+    line->tint = 0;
+    if (level >= 0) {
+        line->tint = level & 0xff00;
+        level &= 0xff;
+    }
+    line->level = level;
+    line->type[0] = line->type[1] = CLASS_CATEGORY_NA + 16;
+    line->start = print_prefix;
+    format_line(name, level, fmt, vl, line->str, LINE_SZ, line->len, &print_prefix);
+    line->print_prefix = print_prefix;
+
+    pthread_mutex_lock(&mutex);
+    log_output(line);
+    pthread_mutex_unlock(&mutex);
 }
 
 static void (*log_callback)(void*, int, const char*, va_list) = log_default_callback;
 
-void log(void *name, int level, const char *fmt, ...)
+/******************************************************************************************************/
+
+/* per call site rate limiting, keyed by the (TAG, format) pointers */
+
+#define RATE_SITES      256
+#define RATE_MILLI      1000
+#define RATE_SCAN_MS    1000    ///< the log thread looks for suppressed messages
+#define RATE_REPORT_MS  5000    ///< and reports those suppressed for that long
+
+typedef struct LogRateSite {
+    atomic_flag busy;
+    const void *name;
+    const char *fmt;
+    int64_t refill;         ///< ms of the last refill
+    int64_t since;          ///< ms of the first suppressed message
+    int tokens;             ///< in thousandths of a message
+    unsigned suppressed;
+} LogRateSite;
+
+static LogRateSite rate_sites[RATE_SITES];
+static int rate_burst = 20;
+static int rate_per_sec = 5;
+static pthread_once_t rate_once = PTHREAD_ONCE_INIT;
+static int64_t rate_scanned;        ///< log thread only
+
+static int64_t coarse_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void call_callback(void (*callback)(void*, int, const char*, va_list),
+                          void *name, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    callback(name, level, fmt, vl);
+    va_end(vl);
+}
+
+static void report_suppressed(void (*callback)(void*, int, const char*, va_list),
+                              const void *name, int level, unsigned count, int64_t ms)
+{
+    call_callback(callback, (void *)name, level,
+                  "    suppressed %u messages from %s in the last %.1f s\n",
+                  count, name ? (const char *)name : "(null)", ms / 1000.0);
+}
+
+/**
+ * Report the messages of every call site suppressed for at least age ms.
+ * A site that keeps failing its bucket, or that goes quiet, would otherwise
+ * only be reported when it may log again or is evicted.
+ * @param callback where the reports go, NULL for the current log callback
+ */
+static void rate_report(int64_t age, void (*callback)(void*, int, const char*, va_list))
+{
+    LogRateSite *site;
+    const void *name = NULL;
+    unsigned count;
+    int64_t now = coarse_ms(), elapsed = 0;
+    int i;
+
+    if (!callback)
+        callback = __atomic_load_n(&log_callback, __ATOMIC_ACQUIRE);
+    if (!callback)
+        return;
+
+    for (i = 0; i < RATE_SITES; i++) {
+        site = &rate_sites[i];
+        if (atomic_flag_test_and_set_explicit(&site->busy, memory_order_acquire))
+            continue;
+        count = 0;
+        if (site->suppressed && now - site->since >= age) {
+            name     = site->name;
+            count    = site->suppressed;
+            elapsed  = now - site->since;
+            site->suppressed = 0;
+        }
+        atomic_flag_clear_explicit(&site->busy, memory_order_release);
+
+        if (count)
+            report_suppressed(callback, name, LOG_WARNING, count, elapsed);
+    }
+}
+
+/**
+ * Called by the log thread on every turn, the reports are printed directly.
+ */
+static void rate_poll(void)
+{
+    int64_t now = coarse_ms();
+
+    if (now - rate_scanned < RATE_SCAN_MS)
+        return;
+    rate_scanned = now;
+    rate_report(RATE_REPORT_MS, direct_callback);
+}
+
+static void rate_report_all(void)
+{
+    rate_report(0, NULL);
+}
+
+static void rate_at_exit(void)
+{
+    atexit(rate_report_all);
+}
+
+/**
+ * Token bucket of the call site.
+ * @return 0 if the message has to be suppressed
+ */
+static int rate_check(void (*callback)(void*, int, const char*, va_list),
+                      const void *name, int level, const char *fmt)
+{
+    uintptr_t key = (uintptr_t)name * 31 + (uintptr_t)fmt;
+    LogRateSite *site = &rate_sites[(key ^ key >> 7 ^ key >> 15) % RATE_SITES];
+    const void *old_name = NULL;
+    unsigned count = 0;
+    int64_t now, elapsed = 0;
+    int pass;
+
+    /* never wait: a busy slot lets the message through */
+    if (atomic_flag_test_and_set_explicit(&site->busy, memory_order_acquire))
+        return 1;
+
+    now = coarse_ms();
+    if (site->fmt != fmt || site->name != name) {
+        /* evicting another site, tell what it swallowed */
+        if (site->suppressed) {
+            old_name = site->name;
+            count    = site->suppressed;
+            elapsed  = now - site->since;
+        }
+        site->name       = name;
+        site->fmt        = fmt;
+        site->tokens     = rate_burst * RATE_MILLI;
+        site->refill     = now;
+        site->suppressed = 0;
+    }
+
+    site->tokens = FFMIN((int64_t)rate_burst * RATE_MILLI,
+                         site->tokens + (now - site->refill) * rate_per_sec);
+    site->refill = now;
+
+    pass = site->tokens >= RATE_MILLI;
+    if (pass) {
+        site->tokens -= RATE_MILLI;
+        if (site->suppressed && !count) {
+            old_name = site->name;
+            count    = site->suppressed;
+            elapsed  = now - site->since;
+            site->suppressed = 0;
+        }
+    } else if (!site->suppressed++) {
+        site->since = now;
+    }
+    atomic_flag_clear_explicit(&site->busy, memory_order_release);
+
+    if (count)
+        report_suppressed(callback, old_name, LOG_WARNING, count, elapsed);
+    if (!pass)
+        pthread_once(&rate_once, rate_at_exit);
+    return pass;
+}
+
+/**
+ * Send a message that passed the level check to the callback.
+ */
+static void dispatch(void *name, int level, const char *fmt, va_list vl)
+{
+    void (*callback)(void*, int, const char*, va_list);
+
+    callback = __atomic_load_n(&log_callback, __ATOMIC_ACQUIRE);
+    if (!callback)
+        return;
+    if ((flags & LOG_RATE_LIMIT) && LOG_LEVEL_BASE(level) >= LOG_ERROR &&
+        !rate_check(callback, name, level, fmt))
+        return;
+    callback(name, level, fmt, vl);
+}
+
+void log_set_rate_limit(int burst, int per_sec)
+{
+    rate_burst   = FFMAX(burst, 1);
+    rate_per_sec = FFMAX(per_sec, 0);
+}
+
+/******************************************************************************************************/
+
+/* per-TAG levels */
+
+#define MAX_TAGS        128
+#define TAG_INDEX_SIZE  (MAX_TAGS * 2)
+
+static pthread_mutex_t tag_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogTag tags[MAX_TAGS];
+static int nb_tags;
+/** name -> tag, open addressing; slots are published once and never change */
+static LogTag *_Atomic tag_index[TAG_INDEX_SIZE];
+/** used for NULL names and once the registry is full */
+static LogTag tag_default = { NULL, LOG_INFO, 0 };
+
+static uint32_t tag_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+static LogTag *tag_find(const char *name, uint32_t h)
+{
+    LogTag *tag;
+    int i;
+
+    for (i = 0; i < TAG_INDEX_SIZE; i++, h++) {
+        tag = atomic_load_explicit(&tag_index[h % TAG_INDEX_SIZE], memory_order_acquire);
+        if (!tag || !strcmp(tag->name, name))
+            return tag;
+    }
+    return NULL;
+}
+
+static LogTag *tag_get(const char *name)
+{
+    LogTag *tag;
+    char *copy;
+    uint32_t h;
+
+    if (!name)
+        return &tag_default;
+
+    h = tag_hash(name);
+    tag = tag_find(name, h);
+    if (tag)
+        return tag;
+
+    pthread_mutex_lock(&tag_mutex);
+    tag = tag_find(name, h);
+    if (!tag) {
+        copy = strdup(name);
+        if (nb_tags >= MAX_TAGS || !copy) {
+            free(copy);
+            tag = &tag_default;
+        } else {
+            tag = &tags[nb_tags++];
+            tag->name = copy;
+            __atomic_store_n(&tag->level, log_level, __ATOMIC_RELAXED);
+            while (atomic_load_explicit(&tag_index[h % TAG_INDEX_SIZE], memory_order_relaxed))
+                h++;
+            atomic_store_explicit(&tag_index[h % TAG_INDEX_SIZE], tag, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&tag_mutex);
+    return tag;
+}
+
+LogTag *log_tag_site(LogTag **site, const char *name)
+{
+    LogTag *tag = tag_get(name);
+
+    __atomic_store_n(site, tag, __ATOMIC_RELEASE);
+    return tag;
+}
+
+void log_tag_emit(const LogTag *tag, int level, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    dispatch((void *)tag->name, level, fmt, vl);
+    va_end(vl);
+}
+
+int log_set_tag_level(const char *name, int level)
+{
+    LogTag *tag = tag_get(name);
+
+    if (tag == &tag_default && name)
+        return AVERROR(ENOSPC);
+
+    pthread_mutex_lock(&tag_mutex);
+    tag->override = level != LOG_TAG_DEFAULT;
+    __atomic_store_n(&tag->level, tag->override ? level : log_level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tag_mutex);
+    return 0;
+}
+
+int log_get_tag_level(const char *name)
+{
+    return __atomic_load_n(&tag_get(name)->level, __ATOMIC_RELAXED);
+}
+
+static int parse_level(const char *str, int *level)
+{
+    static const struct { const char *name; int level; } names[] = {
+        { "quiet",   LOG_QUIET   }, { "panic",   LOG_PANIC   },
+        { "fatal",   LOG_FATAL   }, { "error",   LOG_ERROR   },
+        { "warning", LOG_WARNING }, { "info",    LOG_INFO    },
+        { "verbose", LOG_VERBOSE }, { "debug",   LOG_DEBUG   },
+        { "trace",   LOG_TRACE   }, { "default", LOG_TAG_DEFAULT },
+    };
+    char *end;
+    int i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!strcmp(str, names[i].name)) {
+            *level = names[i].level;
+            return 0;
+        }
+    }
+    *level = strtol(str, &end, 10);
+    return *str && !*end ? 0 : AVERROR(EINVAL);
+}
+
+int log_parse_levels(const char *spec)
+{
+    char buf[256], *item, *save = NULL, *eq;
+    int level, ret = 0;
+
+    if (strlen(spec) >= sizeof(buf))
+        return AVERROR(EINVAL);
+    strcpy(buf, spec);
+
+    for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        eq = strchr(item, '=');
+        if (eq)
+            *eq = 0;
+        if (parse_level(eq ? eq + 1 : item, &level) < 0) {
+            ret = AVERROR(EINVAL);
+            continue;
+        }
+        if (eq)
+            ret = log_set_tag_level(item, level) < 0 ? AVERROR(ENOSPC) : ret;
+        else if (level != LOG_TAG_DEFAULT)
+            log_set_level(level);
+    }
+    return ret;
+}
+
+/******************************************************************************************************/
+
+void (log)(void *name, int level, const char *fmt, ...)
 {
     va_list vl;
     va_start(vl, fmt);
@@ -1020,24 +1878,27 @@ void log_once(void *name, int initial_level, int subsequent_level, int *state, c
 
 void vlog(void *name, int level, const char *fmt, va_list vl)
 {
-#if 0
-    void (*log_callback)(void*, int, const char*, va_list) = log_callback;
-    if (log_callback){
-        log_callback(name, level, fmt, vl);
-    }
-#else
-    log_default_callback(name, level, fmt, vl);
-#endif
+    if (!log_tag_enabled(tag_get(name), level))
+        return;
+    dispatch(name, level, fmt, vl);
 }
 
 int log_get_level(void)
 {
-    return log_level;
+    return __atomic_load_n(&log_level, __ATOMIC_RELAXED);
 }
 
 void log_set_level(int level)
 {
-    log_level = level;
+    int i;
+
+    pthread_mutex_lock(&tag_mutex);
+    __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+    __atomic_store_n(&tag_default.level, level, __ATOMIC_RELAXED);
+    for (i = 0; i < nb_tags; i++)
+        if (!tags[i].override)
+            __atomic_store_n(&tags[i].level, level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tag_mutex);
 }
 
 void log_set_flags(int arg)
@@ -1052,6 +1913,6 @@ int log_get_flags(void)
 
 void log_set_callback(void (*callback)(void*, int, const char*, va_list))
 {
-    log_callback = callback;
+    __atomic_store_n(&log_callback, callback, __ATOMIC_RELEASE);
 }
 
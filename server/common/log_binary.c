@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log_binary.h"
+
+typedef struct{
+	const char *start;	/* the '%' */
+	int len;		/* characters of the conversion spec */
+	int star_width;
+	int star_prec;
+	int prec;		/* literal precision, -1 if none */
+	char lenmod;		/* 0, H(hh), h, l, q(ll), j, z, t, L */
+	char conv;
+}LOG_BIN_SPEC_T;
+
+/* find the next conversion spec of fmt, NULL at the end of the string */
+static const char *next_spec(const char *p, LOG_BIN_SPEC_T *s)
+{
+	const char *q;
+
+	p = strchr(p, '%');
+	if (p == NULL)
+		return NULL;
+
+	memset(s, 0, sizeof(*s));
+	s->start = p;
+	s->prec = -1;
+	q = p + 1;
+
+	while (*q && strchr("-+ #0'", *q))
+		q++;
+	if (*q == '*') {
+		s->star_width = 1;
+		q++;
+	} else {
+		while (*q >= '0' && *q <= '9')
+			q++;
+	}
+	if (*q == '.') {
+		q++;
+		if (*q == '*') {
+			s->star_prec = 1;
+			q++;
+		} else {
+			s->prec = 0;
+			while (*q >= '0' && *q <= '9')
+				s->prec = s->prec * 10 + *q++ - '0';
+		}
+	}
+	switch (*q) {
+	case 'h':
+		s->lenmod = 'h';
+		if (*++q == 'h') {
+			s->lenmod = 'H';
+			q++;
+		}
+		break;
+	case 'l':
+		s->lenmod = 'l';
+		if (*++q == 'l') {
+			s->lenmod = 'q';
+			q++;
+		}
+		break;
+	case 'q': case 'j': case 'z': case 't': case 'L':
+		s->lenmod = *q++;
+		break;
+	}
+	s->conv = *q;
+	if (*q)
+		q++;
+	s->len = q - p;
+	return p;
+}
+
+#define PUT(v) do {						\
+	if (used + 8 > room)					\
+		goto fail;					\
+	memcpy(dst + used, &(v), 8);				\
+	used += 8;						\
+} while (0)
+
+int log_bin_capture(uint8_t *dst, unsigned room, const char *fmt, va_list vl)
+{
+	LOG_BIN_SPEC_T s;
+	const char *p = fmt;
+	unsigned used = 0;
+	int64_t i;
+	uint64_t u;
+	double d;
+	const char *str;
+	uint16_t len;
+	int prec;
+	va_list ap;
+
+	va_copy(ap, vl);
+	while ((p = next_spec(p, &s)) != NULL) {
+		p += s.len;
+		prec = s.prec;
+		if (s.star_width) {
+			i = va_arg(ap, int);
+			PUT(i);
+		}
+		if (s.star_prec) {
+			i = va_arg(ap, int);
+			prec = i;
+			PUT(i);
+		}
+
+		switch (s.conv) {
+		case '%':
+			break;
+		case 'd': case 'i': case 'c':
+			if (s.conv == 'c' && s.lenmod == 'l')
+				goto fail;
+			switch (s.lenmod) {
+			case 'l': i = va_arg(ap, long);		break;
+			case 'q': i = va_arg(ap, long long);	break;
+			case 'j': i = va_arg(ap, intmax_t);	break;
+			case 'z': i = va_arg(ap, ptrdiff_t);	break;
+			case 't': i = va_arg(ap, ptrdiff_t);	break;
+			default:  i = va_arg(ap, int);		break;
+			}
+			PUT(i);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			switch (s.lenmod) {
+			case 'l': u = va_arg(ap, unsigned long);	break;
+			case 'q': u = va_arg(ap, unsigned long long);	break;
+			case 'j': u = va_arg(ap, uintmax_t);		break;
+			case 'z': u = va_arg(ap, size_t);		break;
+			case 't': u = va_arg(ap, size_t);		break;
+			default:  u = va_arg(ap, unsigned int);		break;
+			}
+			PUT(u);
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			if (s.lenmod == 'L')
+				d = va_arg(ap, long double);
+			else
+				d = va_arg(ap, double);
+			PUT(d);
+			break;
+		case 'p':
+			u = (uintptr_t)va_arg(ap, void *);
+			PUT(u);
+			break;
+		case 's':
+			if (s.lenmod == 'l')
+				goto fail;
+			str = va_arg(ap, const char *);
+			if (str == NULL) {
+				len = LOG_BIN_NULL_STR;
+			} else {
+				if (prec < 0 || prec > LOG_BIN_MAX_STR)
+					prec = LOG_BIN_MAX_STR;
+				len = strnlen(str, prec);
+			}
+			if (used + 2 + (len == LOG_BIN_NULL_STR ? 0 : len) > room)
+				goto fail;
+			memcpy(dst + used, &len, 2);
+			used += 2;
+			if (len != LOG_BIN_NULL_STR) {
+				memcpy(dst + used, str, len);
+				used += len;
+			}
+			break;
+		default:
+			/* %n, %C, %S and anything unknown */
+			goto fail;
+		}
+	}
+	va_end(ap);
+	return used;
+
+fail:
+	va_end(ap);
+	return -1;
+}
+
+#undef PUT
+
+static int64_t get_word(const uint8_t *args, unsigned len, unsigned *pos)
+{
+	int64_t v = 0;
+
+	if (*pos + 8 <= len)
+		memcpy(&v, args + *pos, 8);
+	*pos += 8;
+	return v;
+}
+
+/* the argument of a conversion that is not formatted */
+static void skip_arg(int conv, const uint8_t *args, unsigned len, unsigned *pos)
+{
+	uint16_t slen = 0;
+
+	switch (conv) {
+	case 's':
+		if (*pos + 2 <= len)
+			memcpy(&slen, args + *pos, 2);
+		*pos += 2;
+		if (slen != LOG_BIN_NULL_STR && slen <= LOG_BIN_MAX_STR && *pos + slen <= len)
+			*pos += slen;
+		break;
+	case 'd': case 'i': case 'c':
+	case 'u': case 'o': case 'x': case 'X':
+	case 'f': case 'F': case 'e': case 'E':
+	case 'g': case 'G': case 'a': case 'A':
+	case 'p':
+		get_word(args, len, pos);
+		break;
+	default:
+		break;
+	}
+}
+
+#define EMIT(...) (s.star_width && s.star_prec ? snprintf(out, room, spec, w, pr, __VA_ARGS__) : \
+		   s.star_width ? snprintf(out, room, spec, w, __VA_ARGS__) : \
+		   s.star_prec  ? snprintf(out, room, spec, pr, __VA_ARGS__) : \
+				  snprintf(out, room, spec, __VA_ARGS__))
+
+int log_bin_format(char *dst, int size, const char *fmt,
+		const uint8_t *args, unsigned len)
+{
+	LOG_BIN_SPEC_T s;
+	const char *p = fmt, *lit = fmt;
+	char spec[32], str[LOG_BIN_MAX_STR + 1];
+	unsigned pos = 0;
+	int total = 0, n, w = 0, pr = 0, room;
+	char *out;
+	int64_t i;
+	double d;
+	uint16_t slen;
+
+	if (size > 0)
+		*dst = 0;
+
+	for (;;) {
+		p = next_spec(lit, &s);
+		/* literal text up to the spec */
+		n = p ? p - lit : (int)strlen(lit);
+		if (total < size)
+			memcpy(dst + total, lit, n < size - total ? n : size - total);
+		total += n;
+		if (p == NULL)
+			break;
+		lit = p + s.len;
+
+		if (s.conv == '%') {
+			if (total < size)
+				dst[total] = '%';
+			total++;
+			continue;
+		}
+		if (s.star_width)
+			w = get_word(args, len, &pos);
+		if (s.star_prec)
+			pr = get_word(args, len, &pos);
+
+		if (s.len >= (int)sizeof(spec)) {
+			/* too long to rebuild: its words are skipped, the spec is printed as it is */
+			skip_arg(s.conv, args, len, &pos);
+			if (total < size)
+				memcpy(dst + total, s.start, s.len < size - total ? s.len : size - total);
+			total += s.len;
+			continue;
+		}
+		memcpy(spec, s.start, s.len);
+		spec[s.len] = 0;
+
+		room = total < size ? size - total : 0;
+		out = room ? dst + total : NULL;
+
+		switch (s.conv) {
+		case 'd': case 'i': case 'c':
+		case 'u': case 'o': case 'x': case 'X':
+			i = get_word(args, len, &pos);
+			switch (s.lenmod) {
+			case 'l': n = EMIT((long)i);		break;
+			case 'q': n = EMIT((long long)i);	break;
+			case 'j': n = EMIT((intmax_t)i);	break;
+			case 'z': n = EMIT((size_t)i);		break;
+			case 't': n = EMIT((ptrdiff_t)i);	break;
+			default:  n = EMIT((int)i);		break;
+			}
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			i = get_word(args, len, &pos);
+			memcpy(&d, &i, 8);
+			if (s.lenmod == 'L')
+				n = EMIT((long double)d);
+			else
+				n = EMIT(d);
+			break;
+		case 'p':
+			i = get_word(args, len, &pos);
+			n = EMIT((void *)(uintptr_t)i);
+			break;
+		case 's':
+			slen = 0;
+			if (pos + 2 <= len)
+				memcpy(&slen, args + pos, 2);
+			pos += 2;
+			if (slen == LOG_BIN_NULL_STR) {
+				n = EMIT((char *)NULL);
+				break;
+			}
+			if (slen > LOG_BIN_MAX_STR || pos + slen > len)
+				slen = 0;
+			memcpy(str, args + pos, slen);
+			str[slen] = 0;
+			pos += slen;
+			n = EMIT(str);
+			break;
+		default:
+			n = 0;
+			break;
+		}
+		if (n > 0)
+			total += n;
+	}
+
+	if (size > 0)
+		dst[total < size ? total : size - 1] = 0;
+	return total;
+}
+
+#undef EMIT
+
+/******************************************************************************************************/
+
+typedef struct{
+	const void *ptr;
+	uint32_t id;
+}LOG_BIN_DICT_T;
+
+struct LOG_BIN_FILE_T{
+	FILE *fp;
+	LOG_BIN_DICT_T *dict;	/* open addressing, pointer -> string id */
+	uint32_t dict_size;	/* power of two */
+	uint32_t dict_used;
+};
+
+static uint32_t hash_ptr(const void *ptr)
+{
+	uint64_t v = (uintptr_t)ptr;
+
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	return (uint32_t)v;
+}
+
+static int dict_grow(LOG_BIN_FILE_T *file)
+{
+	uint32_t size = file->dict_size ? file->dict_size * 2 : 256;
+	LOG_BIN_DICT_T *dict = calloc(size, sizeof(*dict));
+	uint32_t i, h;
+
+	if (dict == NULL)
+		return -1;
+	for (i = 0; i < file->dict_size; i++) {
+		if (file->dict[i].ptr == NULL)
+			continue;
+		for (h = hash_ptr(file->dict[i].ptr); dict[h & (size - 1)].ptr; h++)
+			;
+		dict[h & (size - 1)] = file->dict[i];
+	}
+	free(file->dict);
+	file->dict = dict;
+	file->dict_size = size;
+	return 0;
+}
+
+/* id of the string at ptr, written to the file the first time it is seen */
+static uint32_t dict_id(LOG_BIN_FILE_T *file, const char *ptr)
+{
+	LOG_BIN_STRING_T def;
+	LOG_BIN_DICT_T *slot;
+	size_t len;
+	uint32_t h;
+
+	if (ptr == NULL)
+		return 0;
+
+	if ((file->dict_used + 1) * 4 > file->dict_size * 3 && dict_grow(file))
+		return 0;
+
+	for (h = hash_ptr(ptr); ; h++) {
+		slot = &file->dict[h & (file->dict_size - 1)];
+		if (slot->ptr == ptr)
+			return slot->id;
+		if (slot->ptr == NULL)
+			break;
+	}
+
+	len = strlen(ptr);
+	memset(&def, 0, sizeof(def));
+	def.kind = LOG_BIN_STRING;
+	def.len = len > UINT16_MAX ? UINT16_MAX : len;
+	def.id = ++file->dict_used;
+	fwrite(&def, sizeof(def), 1, file->fp);
+	fwrite(ptr, def.len, 1, file->fp);
+
+	slot->ptr = ptr;
+	slot->id = def.id;
+	return def.id;
+}
+
+LOG_BIN_FILE_T *log_bin_file_open(const char *path)
+{
+	LOG_BIN_FILE_T *file;
+	uint32_t version = LOG_BIN_VERSION;
+
+	file = calloc(1, sizeof(*file));
+	if (file == NULL)
+		return NULL;
+
+	file->fp = fopen(path, "wb");
+	if (file->fp == NULL || dict_grow(file)) {
+		log_bin_file_close(file);
+		return NULL;
+	}
+	fwrite(LOG_BIN_MAGIC, 8, 1, file->fp);
+	fwrite(&version, sizeof(version), 1, file->fp);
+	return file;
+}
+
+int log_bin_file_write(LOG_BIN_FILE_T *file, const LOG_BIN_REC_T *rec)
+{
+	LOG_BIN_EVENT_T ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.kind = LOG_BIN_EVENT;
+	ev.size = rec->size;
+	ev.level = rec->level;
+	ev.time = rec->time;
+	ev.fmt_id = dict_id(file, rec->fmt);
+	ev.name_id = dict_id(file, rec->name);
+
+	if (fwrite(&ev, sizeof(ev), 1, file->fp) != 1 ||
+	    fwrite(rec->args, 1, rec->size, file->fp) != rec->size)
+		return -1;
+	return 0;
+}
+
+int log_bin_file_flush(LOG_BIN_FILE_T *file)
+{
+	return fflush(file->fp);
+}
+
+void log_bin_file_close(LOG_BIN_FILE_T *file)
+{
+	if (file == NULL)
+		return;
+	if (file->fp)
+		fclose(file->fp);
+	free(file->dict);
+	free(file);
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log_mmap.h"
+
+#define PATH_SZ		256
+#define MIN_SEGMENT	(64 * 1024)
+
+struct LOG_MMAP_T{
+	char path[PATH_SZ];
+	int segments;
+	int sync_ms;
+	uint32_t size;		/* segment size */
+	uint32_t used;		/* bytes written to the active segment */
+	uint32_t synced;	/* bytes known to be on disk */
+	int64_t last_sync;	/* ms, CLOCK_MONOTONIC */
+	int fd;
+	char *map;
+};
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void segment_name(LOG_MMAP_T *f, int idx, char *name, int size)
+{
+	if (idx == 0)
+		snprintf(name, size, "%s", f->path);
+	else
+		snprintf(name, size, "%s.%d", f->path, idx);
+}
+
+/* path -> path.1 -> ... -> path.<segments-1>, the oldest one is dropped */
+static void shift_segments(LOG_MMAP_T *f)
+{
+	char from[PATH_SZ + 16], to[PATH_SZ + 16];
+	int i;
+
+	segment_name(f, f->segments - 1, to, sizeof(to));
+	unlink(to);
+	for (i = f->segments - 1; i > 0; i--) {
+		segment_name(f, i - 1, from, sizeof(from));
+		segment_name(f, i, to, sizeof(to));
+		rename(from, to);
+	}
+}
+
+static void sync_range(LOG_MMAP_T *f)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	uint32_t start = f->synced & ~(page - 1);
+
+	if (f->used > f->synced)
+		msync(f->map + start, f->used - start, MS_SYNC);
+	f->synced = f->used;
+	f->last_sync = now_ms();
+}
+
+/* unmap the active segment and trim the zero padding */
+static void close_segment(LOG_MMAP_T *f)
+{
+	if (f->map) {
+		sync_range(f);
+		munmap(f->map, f->size);
+		f->map = NULL;
+	}
+	if (f->fd >= 0) {
+		/* the padding stays then, the next open trims it */
+		if (ftruncate(f->fd, f->used) != 0)
+			fprintf(stderr, "log: trim %s failed: %s\n", f->path, strerror(errno));
+		close(f->fd);
+		f->fd = -1;
+	}
+}
+
+static int open_segment(LOG_MMAP_T *f)
+{
+	struct stat st;
+	off_t end;
+
+	f->fd = open(f->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (f->fd < 0)
+		return -1;
+	if (fstat(f->fd, &st) != 0)
+		goto fail;
+
+	if (st.st_size > f->size) {
+		/* written with a larger segment size, start a new one */
+		close(f->fd);
+		f->fd = -1;
+		shift_segments(f);
+		return open_segment(f);
+	}
+	end = st.st_size;
+
+	if (ftruncate(f->fd, f->size) != 0)
+		goto fail;
+	f->map = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+	if (f->map == MAP_FAILED) {
+		f->map = NULL;
+		goto fail;
+	}
+
+	/* left over by a crash: the data ends at the last non-zero byte */
+	while (end > 0 && f->map[end - 1] == 0)
+		end--;
+	f->used = f->synced = end;
+	f->last_sync = now_ms();
+	return 0;
+
+fail:
+	close(f->fd);
+	f->fd = -1;
+	return -1;
+}
+
+static int rotate(LOG_MMAP_T *f)
+{
+	close_segment(f);
+	shift_segments(f);
+	return open_segment(f);
+}
+
+LOG_MMAP_T *log_mmap_open(const char *path, unsigned segment_size,
+		int segments, int sync_ms)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	LOG_MMAP_T *f;
+
+	if (strlen(path) >= PATH_SZ)
+		return NULL;
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL)
+		return NULL;
+
+	snprintf(f->path, sizeof(f->path), "%s", path);
+	f->segments = segments < 1 ? 1 : segments;
+	f->sync_ms = sync_ms;
+	f->size = segment_size < MIN_SEGMENT ? MIN_SEGMENT : segment_size;
+	f->size = (f->size + page - 1) & ~(page - 1);
+	f->fd = -1;
+
+	if (open_segment(f) != 0) {
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+
+int log_mmap_write(LOG_MMAP_T *f, const char *buf, unsigned len, int sync)
+{
+	if (f->map == NULL && open_segment(f) != 0)
+		return -1;
+	if (len > f->size)
+		len = f->size;
+	if (f->used + len > f->size && rotate(f) != 0)
+		return -1;
+
+	memcpy(f->map + f->used, buf, len);
+	f->used += len;
+
+	if (sync)
+		sync_range(f);
+	else
+		log_mmap_poll(f);
+	return 0;
+}
+
+void log_mmap_poll(LOG_MMAP_T *f)
+{
+	if (f->map && f->used > f->synced && now_ms() - f->last_sync >= f->sync_ms)
+		sync_range(f);
+}
+
+void log_mmap_close(LOG_MMAP_T *f)
+{
+	if (f == NULL)
+		return;
+	close_segment(f);
+	free(f);
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "log_ring.h"
+
+#define CACHE_LINE	64
+#define RING_MIN_SIZE	4096
+#define REC_ALIGN(x)	(((x) + 7) & ~7u)
+
+typedef struct{
+	uint32_t size;	/* payload bytes following the header */
+	uint32_t type;
+}LOG_REC_HDR_T;
+
+struct LOG_RING_T{
+	/* written by the producer only */
+	_Atomic uint32_t tail __attribute__((aligned(CACHE_LINE)));
+	uint32_t pending;	/* tail once the reserved record is committed */
+
+	/* written by the consumer only */
+	_Atomic uint32_t head __attribute__((aligned(CACHE_LINE)));
+
+	_Atomic uint64_t dropped __attribute__((aligned(CACHE_LINE)));
+	_Atomic int owner;	/* 1 while a live thread produces into the ring */
+	uint32_t size;		/* power of two */
+	uint8_t *buf;
+	struct LOG_RING_T *next;
+};
+
+/*
+ * Rings are never freed: when a thread exits its ring is released and can be
+ * adopted by the next thread that starts logging, so the list only grows up to
+ * the peak number of concurrent logging threads.
+ */
+static _Atomic(LOG_RING_T *) rings = NULL;
+static __thread LOG_RING_T *local = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void ring_release(void *arg)
+{
+	LOG_RING_T *ring = arg;
+
+	atomic_store_explicit(&ring->owner, 0, memory_order_release);
+}
+
+static void ring_key_init(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+static LOG_RING_T *ring_adopt(uint32_t size)
+{
+	LOG_RING_T *ring;
+	int expected;
+
+	for (ring = atomic_load(&rings); ring; ring = ring->next) {
+		expected = 0;
+		if (ring->size >= size &&
+		    atomic_compare_exchange_strong(&ring->owner, &expected, 1)) {
+			ring->pending = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+			return ring;
+		}
+	}
+	return NULL;
+}
+
+static LOG_RING_T *ring_alloc(uint32_t size)
+{
+	LOG_RING_T *ring;
+
+	if (posix_memalign((void **)&ring, CACHE_LINE, sizeof(*ring)))
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+	ring->buf = malloc(size);
+	if (ring->buf == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->size = size;
+	atomic_store(&ring->owner, 1);
+
+	ring->next = atomic_load(&rings);
+	while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+		;
+	return ring;
+}
+
+LOG_RING_T *log_ring_local(unsigned size)
+{
+	uint32_t sz = RING_MIN_SIZE;
+	LOG_RING_T *ring;
+
+	if (local)
+		return local;
+
+	while (sz < size && sz < (1u << 30))
+		sz <<= 1;
+
+	pthread_once(&ring_once, ring_key_init);
+	ring = ring_adopt(sz);
+	if (ring == NULL)
+		ring = ring_alloc(sz);
+	if (ring == NULL)
+		return NULL;
+
+	pthread_setspecific(ring_key, ring);
+	local = ring;
+	return ring;
+}
+
+void *log_ring_reserve(LOG_RING_T *ring, unsigned size, unsigned type)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	uint32_t need = REC_ALIGN(sizeof(LOG_REC_HDR_T) + size);
+	uint32_t off = tail & (ring->size - 1);
+	uint32_t pad = 0;
+	LOG_REC_HDR_T *hdr;
+
+	if (need > ring->size / 2)
+		return NULL;
+	if (off + need > ring->size)
+		pad = ring->size - off;
+	if (tail + pad + need - head > ring->size)
+		return NULL;
+
+	if (pad) {
+		hdr = (LOG_REC_HDR_T *)(ring->buf + off);
+		hdr->size = pad - sizeof(*hdr);
+		hdr->type = LOG_REC_PAD;
+		off = 0;
+	}
+
+	hdr = (LOG_REC_HDR_T *)(ring->buf + off);
+	hdr->size = size;
+	hdr->type = type;
+	ring->pending = tail + pad + need;
+	return hdr + 1;
+}
+
+void log_ring_commit(LOG_RING_T *ring)
+{
+	atomic_store_explicit(&ring->tail, ring->pending, memory_order_release);
+}
+
+void log_ring_drop(LOG_RING_T *ring)
+{
+	atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+}
+
+int log_ring_drain(int batch,
+		void (*cb)(void *opaque, unsigned type, const void *data, unsigned size),
+		void *opaque)
+{
+	LOG_RING_T *ring;
+	LOG_REC_HDR_T *hdr;
+	uint32_t head, tail;
+	int n, total = 0;
+
+	for (ring = atomic_load(&rings); ring; ring = ring->next) {
+		head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+		for (n = 0; head != tail && n < batch; ) {
+			hdr = (LOG_REC_HDR_T *)(ring->buf + (head & (ring->size - 1)));
+			if (hdr->type != LOG_REC_PAD) {
+				cb(opaque, hdr->type, hdr + 1, hdr->size);
+				n++;
+			}
+			head += REC_ALIGN(sizeof(*hdr) + hdr->size);
+		}
+		/* hand the whole batch back to the producer at once */
+		atomic_store_explicit(&ring->head, head, memory_order_release);
+		total += n;
+	}
+	return total;
+}
+
+uint64_t log_ring_dropped(void)
+{
+	LOG_RING_T *ring;
+	uint64_t total = 0;
+
+	for (ring = atomic_load(&rings); ring; ring = ring->next)
+		total += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	return total;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "queue.h"
+
+#define CACHE_LINE 64
+
+/*
+ * Dmitry Vyukov's bounded MPMC queue: each cell carries a sequence number
+ * telling producers and consumers whose turn it is, so the only contended
+ * operation is one CAS on head or tail.
+ */
+typedef struct{
+	_Atomic uint32_t seq;
+	/* followed by elem_size bytes */
+}QUEUE_CELL_T;
+
+struct QUEUE_T{
+	_Atomic uint32_t tail __attribute__((aligned(CACHE_LINE)));	/* producers */
+	_Atomic uint32_t head __attribute__((aligned(CACHE_LINE)));	/* consumers */
+	uint32_t mask __attribute__((aligned(CACHE_LINE)));
+	uint32_t elem_size;
+	uint32_t cell_size;
+	uint8_t *cells;
+};
+
+static inline QUEUE_CELL_T *cell_at(QUEUE_T *q, uint32_t pos)
+{
+	return (QUEUE_CELL_T *)(q->cells + (size_t)(pos & q->mask) * q->cell_size);
+}
+
+QUEUE_T *queue_create(unsigned capacity, unsigned elem_size)
+{
+	QUEUE_T *q;
+	uint32_t size = 2, i;
+
+	while (size < capacity && size < (1u << 30))
+		size <<= 1;
+
+	if (posix_memalign((void **)&q, CACHE_LINE, sizeof(*q)))
+		return NULL;
+	memset(q, 0, sizeof(*q));
+
+	q->mask = size - 1;
+	q->elem_size = elem_size;
+	q->cell_size = (sizeof(QUEUE_CELL_T) + elem_size + 7) & ~7u;
+	q->cells = malloc((size_t)size * q->cell_size);
+	if (q->cells == NULL) {
+		free(q);
+		return NULL;
+	}
+	for (i = 0; i < size; i++)
+		atomic_init(&cell_at(q, i)->seq, i);
+	return q;
+}
+
+void queue_destroy(QUEUE_T *q)
+{
+	if (q == NULL)
+		return;
+	free(q->cells);
+	free(q);
+}
+
+int queue_push(QUEUE_T *q, const void *elem)
+{
+	uint32_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	QUEUE_CELL_T *cell;
+	int32_t diff;
+
+	for (;;) {
+		cell = cell_at(q, pos);
+		diff = (int32_t)(atomic_load_explicit(&cell->seq, memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+
+	memcpy(cell + 1, elem, q->elem_size);
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
+int queue_pop(QUEUE_T *q, void *elem)
+{
+	uint32_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	QUEUE_CELL_T *cell;
+	int32_t diff;
+
+	for (;;) {
+		cell = cell_at(q, pos);
+		diff = (int32_t)(atomic_load_explicit(&cell->seq, memory_order_acquire) - (pos + 1));
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+
+	memcpy(elem, cell + 1, q->elem_size);
+	atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+	return 0;
+}
+
+unsigned queue_count(QUEUE_T *q)
+{
+	uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+	return tail - head > q->mask + 1 ? 0 : tail - head;
+}
+
+unsigned queue_capacity(QUEUE_T *q)
+{
+	return q->mask + 1;
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "registry.h"
+#include "status.h"
+
+int64_t registry_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* IDs are often sequential or MAC-like: mix every bit into the low ones */
+static uint32_t hash_of(uint64_t id)
+{
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	id *= 0xc4ceb9fe1a85ec53ULL;
+	id ^= id >> 33;
+	return (uint32_t)id;
+}
+
+static void *array(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, CACHE_LINE_SIZE, size ? size : 1))
+		return NULL;
+	memset(p, 0, size);
+	return p;
+}
+
+REGISTRY_T *registry_create(unsigned cap)
+{
+	REGISTRY_T *r;
+	uint32_t size = 2;
+
+	if (cap == 0 || cap > (1u << 24))
+		return NULL;
+	/* at most half full, probes stay short */
+	while (size < 2 * cap)
+		size <<= 1;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+	r->cap = cap;
+	r->hashMask = size - 1;
+	r->ids = array(cap * sizeof(*r->ids));
+	r->time = array(cap * sizeof(*r->time));
+	r->temp = array(cap * sizeof(*r->temp));
+	r->hum = array(cap * sizeof(*r->hum));
+	r->status = array(cap * sizeof(*r->status));
+	r->lastSeen = array(cap * sizeof(*r->lastSeen));
+	r->seq = array(cap * sizeof(*r->seq));
+	r->hash = array(size * sizeof(*r->hash));
+	if (!r->ids || !r->time || !r->temp || !r->hum || !r->status ||
+	    !r->lastSeen || !r->seq || !r->hash) {
+		registry_destroy(r);
+		return NULL;
+	}
+	atomic_init(&r->count, 0);
+	return r;
+}
+
+void registry_destroy(REGISTRY_T *r)
+{
+	if (r == NULL)
+		return;
+	free(r->ids);
+	free(r->time);
+	free(r->temp);
+	free(r->hum);
+	free(r->status);
+	free(r->lastSeen);
+	free((void *)r->seq);
+	free(r->hash);
+	free(r);
+}
+
+/* the entry of id, or the free one where it would go */
+static REGISTRY_HASH_T *probe(REGISTRY_T *r, uint64_t id)
+{
+	uint32_t i = hash_of(id) & r->hashMask;
+	REGISTRY_HASH_T *e;
+	uint64_t v;
+
+	for (;;) {
+		e = &r->hash[i];
+		v = atomic_load_explicit(&e->id, memory_order_acquire);
+		if (v == id || v == REGISTRY_ID_NONE)
+			return e;
+		i = (i + 1) & r->hashMask;
+	}
+}
+
+int registry_find(REGISTRY_T *r, uint64_t id)
+{
+	REGISTRY_HASH_T *e;
+
+	if (id == REGISTRY_ID_NONE)
+		return -1;
+	e = probe(r, id);
+	if (atomic_load_explicit(&e->id, memory_order_acquire) != id)
+		return -1;
+	return e->slot;
+}
+
+int registry_add(REGISTRY_T *r, uint64_t id)
+{
+	REGISTRY_HASH_T *e;
+	uint32_t slot;
+
+	if (id == REGISTRY_ID_NONE)
+		return -1;
+	e = probe(r, id);
+	if (atomic_load_explicit(&e->id, memory_order_relaxed) == id)
+		return e->slot;
+
+	slot = atomic_load_explicit(&r->count, memory_order_relaxed);
+	if (slot == r->cap)
+		return -1;
+	r->ids[slot] = id;
+	r->time[slot] = 0;
+	r->temp[slot] = __builtin_nanf("");
+	r->hum[slot] = __builtin_nanf("");
+	r->status[slot] = STATUS_INIT;
+	r->lastSeen[slot] = 0;
+	atomic_init(&r->seq[slot], 0);
+
+	/* the slot is valid for the scans before its ID can be found */
+	atomic_store_explicit(&r->count, slot + 1, memory_order_release);
+	e->slot = slot;
+	atomic_store_explicit(&e->id, id, memory_order_release);
+	return slot;
+}
+
+static uint32_t slot_lock(REGISTRY_T *r, int slot)
+{
+	uint32_t seq = atomic_load_explicit(&r->seq[slot], memory_order_relaxed);
+
+	atomic_store_explicit(&r->seq[slot], seq + 1, memory_order_relaxed);
+	/* the fields must not become visible before the odd sequence */
+	atomic_thread_fence(memory_order_release);
+	return seq + 1;
+}
+
+static void slot_unlock(REGISTRY_T *r, int slot, uint32_t seq)
+{
+	atomic_store_explicit(&r->seq[slot], seq + 1, memory_order_release);
+}
+
+int registry_update(REGISTRY_T *r, uint64_t id, const STATUS_FAST_T *s)
+{
+	int slot = registry_add(r, id);
+	uint32_t seq;
+
+	if (slot < 0)
+		return -1;
+
+	seq = slot_lock(r, slot);
+	r->time[slot] = s->time;
+	r->temp[slot] = s->fTemp;
+	r->hum[slot] = s->fHum;
+	r->status[slot] = STATUS_READ;
+	r->lastSeen[slot] = registry_now_ms();
+	slot_unlock(r, slot, seq);
+	return slot;
+}
+
+void registry_set_status(REGISTRY_T *r, int slot, int status)
+{
+	uint32_t seq;
+
+	if (slot < 0 || (unsigned)slot >= registry_count(r))
+		return;
+	seq = slot_lock(r, slot);
+	r->status[slot] = status;
+	slot_unlock(r, slot, seq);
+}
+
+int registry_get(REGISTRY_T *r, int slot, REGISTRY_DEV_T *dev)
+{
+	uint32_t seq0, seq1;
+
+	if (slot < 0 || (unsigned)slot >= registry_count(r))
+		return -1;
+
+	for (;;) {
+		seq0 = atomic_load_explicit(&r->seq[slot], memory_order_acquire);
+		if (seq0 & 1) {
+			status_pause();
+			continue;
+		}
+		dev->id = r->ids[slot];
+		dev->sample.dev = r->ids[slot];
+		dev->sample.time = r->time[slot];
+		dev->sample.fTemp = r->temp[slot];
+		dev->sample.fHum = r->hum[slot];
+		dev->status = r->status[slot];
+		dev->lastSeen = r->lastSeen[slot];
+		atomic_thread_fence(memory_order_acquire);
+		seq1 = atomic_load_explicit(&r->seq[slot], memory_order_relaxed);
+		if (seq0 == seq1)
+			return 0;
+	}
+}
+
+unsigned registry_scan_temp(REGISTRY_T *r, float lo, float hi, uint32_t *slots, unsigned max)
+{
+	unsigned n = registry_count(r), i, k = 0;
+	const float *t = r->temp;
+
+	/* no branch on the data: the slot is written, and kept if it matches (NaN never does) */
+	for (i = 0; i < n && k < max; i++) {
+		slots[k] = i;
+		k += t[i] >= lo && t[i] <= hi;
+	}
+	return k;
+}
+
+unsigned registry_scan_stale(REGISTRY_T *r, int64_t ageMs, uint32_t *slots, unsigned max)
+{
+	unsigned n = registry_count(r), i, k = 0;
+	int64_t before = registry_now_ms() - ageMs;
+	const int64_t *seen = r->lastSeen;
+
+	for (i = 0; i < n && k < max; i++) {
+		slots[k] = i;
+		k += seen[i] < before;
+	}
+	return k;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ts_block.h"
+
+#define NO_WINDOW	0xff
+
+static void put_bits(TS_BLOCK_T *b, uint64_t v, int n)
+{
+	uint32_t byte, used, take;
+
+	while (n > 0) {
+		byte = b->bits >> 3;
+		used = b->bits & 7;
+		take = 8 - used < n ? 8 - used : n;
+		if (used == 0)
+			b->buf[byte] = 0;
+		b->buf[byte] |= ((v >> (n - take)) & ((1u << take) - 1)) << (8 - used - take);
+		b->bits += take;
+		n -= take;
+	}
+}
+
+static int get_bits(TS_BLOCK_T *b, int n, uint64_t *v)
+{
+	uint32_t used, take;
+
+	if (b->bits + n > b->size * 8)
+		return -1;
+
+	*v = 0;
+	while (n > 0) {
+		used = b->bits & 7;
+		take = 8 - used < n ? 8 - used : n;
+		*v = (*v << take) | ((b->buf[b->bits >> 3] >> (8 - used - take)) & ((1u << take) - 1));
+		b->bits += take;
+		n -= take;
+	}
+	return 0;
+}
+
+static uint32_t float_bits(float f)
+{
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof(v));
+	return v;
+}
+
+static float bits_float(uint32_t v)
+{
+	float f;
+
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+/*
+ * '0'                      same value
+ * '10' + bits              XOR inside the previous window
+ * '11' + 5 lead + 5 len-1  new window, then len bits
+ */
+static void put_value(TS_BLOCK_T *b, TS_XOR_T *x, uint32_t v)
+{
+	uint32_t d = v ^ x->prev;
+	int lead, trail, len;
+
+	x->prev = v;
+	if (d == 0) {
+		put_bits(b, 0, 1);
+		return;
+	}
+
+	lead = __builtin_clz(d);
+	trail = __builtin_ctz(d);
+	if (x->lead != NO_WINDOW && lead >= x->lead && trail >= x->trail) {
+		put_bits(b, 2, 2);
+		put_bits(b, d >> x->trail, 32 - x->lead - x->trail);
+		return;
+	}
+
+	len = 32 - lead - trail;
+	put_bits(b, 3, 2);
+	put_bits(b, lead, 5);
+	put_bits(b, len - 1, 5);
+	put_bits(b, d >> trail, len);
+	x->lead = lead;
+	x->trail = trail;
+}
+
+static int get_value(TS_BLOCK_T *b, TS_XOR_T *x, uint32_t *v)
+{
+	uint64_t bit, lead, len, d;
+
+	if (get_bits(b, 1, &bit) != 0)
+		return -1;
+	if (bit == 0) {
+		*v = x->prev;
+		return 0;
+	}
+
+	if (get_bits(b, 1, &bit) != 0)
+		return -1;
+	if (bit == 0) {
+		if (x->lead == NO_WINDOW ||
+		    get_bits(b, 32 - x->lead - x->trail, &d) != 0)
+			return -1;
+	} else {
+		if (get_bits(b, 5, &lead) != 0 || get_bits(b, 5, &len) != 0)
+			return -1;
+		len++;
+		if (lead + len > 32 || get_bits(b, len, &d) != 0)
+			return -1;
+		x->lead = lead;
+		x->trail = 32 - lead - len;
+	}
+
+	x->prev ^= (uint32_t)d << x->trail;
+	*v = x->prev;
+	return 0;
+}
+
+/*
+ * delta of delta:
+ * '0'                dod == 0
+ * '10'   + 7 bits    [-63, 64]
+ * '110'  + 9 bits    [-255, 256]
+ * '1110' + 12 bits   [-2047, 2048]
+ * '1111' + 32 bits   anything else that fits an int32
+ */
+static void put_time(TS_BLOCK_T *b, int64_t dod)
+{
+	if (dod == 0) {
+		put_bits(b, 0, 1);
+	} else if (dod >= -63 && dod <= 64) {
+		put_bits(b, 2, 2);
+		put_bits(b, dod + 63, 7);
+	} else if (dod >= -255 && dod <= 256) {
+		put_bits(b, 6, 3);
+		put_bits(b, dod + 255, 9);
+	} else if (dod >= -2047 && dod <= 2048) {
+		put_bits(b, 14, 4);
+		put_bits(b, dod + 2047, 12);
+	} else {
+		put_bits(b, 15, 4);
+		put_bits(b, (uint32_t)(int32_t)dod, 32);
+	}
+}
+
+static int get_time(TS_BLOCK_T *b, int64_t *dod)
+{
+	static const struct{ int bits; int bias; }ranges[] = {
+		{ 7, 63 }, { 9, 255 }, { 12, 2047 },
+	};
+	uint64_t bit, v;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (get_bits(b, 1, &bit) != 0)
+			return -1;
+		if (bit == 0)
+			break;
+	}
+
+	if (i == 0) {
+		*dod = 0;
+	} else if (i < 4) {
+		if (get_bits(b, ranges[i - 1].bits, &v) != 0)
+			return -1;
+		*dod = (int64_t)v - ranges[i - 1].bias;
+	} else {
+		if (get_bits(b, 32, &v) != 0)
+			return -1;
+		*dod = (int32_t)(uint32_t)v;
+	}
+	return 0;
+}
+
+void ts_block_init(TS_BLOCK_T *b, uint8_t *buf, uint32_t size)
+{
+	memset(b, 0, sizeof(*b));
+	b->buf = buf;
+	b->size = size;
+	b->temp.lead = b->hum.lead = NO_WINDOW;
+}
+
+int ts_block_append(TS_BLOCK_T *b, const STATUS_FAST_T *s)
+{
+	int64_t delta, dod;
+
+	if (b->bits + TS_SAMPLE_MAX_BITS > b->size * 8)
+		return -1;
+
+	if (b->count == 0) {
+		put_bits(b, (uint64_t)(int64_t)s->time, 64);
+		put_bits(b, float_bits(s->fTemp), 32);
+		put_bits(b, float_bits(s->fHum), 32);
+		b->temp.prev = float_bits(s->fTemp);
+		b->hum.prev = float_bits(s->fHum);
+		b->first = b->time = s->time;
+		b->count = 1;
+		return 0;
+	}
+
+	delta = (int64_t)s->time - b->time;
+	dod = delta - b->delta;
+	if (dod < INT32_MIN || dod > INT32_MAX)
+		return -1;
+
+	put_time(b, dod);
+	put_value(b, &b->temp, float_bits(s->fTemp));
+	put_value(b, &b->hum, float_bits(s->fHum));
+	b->time = s->time;
+	b->delta = delta;
+	b->count++;
+	return 0;
+}
+
+uint32_t ts_block_bytes(const TS_BLOCK_T *b)
+{
+	return (b->bits + 7) >> 3;
+}
+
+void ts_block_open(TS_BLOCK_T *b, const uint8_t *buf, uint32_t size, uint32_t count)
+{
+	/* the decoder never writes into buf */
+	ts_block_init(b, (uint8_t *)buf, size);
+	b->count = count;
+}
+
+int ts_block_next(TS_BLOCK_T *b, STATUS_FAST_T *s)
+{
+	uint64_t v, t, h;
+	uint32_t temp, hum;
+	int64_t dod;
+
+	if (b->count == 0)
+		return -1;
+
+	if (b->bits == 0) {
+		if (get_bits(b, 64, &v) != 0 || get_bits(b, 32, &t) != 0 ||
+		    get_bits(b, 32, &h) != 0)
+			return -1;
+		b->first = b->time = (int64_t)v;
+		b->temp.prev = t;
+		b->hum.prev = h;
+		temp = t;
+		hum = h;
+	} else {
+		if (get_time(b, &dod) != 0 ||
+		    get_value(b, &b->temp, &temp) != 0 ||
+		    get_value(b, &b->hum, &hum) != 0)
+			return -1;
+		b->delta += dod;
+		b->time += b->delta;
+	}
+
+	s->time = b->time;
+	s->fTemp = bits_float(temp);
+	s->fHum = bits_float(hum);
+	b->count--;
+	return 0;
+}
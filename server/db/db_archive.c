@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_archive.h"
+
+#define TAG "archive"
+
+#define DAY		(24 * 3600)
+#define NAP_MS		100
+
+#define ATTACH_SQL	"ATTACH DATABASE ? AS " DB_ARCHIVE_SCHEMA ";"
+#define OLDEST_SQL	"SELECT ID, START, END, COUNT, SAMPLES, DEV FROM BLOCK WHERE END < ? ORDER BY END LIMIT 1;"
+/* nothing if an interrupted move already copied this very block */
+#define COPY_SQL	"INSERT INTO BLOCK(HOT_ID, START, END, COUNT, SAMPLES, DEV) " \
+			"SELECT ?1, ?2, ?3, ?4, ?5, ?6 WHERE NOT EXISTS (SELECT 1 FROM BLOCK " \
+			"WHERE HOT_ID = ?1 AND DEV = ?6 AND START = ?2 AND END = ?3 AND COUNT = ?4 AND SAMPLES = ?5);"
+#define REMOVE_SQL	"DELETE FROM BLOCK WHERE ID = ?;"
+
+static DB_SQLITE_T hot;		/* own connection to eSQLITE_DATA */
+static DB_SQLITE_T *cold;
+static pthread_t thread;
+static atomic_int running;
+static atomic_uint_fast64_t moved_blocks, moved_bytes;
+
+int db_archive_attach(DB_SQLITE_T *db)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	if (glb->db[eSQLITE_ARCHIVE].name[0] == 0)
+		return 0;
+
+	if (sqlite3_prepare_v2(db->sqlite, ATTACH_SQL, -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+	sqlite3_bind_text(stmt, 1, glb->db[eSQLITE_ARCHIVE].name, -1, SQLITE_STATIC);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE) {
+		log(TAG, LOG_ERROR, "attach %s to %s failed: %s\n",
+		    glb->db[eSQLITE_ARCHIVE].name, db->name, sqlite3_errmsg(db->sqlite));
+		return -1;
+	}
+	return 0;
+}
+
+/* sleep ms, or less when stopped */
+static void nap(int64_t ms)
+{
+	struct timespec ts = { 0, NAP_MS * 1000000 };
+
+	while (ms > 0 && atomic_load(&running)) {
+		if (ms < NAP_MS)
+			ts.tv_nsec = ms * 1000000;
+		nanosleep(&ts, NULL);
+		ms -= NAP_MS;
+	}
+}
+
+/* move the oldest block due, returns its size, 0 if none is due, -1 on error */
+static int move_one(void)
+{
+	sqlite3_int64 id, start, end, dev;
+	sqlite3_stmt *stmt;
+	void *samples = NULL;
+	int count, len, rc;
+
+	/* copy the block out, this read transaction ends with the reset */
+	stmt = db_sqlite_stmt(&hot, OLDEST_SQL);
+	if (stmt == NULL)
+		return -1;
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)time(NULL) - DB_ARCHIVE_HOT_DAYS * DAY);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		id = sqlite3_column_int64(stmt, 0);
+		start = sqlite3_column_int64(stmt, 1);
+		end = sqlite3_column_int64(stmt, 2);
+		count = sqlite3_column_int(stmt, 3);
+		dev = sqlite3_column_int64(stmt, 5);
+		len = sqlite3_column_bytes(stmt, 4);
+		samples = malloc(len ? len : 1);
+		if (samples)
+			memcpy(samples, sqlite3_column_blob(stmt, 4), len);
+	}
+	sqlite3_reset(stmt);
+	if (rc == SQLITE_DONE)
+		return 0;
+	if (rc != SQLITE_ROW || samples == NULL)
+		goto err;
+
+	/* synchronous=FULL: on disk before it leaves the data database */
+	stmt = db_sqlite_stmt(cold, COPY_SQL);
+	if (stmt == NULL)
+		goto err;
+	sqlite3_bind_int64(stmt, 1, id);
+	sqlite3_bind_int64(stmt, 2, start);
+	sqlite3_bind_int64(stmt, 3, end);
+	sqlite3_bind_int(stmt, 4, count);
+	sqlite3_bind_blob(stmt, 5, samples, len, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 6, dev);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc == SQLITE_DONE && sqlite3_changes(cold->sqlite) == 0)
+		log(TAG, LOG_DEBUG, "block %lld already archived\n", (long long)id);
+	if (rc != SQLITE_DONE) {
+		log(TAG, LOG_ERROR, "copy block %lld/%lld failed: %s\n", (long long)dev, (long long)start,
+		    sqlite3_errmsg(cold->sqlite));
+		goto err;
+	}
+
+	stmt = db_sqlite_stmt(&hot, REMOVE_SQL);
+	if (stmt == NULL)
+		goto err;
+	sqlite3_bind_int64(stmt, 1, id);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE) {
+		/* copied again on the next pass, the archive keeps one */
+		log(TAG, LOG_WARNING, "remove block %lld/%lld failed: %s\n", (long long)dev, (long long)start,
+		    sqlite3_errmsg(hot.sqlite));
+		goto err;
+	}
+
+	free(samples);
+	atomic_fetch_add(&moved_blocks, 1);
+	atomic_fetch_add(&moved_bytes, len);
+	return len;
+
+err:
+	free(samples);
+	return -1;
+}
+
+static void *db_archive_thread(void *arg)
+{
+	int len;
+
+	while (atomic_load(&running)) {
+		len = move_one();
+		if (len > 0)
+			nap((int64_t)len * 1000 / DB_ARCHIVE_RATE + 1);
+		else
+			nap(DB_ARCHIVE_IDLE_S * 1000);
+	}
+	return NULL;
+}
+
+int db_archive_start(void)
+{
+	cold = &glb->db[eSQLITE_ARCHIVE];
+	if (atomic_load(&running) || cold->sqlite == NULL || glb->db[eSQLITE_DATA].sqlite == NULL)
+		return -1;
+
+	memset(&hot, 0, sizeof(hot));
+	snprintf(hot.name, sizeof(hot.name), "%s", glb->db[eSQLITE_DATA].name);
+	if (db_sqlite_open(&hot) != 0)
+		return -1;
+	if (db_sqlite_exec(cold, "PRAGMA synchronous=FULL;") != 0)
+		goto err;
+
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, db_archive_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		goto err;
+	}
+
+	log(TAG, LOG_INFO, "blocks older than %d days moved to %s\n", DB_ARCHIVE_HOT_DAYS, cold->name);
+	return 0;
+
+err:
+	db_sqlite_close(&hot);
+	return -1;
+}
+
+void db_archive_stop(void)
+{
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	pthread_join(thread, NULL);
+	db_sqlite_close(&hot);
+	log(TAG, LOG_INFO, "%llu blocks, %llu bytes archived\n",
+	    (unsigned long long)atomic_load(&moved_blocks),
+	    (unsigned long long)atomic_load(&moved_bytes));
+}
+
+void db_archive_stats(DB_ARCHIVE_STATS_T *st)
+{
+	st->blocks = atomic_load(&moved_blocks);
+	st->bytes = atomic_load(&moved_bytes);
+}
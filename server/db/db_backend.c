@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_store.h"
+#include "db_block.h"
+#include "db_rollup.h"
+#include "db_journal.h"
+#include "db_archive.h"
+#include "db_backend.h"
+
+#define TAG "backend"
+
+#define QUERY_CHUNK_S	(24 * 3600)	/* seconds of samples per read transaction */
+
+/* the first and last sample time of each tier, through the indexes */
+#define RANGE_SQL	"SELECT (SELECT MIN(START) FROM main.BLOCK), (SELECT MAX(END) FROM main.BLOCK)," \
+			"(SELECT MIN(TIME) FROM DATA), (SELECT MAX(TIME) FROM DATA);"
+#define ARCHIVE_RANGE_SQL "SELECT (SELECT MIN(START) FROM " DB_ARCHIVE_SCHEMA ".BLOCK)," \
+			"(SELECT MAX(END) FROM " DB_ARCHIVE_SCHEMA ".BLOCK);"
+
+static const DB_BACKEND_T *backends[] = {
+	&db_backend_sqlite,
+	&db_backend_memory,
+};
+
+const DB_BACKEND_T *db_backend_find(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (!strcmp(backends[i]->name, name))
+			return backends[i];
+	}
+	return NULL;
+}
+
+static void sqlite_close(void)
+{
+	db_journal_close();
+	db_sqlite_close(&glb->db[eSQLITE_ARCHIVE]);
+	db_sqlite_close(&glb->db[eSQLITE_DATA]);
+}
+
+static int sqlite_open(void)
+{
+	DB_SQLITE_T *db = &glb->db[eSQLITE_DATA];
+	char path[sizeof(db->name) + 8];
+
+	if (db_sqlite_open(db) != 0)
+		goto err;
+	if (glb->db[eSQLITE_ARCHIVE].name[0] && db_sqlite_open(&glb->db[eSQLITE_ARCHIVE]) != 0)
+		goto err;
+	if (db_archive_attach(db) != 0)
+		goto err;
+
+	/* samples journaled before a crash but not in the database yet */
+	snprintf(path, sizeof(path), "%s.jnl", db->name);
+	if (db_journal_open(path) != 0)
+		log(TAG, LOG_WARNING, "samples are not journaled\n");
+	else if (db_journal_replay(db) != 0)
+		goto err;
+	return 0;
+
+err:
+	sqlite_close();
+	return -1;
+}
+
+static int sqlite_append(const STATUS_FAST_T *s, unsigned n)
+{
+	DB_SQLITE_T *db = &glb->db[eSQLITE_DATA];
+	int stored;
+
+	stored = db_store_apply(db, s, n, db_journal_seq());
+	if (stored >= 0)
+		db_journal_checkpoint(db);
+	return stored;
+}
+
+static void widen(sqlite3_stmt *stmt, int col, int64_t *first, int64_t *last)
+{
+	int64_t v;
+
+	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+		return;
+	v = sqlite3_column_int64(stmt, col);
+	if (col % 2 == 0 && v < *first)
+		*first = v;
+	if (col % 2 == 1 && v > *last)
+		*last = v;
+}
+
+/* time of the first and last sample stored, first > last if there is none */
+static int range_of(DB_SQLITE_T *db, int64_t *first, int64_t *last)
+{
+	sqlite3_stmt *stmt;
+	int i, rc;
+
+	*first = INT64_MAX;
+	*last = INT64_MIN;
+
+	stmt = db_sqlite_stmt(db, RANGE_SQL);
+	if (stmt == NULL)
+		return -1;
+	rc = sqlite3_step(stmt);
+	for (i = 0; rc == SQLITE_ROW && i < 4; i++)
+		widen(stmt, i, first, last);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_ROW)
+		return -1;
+
+	if (sqlite3_db_filename(db->sqlite, DB_ARCHIVE_SCHEMA) == NULL)
+		return 0;
+	stmt = db_sqlite_stmt(db, ARCHIVE_RANGE_SQL);
+	if (stmt == NULL)
+		return -1;
+	rc = sqlite3_step(stmt);
+	for (i = 0; rc == SQLITE_ROW && i < 2; i++)
+		widen(stmt, i, first, last);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_ROW ? 0 : -1;
+}
+
+typedef struct{
+	DB_SAMPLE_CB cb;
+	void *arg;
+	int stop;
+}QUERY_T;
+
+static int on_sample(const STATUS_FAST_T *s, void *arg)
+{
+	QUERY_T *q = arg;
+
+	q->stop = q->cb(s, q->arg);
+	return q->stop;
+}
+
+/* a query-only connection of the caller, with the archive attached */
+static int open_reader(DB_SQLITE_T *db)
+{
+	memset(db, 0, sizeof(*db));
+	snprintf(db->name, sizeof(db->name), "%s", glb->db[eSQLITE_DATA].name);
+	if (db_sqlite_open(db) != 0)
+		return -1;
+	if (db_sqlite_exec(db, "PRAGMA query_only=1;") != 0 || db_archive_attach(db) != 0) {
+		db_sqlite_close(db);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The range is clamped to the stored samples and read one QUERY_CHUNK_S
+ * window per transaction, so a long query never holds a checkpoint back
+ * for long.
+ */
+static int sqlite_query(uint64_t dev, time_t from, time_t to, DB_SAMPLE_CB cb, void *arg)
+{
+	QUERY_T q = { cb, arg, 0 };
+	DB_SQLITE_T db;
+	int64_t first, last, t, end;
+	int rc = -1;
+
+	if (open_reader(&db) != 0)
+		return -1;
+	if (range_of(&db, &first, &last) != 0)
+		goto out;
+
+	if (first < from)
+		first = from;
+	if (last > to)
+		last = to;
+
+	rc = 0;
+	for (t = first; t <= last && rc == 0 && !q.stop; t = end + 1) {
+		end = last - t >= QUERY_CHUNK_S ? t + QUERY_CHUNK_S - 1 : last;
+		rc = db_block_query(&db, dev, (time_t)t, (time_t)end, on_sample, &q);
+		if (end == last)
+			break;
+	}
+
+out:
+	db_sqlite_close(&db);
+	return rc;
+}
+
+/* one transaction: buckets are few, and below a minute the range is short */
+static int sqlite_rollup(uint64_t dev, time_t from, time_t to, int resolution,
+		DB_ROLLUP_CB cb, void *arg)
+{
+	DB_SQLITE_T db;
+	int rc;
+
+	if (open_reader(&db) != 0)
+		return -1;
+	rc = db_rollup_query(&db, dev, from, to, resolution, cb, arg);
+	db_sqlite_close(&db);
+	return rc;
+}
+
+const DB_BACKEND_T db_backend_sqlite = {
+	.name = "sqlite",
+	.open = sqlite_open,
+	.close = sqlite_close,
+	.append = sqlite_append,
+	.query = sqlite_query,
+	.rollup = sqlite_rollup,
+};
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_block.h"
+#include "db_archive.h"
+#include "devmap.h"
+
+#define TAG "block"
+
+#define LOAD_CHUNK		1024
+
+#define INSERT_BLOCK_SQL	"INSERT INTO BLOCK(DEV, START, END, COUNT, SAMPLES) VALUES(?, ?, ?, ?, ?);"
+/* the rows of the block, not the late ones of earlier spans */
+#define DELETE_ROWS_SQL		"DELETE FROM DATA WHERE DEV = ?1 AND ROWID <= ?2 AND TIME >= ?3;"
+#define LATE_ROWS_SQL		"SELECT TIME, TEMP, HUM FROM DATA WHERE DEV = ?1 AND TIME < ?2 ORDER BY TIME;"
+#define DELETE_LATE_SQL		"DELETE FROM DATA WHERE DEV = ?1 AND TIME < ?2;"
+#define LOAD_ROWS_SQL		"SELECT ROWID, DEV, TIME, TEMP, HUM FROM DATA WHERE ROWID > ? ORDER BY ROWID LIMIT ?;"
+/*
+ * ?1 from, ?2 to, ?3 the span start of from, ?4 the device. A block never
+ * crosses its span: START >= ?3 bounds the index range.
+ */
+#define QUERY_BLOCK_SQL		"SELECT DEV, COUNT, SAMPLES FROM main.BLOCK " \
+				"WHERE START >= ?3 AND START <= ?2 AND END >= ?1 ORDER BY START;"
+#define QUERY_DEV_BLOCK_SQL	"SELECT DEV, COUNT, SAMPLES FROM main.BLOCK " \
+				"WHERE DEV = ?4 AND START >= ?3 AND START <= ?2 AND END >= ?1 ORDER BY START;"
+/*
+ * a block being moved may be in both databases, the one in main is used;
+ * DEV and START guard against main reusing the ID of a block it moved
+ */
+#define NOT_IN_MAIN		" AND NOT EXISTS (SELECT 1 FROM main.BLOCK m " \
+				"WHERE m.ID = a.HOT_ID AND m.DEV = a.DEV AND m.START = a.START)"
+#define QUERY_ARCHIVE_SQL	"SELECT DEV, COUNT, SAMPLES FROM " DB_ARCHIVE_SCHEMA ".BLOCK a " \
+				"WHERE START >= ?3 AND START <= ?2 AND END >= ?1" NOT_IN_MAIN " ORDER BY START;"
+#define QUERY_DEV_ARCHIVE_SQL	"SELECT DEV, COUNT, SAMPLES FROM " DB_ARCHIVE_SCHEMA ".BLOCK a " \
+				"WHERE DEV = ?4 AND START >= ?3 AND START <= ?2 AND END >= ?1" NOT_IN_MAIN \
+				" ORDER BY START;"
+#define MAIN_FIRST_SQL		"SELECT 1 FROM main.BLOCK LIMIT 1;"
+#define QUERY_ROWS_SQL		"SELECT DEV, TIME, TEMP, HUM FROM DATA " \
+				"WHERE TIME >= ?1 AND TIME <= ?2 ORDER BY ROWID;"
+#define QUERY_DEV_ROWS_SQL	"SELECT DEV, TIME, TEMP, HUM FROM DATA " \
+				"WHERE DEV = ?4 AND TIME >= ?1 AND TIME <= ?2 ORDER BY ROWID;"
+
+static int64_t span_of(time_t t)
+{
+	int64_t v = t;
+
+	return v >= 0 ? v / DB_BLOCK_SPAN : (v - DB_BLOCK_SPAN + 1) / DB_BLOCK_SPAN;
+}
+
+static int insert_block(DB_SQLITE_T *db, uint64_t dev, int64_t start, int64_t end,
+		const TS_BLOCK_T *blk)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, INSERT_BLOCK_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)dev);
+	sqlite3_bind_int64(stmt, 2, start);
+	sqlite3_bind_int64(stmt, 3, end);
+	sqlite3_bind_int(stmt, 4, blk->count);
+	sqlite3_bind_blob(stmt, 5, blk->buf, ts_block_bytes(blk), SQLITE_STATIC);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+/* the DATA rows of dev up to rowid and from time on */
+static int delete_rows(DB_SQLITE_T *db, uint64_t dev, sqlite3_int64 rowid, int64_t time)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, DELETE_ROWS_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)dev);
+	sqlite3_bind_int64(stmt, 2, rowid);
+	sqlite3_bind_int64(stmt, 3, time);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+/* the late rows of dev before span into blocks of their span, then drop them */
+static int compact_late(DB_SQLITE_T *db, uint64_t dev, int64_t span)
+{
+	static uint8_t buf[DB_BLOCK_BYTES];	/* storage thread only */
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, LATE_ROWS_SQL);
+	STATUS_FAST_T s;
+	TS_BLOCK_T blk;
+	int64_t cur = 0;
+	int rc, n = 0, blocks = 0;
+
+	if (stmt == NULL)
+		return -1;
+	ts_block_init(&blk, buf, sizeof(buf));
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)dev);
+	sqlite3_bind_int64(stmt, 2, span * DB_BLOCK_SPAN);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		s.time = sqlite3_column_int64(stmt, 0);
+		s.fTemp = db_sqlite_column_real(stmt, 1);
+		s.fHum = db_sqlite_column_real(stmt, 2);
+		if (blk.count && (span_of(s.time) != cur || ts_block_append(&blk, &s) != 0)) {
+			if (insert_block(db, dev, blk.first, blk.time, &blk) != 0)
+				goto err;
+			blocks++;
+			ts_block_init(&blk, buf, sizeof(buf));
+		}
+		if (blk.count == 0) {
+			ts_block_append(&blk, &s);
+			cur = span_of(s.time);
+		}
+		n++;
+	}
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE)
+		return -1;
+	if (n == 0)
+		return 0;
+	if (insert_block(db, dev, blk.first, blk.time, &blk) != 0)
+		return -1;
+
+	stmt = db_sqlite_stmt(db, DELETE_LATE_SQL);
+	if (stmt == NULL)
+		return -1;
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)dev);
+	sqlite3_bind_int64(stmt, 2, span * DB_BLOCK_SPAN);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE)
+		return -1;
+	log(TAG, LOG_DEBUG, "%llu: %d late samples in %d blocks\n", (unsigned long long)dev, n, blocks + 1);
+	return 0;
+
+err:
+	sqlite3_reset(stmt);
+	return -1;
+}
+
+/* write the open block of dev, drop its DATA rows and compact the late ones */
+static int close_block(DB_BLOCK_OPEN_T *o, uint64_t dev, DB_SQLITE_T *db)
+{
+	if (insert_block(db, dev, o->start, o->end, &o->blk) != 0 ||
+	    delete_rows(db, dev, o->lastRowid, o->span * DB_BLOCK_SPAN) != 0 ||
+	    compact_late(db, dev, o->span) != 0) {
+		log(TAG, LOG_ERROR, "close block failed: %s\n", sqlite3_errmsg(db->sqlite));
+		return -1;
+	}
+
+	log(TAG, LOG_DEBUG, "block %llu %lld..%lld: %u samples in %u bytes\n",
+	    (unsigned long long)dev, (long long)o->start, (long long)o->end,
+	    o->blk.count, ts_block_bytes(&o->blk));
+	o->blk.count = 0;
+	return 0;
+}
+
+/* append s, doubling the buffer while the block is below DB_BLOCK_BYTES */
+static int append(DB_BLOCK_OPEN_T *o, const STATUS_FAST_T *s)
+{
+	uint32_t size;
+	uint8_t *buf;
+
+	while (ts_block_append(&o->blk, s) != 0) {
+		if (o->blk.bits + TS_SAMPLE_MAX_BITS <= o->blk.size * 8 || o->blk.size >= DB_BLOCK_BYTES)
+			return -1;
+		size = o->blk.size * 2 < DB_BLOCK_BYTES ? o->blk.size * 2 : DB_BLOCK_BYTES;
+		buf = realloc(o->buf, size);
+		if (buf == NULL)
+			return -1;
+		o->buf = o->blk.buf = buf;
+		o->blk.size = size;
+	}
+	return 0;
+}
+
+/* start an empty block, with the buffer of the previous one */
+static int restart(DB_BLOCK_OPEN_T *o)
+{
+	if (o->buf == NULL) {
+		o->buf = malloc(DB_BLOCK_MIN_BYTES);
+		if (o->buf == NULL)
+			return -1;
+		o->blk.size = DB_BLOCK_MIN_BYTES;
+	}
+	ts_block_init(&o->blk, o->buf, o->blk.size);
+	return 0;
+}
+
+int db_block_add(DB_BLOCK_WRITER_T *w, DB_SQLITE_T *db, const STATUS_FAST_T *s,
+		sqlite3_int64 rowid)
+{
+	DB_BLOCK_OPEN_T *o = devmap_get(w->open, s->dev, 1);
+	int64_t span = span_of(s->time);
+
+	if (o == NULL)
+		return -1;
+	/* late: the row waits in DATA for the next close, the open block goes on */
+	if (o->blk.count > 0 && span < o->span)
+		return 0;
+	if (o->blk.count > 0 && span == o->span && append(o, s) == 0) {
+		if (s->time < o->start)
+			o->start = s->time;
+		if (s->time > o->end)
+			o->end = s->time;
+		o->lastRowid = rowid;
+		return 0;
+	}
+	if (o->blk.count > 0 && close_block(o, s->dev, db) != 0)
+		return -1;
+
+	if (restart(o) != 0 || append(o, s) != 0)
+		return -1;
+	o->span = span;
+	o->start = o->end = s->time;
+	o->lastRowid = rowid;
+	return 0;
+}
+
+static int free_buf(uint64_t dev, void *rec, void *arg)
+{
+	DB_BLOCK_OPEN_T *o = rec;
+
+	free(o->buf);
+	return 0;
+}
+
+void db_block_release(DB_BLOCK_WRITER_T *w)
+{
+	if (w->open == NULL)
+		return;
+	devmap_each(w->open, free_buf, NULL);
+	devmap_destroy(w->open);
+	w->open = NULL;
+}
+
+int db_block_load(DB_BLOCK_WRITER_T *w, DB_SQLITE_T *db)
+{
+	sqlite3_int64 rowids[LOAD_CHUNK], last = 0;
+	STATUS_FAST_T rows[LOAD_CHUNK];
+	sqlite3_stmt *stmt;
+	int n, i;
+
+	db_block_release(w);
+	w->open = devmap_create(sizeof(DB_BLOCK_OPEN_T));
+	if (w->open == NULL)
+		return -1;
+
+	if (db_sqlite_exec(db, "BEGIN;") != 0)
+		return -1;
+
+	/* in chunks: closing a block deletes rows behind the cursor */
+	do {
+		stmt = db_sqlite_stmt(db, LOAD_ROWS_SQL);
+		if (stmt == NULL)
+			goto err;
+		sqlite3_bind_int64(stmt, 1, last);
+		sqlite3_bind_int(stmt, 2, LOAD_CHUNK);
+		for (n = 0; n < LOAD_CHUNK && sqlite3_step(stmt) == SQLITE_ROW; n++) {
+			rowids[n] = sqlite3_column_int64(stmt, 0);
+			rows[n].dev = sqlite3_column_int64(stmt, 1);
+			rows[n].time = sqlite3_column_int64(stmt, 2);
+			rows[n].fTemp = db_sqlite_column_real(stmt, 3);
+			rows[n].fHum = db_sqlite_column_real(stmt, 4);
+		}
+		sqlite3_reset(stmt);
+
+		for (i = 0; i < n; i++) {
+			if (db_block_add(w, db, &rows[i], rowids[i]) != 0)
+				goto err;
+		}
+		if (n > 0)
+			last = rowids[n - 1];
+	} while (n == LOAD_CHUNK);
+
+	if (db_sqlite_exec(db, "COMMIT;") != 0)
+		goto err;
+
+	log(TAG, LOG_DEBUG, "open blocks of %u devices\n", devmap_count(w->open));
+	return 0;
+
+err:
+	db_sqlite_exec(db, "ROLLBACK;");
+	db_block_release(w);
+	return -1;
+}
+
+static void bind_query(sqlite3_stmt *stmt, uint64_t dev, time_t from, time_t to)
+{
+	sqlite3_bind_int64(stmt, 1, from);
+	sqlite3_bind_int64(stmt, 2, to);
+	sqlite3_bind_int64(stmt, 3, span_of(from) * DB_BLOCK_SPAN);
+	if (dev != DB_DEV_ALL)
+		sqlite3_bind_int64(stmt, 4, (sqlite3_int64)dev);
+}
+
+/* blocks of [from, to] */
+static int query_blocks(DB_SQLITE_T *db, const char *sql, uint64_t dev, time_t from, time_t to,
+		DB_SAMPLE_CB cb, void *arg)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, sql);
+	STATUS_FAST_T s;
+	TS_BLOCK_T blk;
+	int rc, stop = 0;
+
+	if (stmt == NULL)
+		return -1;
+
+	bind_query(stmt, dev, from, to);
+	while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		s.dev = sqlite3_column_int64(stmt, 0);
+		ts_block_open(&blk, sqlite3_column_blob(stmt, 2),
+			      sqlite3_column_bytes(stmt, 2), sqlite3_column_int(stmt, 1));
+		while (!stop && ts_block_next(&blk, &s) == 0) {
+			if (s.time >= from && s.time <= to)
+				stop = cb(&s, arg);
+		}
+		if (blk.count)
+			log(TAG, LOG_WARNING, "block %llu at %lld is truncated\n",
+			    (unsigned long long)s.dev, (long long)blk.first);
+	}
+	sqlite3_reset(stmt);
+	return stop ? 1 : (rc == SQLITE_DONE ? 0 : -1);
+}
+
+static int query_rows(DB_SQLITE_T *db, uint64_t dev, time_t from, time_t to,
+		DB_SAMPLE_CB cb, void *arg)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, dev == DB_DEV_ALL ? QUERY_ROWS_SQL : QUERY_DEV_ROWS_SQL);
+	STATUS_FAST_T s;
+	int rc, stop = 0;
+
+	if (stmt == NULL)
+		return -1;
+
+	bind_query(stmt, dev, from, to);
+	while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		s.dev = sqlite3_column_int64(stmt, 0);
+		s.time = sqlite3_column_int64(stmt, 1);
+		s.fTemp = db_sqlite_column_real(stmt, 2);
+		s.fHum = db_sqlite_column_real(stmt, 3);
+		stop = cb(&s, arg);
+	}
+	sqlite3_reset(stmt);
+	return stop ? 1 : (rc == SQLITE_DONE ? 0 : -1);
+}
+
+/* start the read transaction on main */
+static int main_first(DB_SQLITE_T *db)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, MAIN_FIRST_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_ROW || rc == SQLITE_DONE ? 0 : -1;
+}
+
+int db_block_query(DB_SQLITE_T *db, uint64_t dev, time_t from, time_t to,
+		DB_SAMPLE_CB cb, void *arg)
+{
+	int all = dev == DB_DEV_ALL;
+	int rc = 0;
+
+	/* one read transaction: a block closing meanwhile is seen once */
+	if (db_sqlite_exec(db, "BEGIN;") != 0)
+		return -1;
+
+	/*
+	 * Archived blocks first. main is read first so that its snapshot is
+	 * the older one: a block being moved is then either still in main or
+	 * already in the archive, and an archived block also in main is left
+	 * to main.
+	 */
+	if (sqlite3_db_filename(db->sqlite, DB_ARCHIVE_SCHEMA) != NULL) {
+		rc = main_first(db);
+		if (rc == 0)
+			rc = query_blocks(db, all ? QUERY_ARCHIVE_SQL : QUERY_DEV_ARCHIVE_SQL,
+					  dev, from, to, cb, arg);
+	}
+	if (rc == 0)
+		rc = query_blocks(db, all ? QUERY_BLOCK_SQL : QUERY_DEV_BLOCK_SQL, dev, from, to, cb, arg);
+	if (rc == 0)
+		rc = query_rows(db, dev, from, to, cb, arg);
+	db_sqlite_exec(db, "COMMIT;");
+	return rc < 0 ? -1 : 0;
+}
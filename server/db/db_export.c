@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "db_backend.h"
+#include "db_export.h"
+
+#define TAG "export"
+
+#define LINE_MAX_BYTES	128	/* one formatted sample, with room to spare */
+
+typedef struct{
+	int fd;
+	DB_EXPORT_FMT_E fmt;
+	int64_t count;
+	int err;
+	size_t len;
+	char buf[DB_EXPORT_BUF];
+}EXPORT_T;
+
+/* send() first: a client gone away is an error, not a SIGPIPE */
+static int write_all(int fd, const char *p, size_t len)
+{
+	int sock = 1;
+	ssize_t n;
+
+	while (len > 0) {
+		n = sock ? send(fd, p, len, MSG_NOSIGNAL) : write(fd, p, len);
+		if (n < 0 && errno == ENOTSOCK && sock) {
+			sock = 0;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int flush(EXPORT_T *x)
+{
+	if (x->len && write_all(x->fd, x->buf, x->len) != 0) {
+		log(TAG, LOG_WARNING, "write failed: %s\n", strerror(errno));
+		x->err = 1;
+	}
+	x->len = 0;
+	return x->err ? -1 : 0;
+}
+
+static void put(EXPORT_T *x, const char *s)
+{
+	x->len += snprintf(x->buf + x->len, sizeof(x->buf) - x->len, "%s", s);
+}
+
+/* NaN is not a number in JSON, and an empty field in CSV */
+static const char *value(char *out, size_t size, float v, const char *none)
+{
+	if (v != v)
+		return none;
+	snprintf(out, size, "%g", v);
+	return out;
+}
+
+static int on_sample(const STATUS_FAST_T *s, void *arg)
+{
+	EXPORT_T *x = arg;
+	char temp[24], hum[24];
+	int n;
+
+	if (sizeof(x->buf) - x->len < LINE_MAX_BYTES && flush(x) != 0)
+		return 1;
+
+	if (x->fmt == DB_EXPORT_JSON)
+		n = snprintf(x->buf + x->len, sizeof(x->buf) - x->len,
+			     "%s{\"time\":%lld,\"temp\":%s,\"hum\":%s,\"dev\":%llu}",
+			     x->count ? ",\n" : "", (long long)s->time,
+			     value(temp, sizeof(temp), s->fTemp, "null"),
+			     value(hum, sizeof(hum), s->fHum, "null"),
+			     (unsigned long long)s->dev);
+	else
+		n = snprintf(x->buf + x->len, sizeof(x->buf) - x->len, "%lld,%s,%s,%llu\n",
+			     (long long)s->time,
+			     value(temp, sizeof(temp), s->fTemp, ""),
+			     value(hum, sizeof(hum), s->fHum, ""),
+			     (unsigned long long)s->dev);
+	x->len += n;
+	x->count++;
+	return 0;
+}
+
+int64_t db_export(int fd, uint64_t dev, time_t from, time_t to, DB_EXPORT_FMT_E fmt)
+{
+	EXPORT_T x;
+
+	if (glb->pBackend == NULL)
+		return -1;
+
+	memset(&x, 0, sizeof(x));
+	x.fd = fd;
+	x.fmt = fmt;
+
+	put(&x, fmt == DB_EXPORT_JSON ? "[\n" : "time,temp,hum,dev\n");
+	if (glb->pBackend->query(dev, from, to, on_sample, &x) != 0)
+		x.err = 1;
+	if (!x.err) {
+		put(&x, fmt == DB_EXPORT_JSON ? (x.count ? "\n]\n" : "]\n") : "");
+		flush(&x);
+	}
+
+	if (x.err) {
+		log(TAG, LOG_ERROR, "export %lld..%lld failed after %lld samples\n",
+		    (long long)from, (long long)to, (long long)x.count);
+		return -1;
+	}
+	log(TAG, LOG_DEBUG, "%lld samples exported\n", (long long)x.count);
+	return x.count;
+}
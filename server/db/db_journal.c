@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_store.h"
+#include "db_journal.h"
+
+#define TAG "journal"
+
+#define REC_SZ		sizeof(DB_JOURNAL_REC_T)
+#define BUF_RECS	(DB_JOURNAL_SYNC_BYTES / REC_SZ)
+#define REPLAY_RECS	DB_STORE_BATCH
+
+#define APPLIED_SQL	"SELECT SEQ FROM JOURNAL WHERE ID = 0;"
+#define SET_APPLIED_SQL	"INSERT OR REPLACE INTO JOURNAL(ID, SEQ) VALUES(0, ?);"
+#define CHECKPOINT_SQL	"PRAGMA wal_checkpoint(TRUNCATE);"
+
+_Static_assert(sizeof(DB_JOURNAL_REC_T) == 40, "journal record is 40 bytes on disk");
+
+static int fd = -1;
+static char path_name[128];
+static uint64_t seq;		/* last assigned */
+static off_t size;		/* bytes written to the file */
+static off_t synced;		/* bytes known to be on disk */
+static int64_t first_pending;	/* ms, oldest record not synced */
+static DB_JOURNAL_REC_T buf[BUF_RECS];
+static unsigned nbuf;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t crc32(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t crc = 0xffffffff;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static int write_all(const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int db_journal_open(const char *path)
+{
+	struct stat st;
+
+	if (fd >= 0 || strlen(path) >= sizeof(path_name))
+		return -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		log(TAG, LOG_ERROR, "open %s failed\n", path);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	snprintf(path_name, sizeof(path_name), "%s", path);
+	size = synced = st.st_size;
+	nbuf = 0;
+	seq = 0;
+	return 0;
+}
+
+void db_journal_close(void)
+{
+	if (fd < 0)
+		return;
+	db_journal_sync(1);
+	close(fd);
+	fd = -1;
+}
+
+static int applied_seq(DB_SQLITE_T *db, uint64_t *applied)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, APPLIED_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+	*applied = 0;
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		*applied = sqlite3_column_int64(stmt, 0);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_ROW || rc == SQLITE_DONE ? 0 : -1;
+}
+
+int db_journal_replay(DB_SQLITE_T *db)
+{
+	DB_JOURNAL_REC_T rec[REPLAY_RECS];
+	STATUS_FAST_T samples[REPLAY_RECS];
+	uint64_t applied, last = 0, count = 0;
+	off_t off = 0;
+	ssize_t len;
+	int i, n, valid = 1;
+
+	if (fd < 0)
+		return 0;
+	if (applied_seq(db, &applied) != 0)
+		return -1;
+
+	while (valid && (len = pread(fd, rec, sizeof(rec), off)) > 0) {
+		for (i = 0, n = 0; i < len / (ssize_t)REC_SZ; i++) {
+			/* a record cut by a power loss, or garbage after it */
+			if (rec[i].crc != crc32(&rec[i], offsetof(DB_JOURNAL_REC_T, crc)) ||
+			    rec[i].seq <= last) {
+				valid = 0;
+				break;
+			}
+			last = rec[i].seq;
+			off += REC_SZ;
+			if (rec[i].seq <= applied)
+				continue;
+			samples[n].dev = rec[i].dev;
+			samples[n].time = rec[i].time;
+			samples[n].fTemp = rec[i].temp;
+			samples[n].fHum = rec[i].hum;
+			n++;
+		}
+		if (len % REC_SZ)
+			valid = 0;
+		if (n > 0) {
+			if (db_store_apply(db, samples, n, last) < 0) {
+				log(TAG, LOG_ERROR, "replay %s failed\n", path_name);
+				return -1;
+			}
+			count += n;
+		}
+	}
+
+	if (off < size) {
+		log(TAG, LOG_WARNING, "%s: %lld bytes of torn records dropped\n",
+		    path_name, (long long)(size - off));
+		if (ftruncate(fd, off) != 0 || fdatasync(fd) != 0)
+			return -1;
+		size = synced = off;
+	}
+
+	seq = last > applied ? last : applied;
+	if (count)
+		log(TAG, LOG_INFO, "%llu samples replayed from %s\n", (unsigned long long)count, path_name);
+	return 0;
+}
+
+int db_journal_append(const STATUS_FAST_T *s)
+{
+	DB_JOURNAL_REC_T *rec;
+
+	if (fd < 0)
+		return -1;
+	if (nbuf == BUF_RECS && db_journal_sync(1) != 0)
+		return -1;
+
+	rec = &buf[nbuf++];
+	memset(rec, 0, sizeof(*rec));
+	rec->seq = ++seq;
+	rec->time = s->time;
+	rec->dev = s->dev;
+	rec->temp = s->fTemp;
+	rec->hum = s->fHum;
+	rec->crc = crc32(rec, offsetof(DB_JOURNAL_REC_T, crc));
+
+	if (size + nbuf * REC_SZ == synced + REC_SZ)
+		first_pending = now_ms();
+	return 0;
+}
+
+int db_journal_sync(int force)
+{
+	off_t pending;
+
+	if (fd < 0)
+		return -1;
+
+	pending = size + nbuf * REC_SZ - synced;
+	if (pending == 0)
+		return 0;
+	if (!force && pending < DB_JOURNAL_SYNC_BYTES && now_ms() - first_pending < DB_JOURNAL_SYNC_MS)
+		return 0;
+
+	if (nbuf) {
+		if (write_all(buf, nbuf * REC_SZ) != 0) {
+			log(TAG, LOG_ERROR, "write %s failed\n", path_name);
+			return -1;
+		}
+		size += nbuf * REC_SZ;
+		nbuf = 0;
+	}
+	if (fdatasync(fd) != 0) {
+		log(TAG, LOG_ERROR, "sync %s failed\n", path_name);
+		return -1;
+	}
+	synced = size;
+	return 0;
+}
+
+uint64_t db_journal_seq(void)
+{
+	return fd < 0 ? 0 : seq;
+}
+
+int db_journal_applied(DB_SQLITE_T *db, uint64_t applied)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, SET_APPLIED_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+	sqlite3_bind_int64(stmt, 1, applied);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+int db_journal_checkpoint(DB_SQLITE_T *db)
+{
+	sqlite3_stmt *stmt;
+	int busy = 1;
+
+	if (fd < 0 || size + nbuf * REC_SZ < DB_JOURNAL_MAX_BYTES)
+		return 0;
+
+	/* the database file must hold every applied sample before they go */
+	stmt = db_sqlite_stmt(db, CHECKPOINT_SQL);
+	if (stmt == NULL)
+		return -1;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		busy = sqlite3_column_int(stmt, 0);
+	sqlite3_reset(stmt);
+	if (busy) {
+		log(TAG, LOG_DEBUG, "checkpoint busy, %s kept\n", path_name);
+		return -1;
+	}
+
+	/* records still buffered are applied too, no need to write them */
+	nbuf = 0;
+	if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+		log(TAG, LOG_ERROR, "truncate %s failed\n", path_name);
+		return -1;
+	}
+	size = synced = 0;
+	log(TAG, LOG_DEBUG, "%s emptied at seq %llu\n", path_name, (unsigned long long)seq);
+	return 0;
+}
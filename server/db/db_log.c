@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "queue.h"
+#include "db_log.h"
+#include "db_sqlite.h"
+
+#define TAG "db_log"
+
+#define DB_LOG_IDLE_MS	20
+#define INSERT_LOG_SQL	"INSERT INTO LOG(NAME, TIME, LEVEL, EVENT) VALUES(?, ?, ?, ?);"
+
+typedef struct{
+	int64_t time;	/* us since the epoch */
+	int level;
+	char name[DB_LOG_NAME_SZ];
+	char event[DB_LOG_EVENT_SZ];
+}DB_LOG_EVENT_T;
+
+static QUEUE_T *queue;
+static sqlite3 *db;
+static sqlite3_stmt *insert;
+static pthread_t thread;
+static atomic_int running;
+static atomic_int pushing;	/* loggers inside db_log_callback() past the running check */
+static atomic_uint_fast64_t dropped;
+static uint64_t stored, failed;	/* sink thread, read once it is joined */
+static int sink_level;
+static __thread int in_sink;	/* messages of the sink thread are not persisted */
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void db_log_callback(void *name, int level, const char *fmt, va_list vl)
+{
+	DB_LOG_EVENT_T ev;
+	va_list vl2;
+	int len;
+
+	va_copy(vl2, vl);
+	log_default_callback(name, level, fmt, vl2);
+	va_end(vl2);
+
+	if (in_sink || LOG_LEVEL_BASE(level) > sink_level || LOG_LEVEL_BASE(level) < 0)
+		return;
+
+	ev.time = now_us();
+	ev.level = LOG_LEVEL_BASE(level);
+	snprintf(ev.name, sizeof(ev.name), "%s", name ? (char *)name : "");
+	len = vsnprintf(ev.event, sizeof(ev.event), fmt, vl);
+	/* one row per message, the trailing newline is noise in the table */
+	if (len > 0 && len < sizeof(ev.event) && ev.event[len - 1] == '\n')
+		ev.event[len - 1] = 0;
+
+	/* db_log_stop() waits for the count to drop before it frees the queue */
+	atomic_fetch_add(&pushing, 1);
+	if (atomic_load(&running) && queue_push(queue, &ev) != 0)
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+	atomic_fetch_sub(&pushing, 1);
+}
+
+static int insert_event(const DB_LOG_EVENT_T *ev)
+{
+	char date[32];
+	struct tm tm;
+	time_t sec = ev->time / 1000000;
+	int len;
+
+	localtime_r(&sec, &tm);
+	len = strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(date + len, sizeof(date) - len, ".%03d", (int)(ev->time % 1000000 / 1000));
+
+	sqlite3_bind_text(insert, 1, ev->name, -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 2, date, -1, SQLITE_STATIC);
+	sqlite3_bind_int(insert, 3, ev->level);
+	sqlite3_bind_text(insert, 4, ev->event, -1, SQLITE_STATIC);
+
+	if (sqlite3_step(insert) != SQLITE_DONE) {
+		sqlite3_reset(insert);
+		return -1;
+	}
+	sqlite3_reset(insert);
+	return 0;
+}
+
+/* insert up to DB_LOG_BATCH events in one transaction */
+static int flush_batch(void)
+{
+	DB_LOG_EVENT_T ev;
+	int n = 0, ok = 0;
+
+	sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+	while (n < DB_LOG_BATCH && queue_pop(queue, &ev) == 0) {
+		if (insert_event(&ev) != 0)
+			log(TAG, LOG_WARNING, "insert log event failed: %s\n", sqlite3_errmsg(db));
+		else
+			ok++;
+		n++;
+	}
+	if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "commit log events failed: %s\n", sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		ok = 0;
+	}
+	stored += ok;
+	failed += n - ok;
+	return n;
+}
+
+static void *db_log_thread(void *arg)
+{
+	struct timespec idle = { 0, DB_LOG_IDLE_MS * 1000000 };
+	int64_t first = 0;	/* when the oldest pending event was seen */
+
+	in_sink = 1;
+	while (atomic_load(&running)) {
+		if (queue_count(queue) == 0) {
+			first = 0;
+		} else {
+			if (first == 0)
+				first = now_us();
+			if (queue_count(queue) >= DB_LOG_BATCH ||
+			    now_us() - first >= DB_LOG_FLUSH_MS * 1000) {
+				flush_batch();
+				first = 0;
+				continue;
+			}
+		}
+		nanosleep(&idle, NULL);
+	}
+
+	while (flush_batch() > 0)
+		;
+	return NULL;
+}
+
+int db_log_start(const char *path, int level)
+{
+	if (atomic_load(&running))
+		return -1;
+	atomic_store(&dropped, 0);
+	stored = failed = 0;
+
+	if (sqlite3_open(path, &db) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "open %s failed: %s\n", path, sqlite3_errmsg(db));
+		goto err;
+	}
+	if (db_sqlite_tune(db, path) != 0 ||
+	    sqlite3_exec(db, CREATE_LOG_DB, NULL, NULL, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, INSERT_LOG_SQL, -1, &insert, NULL) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "prepare %s failed: %s\n", path, sqlite3_errmsg(db));
+		goto err;
+	}
+
+	queue = queue_create(DB_LOG_QUEUE, sizeof(DB_LOG_EVENT_T));
+	if (queue == NULL)
+		goto err;
+
+	sink_level = level;
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, db_log_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		goto err;
+	}
+
+	log_set_callback(db_log_callback);
+	log(TAG, LOG_INFO, "log events persisted to %s\n", path);
+	return 0;
+
+err:
+	queue_destroy(queue);
+	queue = NULL;
+	sqlite3_finalize(insert);
+	insert = NULL;
+	sqlite3_close(db);
+	db = NULL;
+	return -1;
+}
+
+void db_log_stop(void)
+{
+	struct timespec wait = { 0, 1000000 };
+
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	log_set_callback(log_default_callback);
+	while (atomic_load(&pushing))
+		nanosleep(&wait, NULL);
+	pthread_join(thread, NULL);
+	/* events pushed after the last batch of the thread */
+	while (flush_batch() > 0)
+		;
+	log(TAG, LOG_INFO, "persisted %llu log events, dropped %llu, failed %llu\n",
+	    (unsigned long long)stored, (unsigned long long)db_log_dropped(), (unsigned long long)failed);
+
+	queue_destroy(queue);
+	queue = NULL;
+	sqlite3_finalize(insert);
+	insert = NULL;
+	sqlite3_close(db);
+	db = NULL;
+}
+
+uint64_t db_log_dropped(void)
+{
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
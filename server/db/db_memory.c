@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "db_backend.h"
+
+#define TAG "memory"
+
+#define COPY_CHUNK	256	/* samples copied per lock by a query */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static STATUS_FAST_T *ring;
+static unsigned cap;
+static uint64_t total;		/* samples appended, the next one goes to total % cap */
+static uint64_t unsorted;	/* last sample older than the one before it, 0 if none */
+
+/* first sample still in the ring */
+static uint64_t oldest(void)
+{
+	return total > cap ? total - cap : 0;
+}
+
+/* the ring is in time order from lo on */
+static int sorted_from(uint64_t lo)
+{
+	return unsorted <= lo;
+}
+
+/* first sample with time >= from, on a sorted ring */
+static uint64_t lower_bound(uint64_t lo, uint64_t hi, time_t from)
+{
+	uint64_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ring[mid % cap].time < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int memory_open(void)
+{
+	unsigned len = glb->pConfig ? glb->pConfig->memSamples : 0;
+
+	cap = len ? len : DB_MEMORY_SAMPLES;
+	ring = malloc((size_t)cap * sizeof(*ring));
+	if (ring == NULL) {
+		log(TAG, LOG_ERROR, "no memory for %u samples\n", cap);
+		return -1;
+	}
+	total = 0;
+	unsorted = 0;
+	log(TAG, LOG_INFO, "samples kept in memory only, last %u\n", cap);
+	return 0;
+}
+
+static void memory_close(void)
+{
+	pthread_mutex_lock(&lock);
+	free(ring);
+	ring = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+static int memory_append(const STATUS_FAST_T *s, unsigned n)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+	if (ring == NULL) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (total && s[i].time < ring[(total - 1) % cap].time)
+			unsorted = total;
+		ring[total % cap] = s[i];
+		total++;
+	}
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+/*
+ * Copies COPY_CHUNK samples at a time under the lock and calls cb without
+ * it; samples overwritten between two copies are skipped. A sorted ring is
+ * searched for from and the walk stops past to, otherwise all of it is read.
+ */
+static int memory_query(uint64_t dev, time_t from, time_t to, DB_SAMPLE_CB cb, void *arg)
+{
+	STATUS_FAST_T chunk[COPY_CHUNK];
+	uint64_t pos, end;
+	unsigned n, i;
+	int sorted;
+
+	pthread_mutex_lock(&lock);
+	if (ring == NULL) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	/* samples appended after this are not read */
+	end = total;
+	pos = oldest();
+	if (sorted_from(pos))
+		pos = lower_bound(pos, end, from);
+	pthread_mutex_unlock(&lock);
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		if (ring == NULL) {
+			pthread_mutex_unlock(&lock);
+			return -1;
+		}
+		if (pos < oldest())
+			pos = oldest();
+		sorted = sorted_from(oldest());
+		for (n = 0; n < COPY_CHUNK && pos < end; n++, pos++)
+			chunk[n] = ring[pos % cap];
+		pthread_mutex_unlock(&lock);
+
+		for (i = 0; i < n; i++) {
+			if (chunk[i].time > to) {
+				if (sorted)
+					return 0;
+				continue;
+			}
+			if (chunk[i].time < from || (dev != DB_DEV_ALL && chunk[i].dev != dev))
+				continue;
+			if (cb(&chunk[i], arg))
+				return 0;
+		}
+		if (pos >= end)
+			return 0;
+	}
+}
+
+const DB_BACKEND_T db_backend_memory = {
+	.name = "memory",
+	.open = memory_open,
+	.close = memory_close,
+	.append = memory_append,
+	.query = memory_query,
+	.rollup = NULL,		/* raw samples only */
+};
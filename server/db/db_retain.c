@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_retain.h"
+
+#define TAG "retain"
+
+#define DAY		(24 * 3600)
+#define NAP_MS		100
+
+#define STR_(x)		#x
+#define STR(x)		STR_(x)
+#define VACUUM_SQL	"PRAGMA incremental_vacuum(" STR(DB_RETAIN_VACUUM_PAGES) ");"
+
+static pthread_t thread;
+static atomic_int running, stopping;
+static atomic_uint_fast64_t passes, deleted_rows, freed_bytes;
+
+/* sleep ms, or less when stopped */
+static void nap(int64_t ms)
+{
+	struct timespec ts = { 0, NAP_MS * 1000000 };
+
+	while (ms > 0 && !atomic_load(&stopping)) {
+		if (ms < NAP_MS)
+			ts.tv_nsec = ms * 1000000;
+		nanosleep(&ts, NULL);
+		ms -= NAP_MS;
+	}
+}
+
+static int64_t pragma_int(DB_SQLITE_T *db, const char *sql)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, sql);
+	int64_t v = -1;
+
+	if (stmt == NULL)
+		return -1;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		v = sqlite3_column_int64(stmt, 0);
+	sqlite3_reset(stmt);
+	return v;
+}
+
+/* delete the expired rows in batches, returns how many */
+static int64_t expire(DB_SQLITE_T *db, const char *sql, int keepDays)
+{
+	time_t cutoff = time(NULL) - (time_t)keepDays * DAY;
+	sqlite3_stmt *stmt;
+	int64_t rows = 0;
+	int rc, n;
+
+	do {
+		stmt = db_sqlite_stmt(db, sql);
+		if (stmt == NULL)
+			break;
+		sqlite3_bind_int64(stmt, 1, cutoff);
+		sqlite3_bind_int(stmt, 2, DB_RETAIN_BATCH);
+		rc = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE) {
+			/* busy for longer than the timeout, the next pass goes on */
+			log(TAG, LOG_WARNING, "%s: expire failed: %s\n", db->name, sqlite3_errmsg(db->sqlite));
+			break;
+		}
+		n = sqlite3_changes(db->sqlite);
+		rows += n;
+		if (n == DB_RETAIN_BATCH)
+			nap(DB_RETAIN_NAP_MS);
+	} while (n == DB_RETAIN_BATCH && !atomic_load(&stopping));
+
+	return rows;
+}
+
+/* give the free pages back, returns the bytes */
+static int64_t compact(DB_SQLITE_T *db)
+{
+	int64_t page, before, after;
+
+	if (pragma_int(db, "PRAGMA auto_vacuum;") != 2) {
+		if (pragma_int(db, "PRAGMA freelist_count;") > 0)
+			log(TAG, LOG_DEBUG, "%s: free pages kept, VACUUM it once to compact\n", db->name);
+		return 0;
+	}
+
+	page = pragma_int(db, "PRAGMA page_size;");
+	before = pragma_int(db, "PRAGMA page_count;");
+	while (!atomic_load(&stopping) && pragma_int(db, "PRAGMA freelist_count;") > 0) {
+		if (db_sqlite_exec(db, VACUUM_SQL) != 0)
+			break;
+		nap(page * DB_RETAIN_VACUUM_PAGES * 1000 / DB_RETAIN_RATE + 1);
+	}
+	after = pragma_int(db, "PRAGMA page_count;");
+
+	/* the file shrinks once the WAL is checkpointed */
+	db_sqlite_exec(db, "PRAGMA wal_checkpoint(PASSIVE);");
+	return before > after ? (before - after) * page : 0;
+}
+
+int64_t db_retain_run(void)
+{
+	DB_SQLITE_T *conf, db;
+	const char *const *sql;
+	int64_t rows, bytes, total = 0;
+	int i;
+
+	for (i = 0; i < MAX_SQLITE_CNTS && !atomic_load(&stopping); i++) {
+		conf = &glb->db[i];
+		if (conf->sqlite == NULL || conf->expireSql == NULL || conf->keepDays <= 0)
+			continue;
+
+		memset(&db, 0, sizeof(db));
+		snprintf(db.name, sizeof(db.name), "%s", conf->name);
+		if (db_sqlite_open(&db) != 0)
+			continue;
+		rows = 0;
+		for (sql = conf->expireSql; *sql && !atomic_load(&stopping); sql++)
+			rows += expire(&db, *sql, conf->keepDays);
+		bytes = compact(&db);
+		db_sqlite_close(&db);
+
+		if (rows || bytes)
+			log(TAG, LOG_INFO, "%s: %lld rows older than %d days deleted, %lld bytes reclaimed\n",
+			    conf->name, (long long)rows, conf->keepDays, (long long)bytes);
+		atomic_fetch_add(&deleted_rows, rows);
+		atomic_fetch_add(&freed_bytes, bytes);
+		total += bytes;
+	}
+	atomic_fetch_add(&passes, 1);
+	return total;
+}
+
+static void *db_retain_thread(void *arg)
+{
+	nap(DB_RETAIN_DELAY_S * 1000);
+	while (!atomic_load(&stopping)) {
+		db_retain_run();
+		nap(DB_RETAIN_PERIOD_S * 1000);
+	}
+	return NULL;
+}
+
+int db_retain_start(void)
+{
+	if (atomic_load(&running))
+		return -1;
+
+	atomic_store(&stopping, 0);
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, db_retain_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+void db_retain_stop(void)
+{
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	atomic_store(&stopping, 1);
+	pthread_join(thread, NULL);
+	log(TAG, LOG_INFO, "%llu passes, %llu rows deleted, %llu bytes reclaimed\n",
+	    (unsigned long long)atomic_load(&passes),
+	    (unsigned long long)atomic_load(&deleted_rows),
+	    (unsigned long long)atomic_load(&freed_bytes));
+}
+
+void db_retain_stats(DB_RETAIN_STATS_T *st)
+{
+	st->passes = atomic_load(&passes);
+	st->rows = atomic_load(&deleted_rows);
+	st->bytes = atomic_load(&freed_bytes);
+}
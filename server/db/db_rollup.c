@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_block.h"
+#include "db_rollup.h"
+#include "devmap.h"
+
+#define TAG "rollup"
+
+#define ROLLUP_COLUMNS		"DEV, BUCKET, COUNT, FIRST_TIME, LAST_TIME, " \
+				"TEMP_MIN, TEMP_MAX, TEMP_SUM, TEMP_FIRST, TEMP_LAST, " \
+				"HUM_MIN, HUM_MAX, HUM_SUM, HUM_FIRST, HUM_LAST, TEMP_COUNT, HUM_COUNT"
+#define SAVE_ROLLUP_SQL		"INSERT OR REPLACE INTO ROLLUP(STEP, " ROLLUP_COLUMNS ") " \
+				"VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"
+#define LOAD_ROLLUP_SQL		"SELECT " ROLLUP_COLUMNS " FROM ROLLUP WHERE DEV = ? AND STEP = ? AND BUCKET = ?;"
+/* ?1 step, ?2 first bucket, ?3 last, ?4 device */
+#define QUERY_ROLLUP_SQL	"SELECT " ROLLUP_COLUMNS " FROM ROLLUP " \
+				"WHERE STEP = ?1 AND BUCKET >= ?2 AND BUCKET <= ?3 ORDER BY BUCKET;"
+#define QUERY_DEV_ROLLUP_SQL	"SELECT " ROLLUP_COLUMNS " FROM ROLLUP " \
+				"WHERE DEV = ?4 AND STEP = ?1 AND BUCKET >= ?2 AND BUCKET <= ?3 ORDER BY BUCKET;"
+#define PRUNE_ROLLUP_SQL	"DELETE FROM ROLLUP WHERE STEP = ? AND BUCKET < ?;"
+#define ANY_ROLLUP_SQL		"SELECT 1 FROM ROLLUP LIMIT 1;"
+
+#define DAY	(24 * 3600)
+
+const DB_ROLLUP_TIER_T db_rollup_tiers[DB_ROLLUP_TIERS] = {
+	{ 60,	7 * DAY },
+	{ 3600,	180 * DAY },
+	{ DAY,	0 },
+};
+
+/* the tier driving the retention, pruned once per bucket of it */
+#define PRUNE_TIER	1
+
+static int64_t bucket_of(int64_t t, int step)
+{
+	return (t >= 0 ? t / step : (t - step + 1) / step) * step;
+}
+
+/* no reading yet */
+static void agg_init(DB_AGG_T *a)
+{
+	memset(a, 0, sizeof(*a));
+	a->min = a->max = a->first = a->last = __builtin_nanf("");
+}
+
+/* first/last follow the sample time, samples may come late */
+static void agg_add(DB_AGG_T *a, float v, int64_t t)
+{
+	if (v != v)
+		return;
+	if (a->count++ == 0) {
+		a->min = a->max = a->first = a->last = v;
+		a->sum = v;
+		a->firstTime = a->lastTime = t;
+		return;
+	}
+	if (v < a->min)
+		a->min = v;
+	if (v > a->max)
+		a->max = v;
+	if (t < a->firstTime) {
+		a->first = v;
+		a->firstTime = t;
+	}
+	if (t >= a->lastTime) {
+		a->last = v;
+		a->lastTime = t;
+	}
+	a->sum += v;
+}
+
+static void rollup_add(DB_ROLLUP_T *r, const STATUS_FAST_T *s)
+{
+	if (r->count == 0) {
+		r->firstTime = r->lastTime = s->time;
+		agg_init(&r->temp);
+		agg_init(&r->hum);
+	}
+	if (s->time < r->firstTime)
+		r->firstTime = s->time;
+	if (s->time >= r->lastTime)
+		r->lastTime = s->time;
+	agg_add(&r->temp, s->fTemp, s->time);
+	agg_add(&r->hum, s->fHum, s->time);
+	r->count++;
+}
+
+/* a bucket written before the per field counts had every field in every sample */
+static void column_agg(sqlite3_stmt *stmt, int col, int countCol, const DB_ROLLUP_T *r, DB_AGG_T *a)
+{
+	a->count = sqlite3_column_type(stmt, countCol) == SQLITE_NULL ? r->count :
+		   (uint32_t)sqlite3_column_int64(stmt, countCol);
+	a->firstTime = r->firstTime;
+	a->lastTime = r->lastTime;
+	a->min = db_sqlite_column_real(stmt, col);
+	a->max = db_sqlite_column_real(stmt, col + 1);
+	a->sum = db_sqlite_column_real(stmt, col + 2);
+	a->first = db_sqlite_column_real(stmt, col + 3);
+	a->last = db_sqlite_column_real(stmt, col + 4);
+}
+
+/* a row of ROLLUP_COLUMNS */
+static void column_rollup(sqlite3_stmt *stmt, int step, DB_ROLLUP_T *r)
+{
+	r->step = step;
+	r->dev = sqlite3_column_int64(stmt, 0);
+	r->start = sqlite3_column_int64(stmt, 1);
+	r->count = sqlite3_column_int(stmt, 2);
+	r->firstTime = sqlite3_column_int64(stmt, 3);
+	r->lastTime = sqlite3_column_int64(stmt, 4);
+	column_agg(stmt, 5, 15, r, &r->temp);
+	column_agg(stmt, 10, 16, r, &r->hum);
+}
+
+static void bind_agg(sqlite3_stmt *stmt, int col, const DB_AGG_T *a)
+{
+	db_sqlite_bind_real(stmt, col, a->min);
+	db_sqlite_bind_real(stmt, col + 1, a->max);
+	db_sqlite_bind_real(stmt, col + 2, a->sum);
+	db_sqlite_bind_real(stmt, col + 3, a->first);
+	db_sqlite_bind_real(stmt, col + 4, a->last);
+}
+
+static int save_bucket(DB_SQLITE_T *db, const DB_ROLLUP_T *r)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, SAVE_ROLLUP_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+
+	sqlite3_bind_int(stmt, 1, r->step);
+	sqlite3_bind_int64(stmt, 2, (sqlite3_int64)r->dev);
+	sqlite3_bind_int64(stmt, 3, r->start);
+	sqlite3_bind_int(stmt, 4, r->count);
+	sqlite3_bind_int64(stmt, 5, r->firstTime);
+	sqlite3_bind_int64(stmt, 6, r->lastTime);
+	bind_agg(stmt, 7, &r->temp);
+	bind_agg(stmt, 12, &r->hum);
+	sqlite3_bind_int64(stmt, 17, r->temp.count);
+	sqlite3_bind_int64(stmt, 18, r->hum.count);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? 0 : -1;
+}
+
+/* the stored bucket, or an empty one */
+static int load_bucket(DB_SQLITE_T *db, uint64_t dev, int step, int64_t start, DB_ROLLUP_T *r)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, LOAD_ROLLUP_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+
+	memset(r, 0, sizeof(*r));
+	r->dev = dev;
+	r->step = step;
+	r->start = start;
+
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)dev);
+	sqlite3_bind_int(stmt, 2, step);
+	sqlite3_bind_int64(stmt, 3, start);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		column_rollup(stmt, step, r);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_ROW || rc == SQLITE_DONE ? 0 : -1;
+}
+
+static int prune(DB_SQLITE_T *db, int64_t now)
+{
+	sqlite3_stmt *stmt;
+	int i, rc;
+
+	for (i = 0; i < DB_ROLLUP_TIERS; i++) {
+		if (db_rollup_tiers[i].keep == 0)
+			continue;
+		stmt = db_sqlite_stmt(db, PRUNE_ROLLUP_SQL);
+		if (stmt == NULL)
+			return -1;
+		sqlite3_bind_int(stmt, 1, db_rollup_tiers[i].step);
+		sqlite3_bind_int64(stmt, 2, bucket_of(now - db_rollup_tiers[i].keep,
+						      db_rollup_tiers[i].step));
+		rc = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE)
+			return -1;
+	}
+	return 0;
+}
+
+int db_rollup_add(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db, const STATUS_FAST_T *s)
+{
+	DB_ROLLUP_OPEN_T *o = devmap_get(w->devs, s->dev, 1);
+	DB_ROLLUP_T *r;
+	int64_t start;
+	int i, step;
+
+	if (o == NULL)
+		goto err;
+	for (i = 0; i < DB_ROLLUP_TIERS; i++) {
+		r = &o->open[i];
+		step = db_rollup_tiers[i].step;
+		start = bucket_of(s->time, step);
+
+		if (r->step == 0 || r->start != start) {
+			if (o->dirty[i] && save_bucket(db, r) != 0)
+				goto err;
+			o->dirty[i] = 0;
+			if (load_bucket(db, s->dev, step, start, r) != 0)
+				goto err;
+		}
+		rollup_add(r, s);
+		o->dirty[i] = 1;
+	}
+
+	start = bucket_of(s->time, db_rollup_tiers[PRUNE_TIER].step);
+	if (start > w->pruned) {
+		if (prune(db, s->time) != 0)
+			goto err;
+		w->pruned = start;
+	}
+	return 0;
+
+err:
+	log(TAG, LOG_ERROR, "rollup failed: %s\n", sqlite3_errmsg(db->sqlite));
+	return -1;
+}
+
+static int flush_dev(uint64_t dev, void *rec, void *arg)
+{
+	DB_ROLLUP_OPEN_T *o = rec;
+	DB_SQLITE_T *db = arg;
+	int i;
+
+	for (i = 0; i < DB_ROLLUP_TIERS; i++) {
+		if (!o->dirty[i])
+			continue;
+		if (save_bucket(db, &o->open[i]) != 0) {
+			log(TAG, LOG_ERROR, "save rollup failed: %s\n", sqlite3_errmsg(db->sqlite));
+			return -1;
+		}
+		o->dirty[i] = 0;
+	}
+	return 0;
+}
+
+int db_rollup_flush(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db)
+{
+	return devmap_each(w->devs, flush_dev, db);
+}
+
+void db_rollup_release(DB_ROLLUP_WRITER_T *w)
+{
+	devmap_destroy(w->devs);
+	w->devs = NULL;
+}
+
+typedef struct{
+	DB_ROLLUP_WRITER_T *w;
+	DB_SQLITE_T *db;
+	uint64_t count;
+	int err;
+}BACKFILL_T;
+
+static int backfill_sample(const STATUS_FAST_T *s, void *arg)
+{
+	BACKFILL_T *b = arg;
+
+	if (db_rollup_add(b->w, b->db, s) != 0) {
+		b->err = 1;
+		return 1;
+	}
+	b->count++;
+	return 0;
+}
+
+int db_rollup_load(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db)
+{
+	BACKFILL_T b = { w, db, 0, 0 };
+	sqlite3_stmt *stmt;
+	int rc;
+
+	db_rollup_release(w);
+	w->devs = devmap_create(sizeof(DB_ROLLUP_OPEN_T));
+	w->pruned = INT64_MIN;
+	if (w->devs == NULL)
+		return -1;
+
+	stmt = db_sqlite_stmt(db, ANY_ROLLUP_SQL);
+	if (stmt == NULL)
+		return -1;
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc == SQLITE_ROW)
+		return 0;
+
+	/* samples stored before the rollups existed */
+	if (db_block_query(db, DB_DEV_ALL, 0, DB_TIME_MAX, backfill_sample, &b) != 0 || b.err ||
+	    db_sqlite_exec(db, "BEGIN;") != 0)
+		goto err;
+	if (db_rollup_flush(w, db) != 0 || db_sqlite_exec(db, "COMMIT;") != 0) {
+		db_sqlite_exec(db, "ROLLBACK;");
+		goto err;
+	}
+	if (b.count)
+		log(TAG, LOG_INFO, "rollups built from %llu samples\n", (unsigned long long)b.count);
+	return 0;
+
+err:
+	devmap_clear(w->devs);
+	return -1;
+}
+
+typedef struct{
+	DB_ROLLUP_CB cb;
+	void *arg;
+}RAW_QUERY_T;
+
+static int raw_sample(const STATUS_FAST_T *s, void *arg)
+{
+	RAW_QUERY_T *q = arg;
+	DB_ROLLUP_T r;
+
+	memset(&r, 0, sizeof(r));
+	r.dev = s->dev;
+	r.start = s->time;
+	rollup_add(&r, s);
+	return q->cb(&r, q->arg);
+}
+
+int db_rollup_query(DB_SQLITE_T *db, uint64_t dev, time_t from, time_t to, int resolution,
+		DB_ROLLUP_CB cb, void *arg)
+{
+	RAW_QUERY_T raw = { cb, arg };
+	time_t now = time(NULL);
+	sqlite3_stmt *stmt;
+	DB_ROLLUP_T r;
+	int i, tier = -1, step, rc, stop = 0;
+
+	for (i = 0; i < DB_ROLLUP_TIERS; i++) {
+		if (db_rollup_tiers[i].step <= resolution)
+			tier = i;
+	}
+	/* pruned past from: a coarser tier still has it */
+	while (tier >= 0 && tier < DB_ROLLUP_TIERS - 1 && db_rollup_tiers[tier].keep &&
+	       from < now - db_rollup_tiers[tier].keep)
+		tier++;
+	if (tier < 0)
+		return db_block_query(db, dev, from, to, raw_sample, &raw);
+
+	step = db_rollup_tiers[tier].step;
+	stmt = db_sqlite_stmt(db, dev == DB_DEV_ALL ? QUERY_ROLLUP_SQL : QUERY_DEV_ROLLUP_SQL);
+	if (stmt == NULL)
+		return -1;
+
+	sqlite3_bind_int(stmt, 1, step);
+	sqlite3_bind_int64(stmt, 2, bucket_of(from, step));
+	sqlite3_bind_int64(stmt, 3, to);
+	if (dev != DB_DEV_ALL)
+		sqlite3_bind_int64(stmt, 4, (sqlite3_int64)dev);
+	while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		column_rollup(stmt, step, &r);
+		stop = cb(&r, arg);
+	}
+	sqlite3_reset(stmt);
+	return stop || rc == SQLITE_DONE ? 0 : -1;
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "db_sqlite.h"
+#include "db_backend.h"
+
+#define TAG "db"
+
+static int migrate_data(DB_SQLITE_T *db);
+static int migrate_archive(DB_SQLITE_T *db);
+
+static const char *const expire_log[] = { EXPIRE_LOG_SQL, NULL };
+/* the tiers of shorter retention are also pruned by the storage thread, see db_rollup.h */
+static const char *const expire_data[] = { EXPIRE_BLOCK_SQL, EXPIRE_DATA_SQL, EXPIRE_ROLLUP_SQL, NULL };
+static const char *const expire_archive[] = { EXPIRE_BLOCK_SQL, NULL };
+
+/* used when parse_config() leaves a database unnamed */
+static const struct{
+	const char *name;
+	const char *createSql;
+	int keepDays;
+	const char *const *expireSql;
+	int (*migrate)(DB_SQLITE_T *db);
+}db_defaults[] = {
+	[eSQLITE_MAIN] = { DB_NAME_MAIN, "", -1, NULL, NULL },
+	[eSQLITE_LOG]  = { DB_NAME_LOG,  CREATE_LOG_DB, 30, expire_log, NULL },
+	[eSQLITE_DATA] = { DB_NAME_DATA, CREATE_DATA_DB, 365, expire_data, migrate_data },
+	[eSQLITE_ARCHIVE] = { "", CREATE_ARCHIVE_DB, -1, expire_archive, migrate_archive },
+};
+
+#define DB_DEFAULTS	(sizeof(db_defaults) / sizeof(db_defaults[0]))
+
+int db_sqlite_tune(sqlite3 *sqlite, const char *name)
+{
+	sqlite3_stmt *stmt;
+	int wal = 0;
+
+	sqlite3_busy_timeout(sqlite, DB_SQLITE_BUSY_MS);
+
+	/* only takes effect on a new database, and before it is switched to WAL */
+	sqlite3_exec(sqlite, "PRAGMA auto_vacuum=INCREMENTAL;", NULL, NULL, NULL);
+
+	/* journal_mode returns the mode in effect, it stays "memory" for :memory: */
+	if (sqlite3_prepare_v2(sqlite, "PRAGMA journal_mode=WAL;", -1, &stmt, NULL) == SQLITE_OK) {
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			wal = !sqlite3_stricmp((const char *)sqlite3_column_text(stmt, 0), "wal");
+		sqlite3_finalize(stmt);
+	}
+	if (!wal)
+		log(TAG, LOG_WARNING, "%s: WAL not available, using the default journal\n", name);
+
+	if (sqlite3_exec(sqlite, DB_SQLITE_PRAGMAS, NULL, NULL, NULL) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "%s: pragmas failed: %s\n", name, sqlite3_errmsg(sqlite));
+		return -1;
+	}
+	return 0;
+}
+
+int db_sqlite_column(sqlite3 *sqlite, const char *table, const char *column, int *notNull)
+{
+	sqlite3_stmt *stmt;
+	char sql[96];
+	int found = 0;
+
+	snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+	if (sqlite3_prepare_v2(sqlite, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+	while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+		if (sqlite3_stricmp((const char *)sqlite3_column_text(stmt, 1), column))
+			continue;
+		found = 1;
+		if (notNull)
+			*notNull = sqlite3_column_int(stmt, 3);
+	}
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+/* column to an existing table that does not have it yet */
+static int add_column(DB_SQLITE_T *db, const char *table, const char *column, const char *type)
+{
+	char sql[128], *err = NULL;
+
+	if (db_sqlite_column(db->sqlite, table, column, NULL) != 0)
+		return 0;
+	snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, type);
+	if (sqlite3_exec(db->sqlite, sql, NULL, NULL, &err) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "%s: add %s.%s failed: %s\n", db->name, table, column, err);
+		sqlite3_free(err);
+		return -1;
+	}
+	log(TAG, LOG_INFO, "%s: %s.%s added\n", db->name, table, column);
+	return 0;
+}
+
+/*
+ * DATA of before the missing readings had NOT NULL on TEMP and HUM: it is
+ * copied to a table without, ROWIDs included (the open blocks refer to
+ * them), in one transaction; createSql puts the indexes back.
+ */
+#define REBUILD_DATA_SQL	"BEGIN IMMEDIATE;" \
+				"CREATE TABLE DATA_NEW(" DATA_COLUMNS ");" \
+				"INSERT INTO DATA_NEW(ROWID, DEV, TIME, TEMP, HUM) " \
+				"SELECT ROWID, DEV, TIME, TEMP, HUM FROM DATA;" \
+				"DROP TABLE DATA;" \
+				"ALTER TABLE DATA_NEW RENAME TO DATA;" \
+				"COMMIT;"
+
+static int rebuild_data(DB_SQLITE_T *db)
+{
+	int tempNotNull = 0, humNotNull = 0;
+	char *err = NULL;
+
+	if (db_sqlite_column(db->sqlite, "DATA", "TEMP", &tempNotNull) < 0 ||
+	    db_sqlite_column(db->sqlite, "DATA", "HUM", &humNotNull) < 0)
+		return -1;
+	if (!tempNotNull && !humNotNull)
+		return 0;
+
+	/* refuse to start rather than lose the samples without a reading */
+	if (sqlite3_exec(db->sqlite, REBUILD_DATA_SQL, NULL, NULL, &err) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "%s: DATA still has NOT NULL readings, rebuild failed: %s\n",
+		    db->name, err);
+		sqlite3_free(err);
+		sqlite3_exec(db->sqlite, "ROLLBACK;", NULL, NULL, NULL);
+		return -1;
+	}
+	log(TAG, LOG_INFO, "%s: DATA rebuilt for missing readings\n", db->name);
+	return 0;
+}
+
+/* missing readings in DATA, per field counts of the rollups */
+static int migrate_data(DB_SQLITE_T *db)
+{
+	if (rebuild_data(db) != 0)
+		return -1;
+	if (db_sqlite_column(db->sqlite, "ROLLUP", "DEV", NULL) != 1)
+		return 0;
+	if (add_column(db, "ROLLUP", "TEMP_COUNT", "INTEGER") != 0 ||
+	    add_column(db, "ROLLUP", "HUM_COUNT", "INTEGER") != 0)
+		return -1;
+	return 0;
+}
+
+/* archives of before HOT_ID */
+static int migrate_archive(DB_SQLITE_T *db)
+{
+	if (db_sqlite_column(db->sqlite, "BLOCK", "ID", NULL) != 1)
+		return 0;
+	return add_column(db, "BLOCK", "HOT_ID", "INTEGER");
+}
+
+int db_sqlite_open(DB_SQLITE_T *db)
+{
+	char *err = NULL;
+
+	memset(db->stmts, 0, sizeof(db->stmts));
+	db->stmtTick = 0;
+
+	if (sqlite3_open(db->name, &db->sqlite) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "open %s failed: %s\n", db->name, sqlite3_errmsg(db->sqlite));
+		goto err;
+	}
+	if (db_sqlite_tune(db->sqlite, db->name) != 0)
+		goto err;
+
+	if (db->createSql[0] && db->migrate && db->migrate(db) != 0)
+		goto err;
+	if (db->createSql[0] && sqlite3_exec(db->sqlite, db->createSql, NULL, NULL, &err) != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "create %s failed: %s\n", db->name, err);
+		sqlite3_free(err);
+		goto err;
+	}
+
+	log(TAG, LOG_DEBUG, "%s opened\n", db->name);
+	return 0;
+
+err:
+	sqlite3_close(db->sqlite);
+	db->sqlite = NULL;
+	return -1;
+}
+
+void db_sqlite_close(DB_SQLITE_T *db)
+{
+	int i;
+
+	if (db->sqlite == NULL)
+		return;
+
+	for (i = 0; i < DB_STMT_CACHE; i++) {
+		sqlite3_finalize(db->stmts[i].stmt);
+		db->stmts[i].stmt = NULL;
+		db->stmts[i].sql = NULL;
+	}
+	/* the last connection checkpoints and removes the -wal file */
+	if (sqlite3_close(db->sqlite) != SQLITE_OK)
+		log(TAG, LOG_WARNING, "close %s: %s\n", db->name, sqlite3_errmsg(db->sqlite));
+	db->sqlite = NULL;
+}
+
+static sqlite3_stmt *prepare(DB_SQLITE_T *db, const char *sql)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+#if SQLITE_VERSION_NUMBER >= 3020000
+	/* the statement lives as long as the connection */
+	rc = sqlite3_prepare_v3(db->sqlite, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+#else
+	rc = sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL);
+#endif
+	if (rc != SQLITE_OK) {
+		log(TAG, LOG_ERROR, "%s: prepare \"%s\" failed: %s\n",
+		    db->name, sql, sqlite3_errmsg(db->sqlite));
+		return NULL;
+	}
+	return stmt;
+}
+
+sqlite3_stmt *db_sqlite_stmt(DB_SQLITE_T *db, const char *sql)
+{
+	DB_STMT_T *e, *victim = NULL;
+	int i;
+
+	if (db->sqlite == NULL)
+		return NULL;
+
+	/* same pointer first, then same text */
+	for (i = 0; i < DB_STMT_CACHE; i++) {
+		if (db->stmts[i].sql == sql)
+			goto hit;
+	}
+	for (i = 0; i < DB_STMT_CACHE; i++) {
+		if (db->stmts[i].sql && !strcmp(db->stmts[i].sql, sql))
+			goto hit;
+	}
+
+	/* miss: take a free slot or the least recently used one */
+	for (i = 0; i < DB_STMT_CACHE; i++) {
+		e = &db->stmts[i];
+		if (e->stmt == NULL) {
+			victim = e;
+			break;
+		}
+		if (victim == NULL || e->lastUse < victim->lastUse)
+			victim = e;
+	}
+
+	e = victim;
+	sqlite3_finalize(e->stmt);
+	e->stmt = prepare(db, sql);
+	e->sql = e->stmt ? sql : NULL;
+	e->lastUse = ++db->stmtTick;
+	return e->stmt;
+
+hit:
+	e = &db->stmts[i];
+	sqlite3_reset(e->stmt);
+	sqlite3_clear_bindings(e->stmt);
+	e->lastUse = ++db->stmtTick;
+	return e->stmt;
+}
+
+int db_sqlite_exec(DB_SQLITE_T *db, const char *sql)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, sql);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		;
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE) {
+		log(TAG, LOG_ERROR, "%s: \"%s\" failed: %s\n", db->name, sql, sqlite3_errmsg(db->sqlite));
+		return -1;
+	}
+	return 0;
+}
+
+int init_db(void)
+{
+	const DB_BACKEND_T *backend;
+	const char *name;
+	DB_SQLITE_T *db;
+	int i;
+
+	name = glb->pConfig && glb->pConfig->dbBackend[0] ? glb->pConfig->dbBackend : DB_BACKEND_DEFAULT;
+	backend = db_backend_find(name);
+	if (backend == NULL) {
+		log(TAG, LOG_ERROR, "no storage engine %s\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < MAX_SQLITE_CNTS; i++) {
+		db = &glb->db[i];
+		if (i < DB_DEFAULTS) {
+			if (db->name[0] == 0)
+				snprintf(db->name, sizeof(db->name), "%s", db_defaults[i].name);
+			if (db->createSql[0] == 0)
+				snprintf(db->createSql, sizeof(db->createSql), "%s", db_defaults[i].createSql);
+			if (db->keepDays == 0)
+				db->keepDays = db_defaults[i].keepDays;
+			if (db->expireSql == NULL)
+				db->expireSql = db_defaults[i].expireSql;
+			if (db->migrate == NULL)
+				db->migrate = db_defaults[i].migrate;
+		}
+		/* the sample databases are opened by their engine */
+		if (db->name[0] == 0 || i == eSQLITE_DATA || i == eSQLITE_ARCHIVE)
+			continue;
+
+		if (db_sqlite_open(db) != 0) {
+			deinit_db();
+			return -1;
+		}
+	}
+
+	if (backend->open() != 0) {
+		deinit_db();
+		return -1;
+	}
+	glb->pBackend = backend;
+
+	log(TAG, LOG_INFO, "sqlite %s, databases opened, samples to %s\n", sqlite3_libversion(), backend->name);
+	return 0;
+}
+
+int deinit_db(void)
+{
+	int i;
+
+	if (glb == NULL)
+		return 0;
+
+	if (glb->pBackend)
+		glb->pBackend->close();
+	glb->pBackend = NULL;
+	for (i = 0; i < MAX_SQLITE_CNTS; i++)
+		db_sqlite_close(&glb->db[i]);
+	return 0;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "queue.h"
+#include "db_sqlite.h"
+#include "db_store.h"
+#include "db_block.h"
+#include "db_rollup.h"
+#include "db_journal.h"
+#include "db_backend.h"
+
+#define TAG "store"
+
+#define DB_STORE_IDLE_MS	20
+#define INSERT_DATA_SQL		"INSERT INTO DATA(DEV, TIME, TEMP, HUM) VALUES(?, ?, ?, ?);"
+
+static QUEUE_T *queue;
+static const DB_BACKEND_T *backend;
+static DB_SQLITE_T *db;			/* the writers below belong to it */
+static DB_BLOCK_WRITER_T writer;	/* the open compressed block of each device */
+static DB_ROLLUP_WRITER_T rollup;	/* the open bucket of each tier and device */
+static STATUS_FAST_T pending[DB_STORE_BATCH];	/* journaled, not applied yet */
+static unsigned npending;
+static pthread_t thread;
+static atomic_int running;
+static atomic_uint_fast64_t queued, dropped;
+/* written by the storage thread only */
+static atomic_uint_fast64_t stored, failed, batches;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int insert_sample(const STATUS_FAST_T *s)
+{
+	sqlite3_stmt *stmt = db_sqlite_stmt(db, INSERT_DATA_SQL);
+	int rc;
+
+	if (stmt == NULL)
+		return -1;
+
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)s->dev);
+	sqlite3_bind_int64(stmt, 2, s->time);
+	db_sqlite_bind_real(stmt, 3, s->fTemp);
+	db_sqlite_bind_real(stmt, 4, s->fHum);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE ||
+	    db_block_add(&writer, db, s, sqlite3_last_insert_rowid(db->sqlite)) != 0)
+		return -1;
+	return db_rollup_add(&rollup, db, s);
+}
+
+static int load_writers(DB_SQLITE_T *data)
+{
+	db = NULL;
+	if (db_block_load(&writer, data) != 0) {
+		log(TAG, LOG_ERROR, "load the open block of %s failed\n", data->name);
+		return -1;
+	}
+	if (db_rollup_load(&rollup, data) != 0) {
+		log(TAG, LOG_ERROR, "load the rollups of %s failed\n", data->name);
+		return -1;
+	}
+	db = data;
+	return 0;
+}
+
+int db_store_apply(DB_SQLITE_T *data, const STATUS_FAST_T *s, unsigned n, uint64_t seq)
+{
+	unsigned i, bad = 0;
+
+	if (db != data && load_writers(data) != 0)
+		return -1;
+	if (db_sqlite_exec(db, "BEGIN;") != 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (insert_sample(&s[i]) != 0) {
+			log(TAG, LOG_WARNING, "insert sample failed: %s\n", sqlite3_errmsg(db->sqlite));
+			bad++;
+		}
+	}
+
+	if ((seq && db_journal_applied(db, seq) != 0) ||
+	    db_rollup_flush(&rollup, db) != 0 || db_sqlite_exec(db, "COMMIT;") != 0) {
+		db_sqlite_exec(db, "ROLLBACK;");
+		log(TAG, LOG_ERROR, "%u samples not stored\n", n);
+		/* the open block and buckets may hold samples that were rolled back */
+		load_writers(data);
+		return -1;
+	}
+	if (bad)
+		load_writers(data);
+	return n - bad;
+}
+
+/* move queued samples to the journal and the pending batch */
+static void take_queued(void)
+{
+	STATUS_FAST_T s;
+
+	while (npending < DB_STORE_BATCH && queue_pop(queue, &s) == 0) {
+		db_journal_append(&s);
+		pending[npending++] = s;
+	}
+}
+
+/*
+ * a failed batch stays pending and is retried whole: the applied sequence
+ * the engine records must never pass a journaled sample it did not store,
+ * or a checkpoint would empty the journal without it
+ */
+static int flush_pending(void)
+{
+	int n = npending, ok;
+
+	if (n == 0)
+		return 0;
+	ok = backend->append(pending, n);
+	if (ok < 0)
+		return -1;
+	atomic_fetch_add(&stored, ok);
+	atomic_fetch_add(&failed, n - ok);
+	atomic_fetch_add(&batches, 1);
+	npending = 0;
+	return n;
+}
+
+static void *db_store_thread(void *arg)
+{
+	struct timespec idle = { 0, DB_STORE_IDLE_MS * 1000000 };
+	int64_t first = 0;	/* when the oldest pending sample was seen */
+	int64_t retry = 0;	/* no batch before, after a failed one */
+	int backoff = 0;
+	STATUS_FAST_T s;
+	unsigned left;
+	int n;
+
+	while (atomic_load(&running)) {
+		take_queued();
+		db_journal_sync(0);
+
+		if (npending == 0) {
+			first = 0;
+		} else {
+			if (first == 0)
+				first = now_ms();
+			if ((npending == DB_STORE_BATCH || now_ms() - first >= DB_STORE_FLUSH_MS) &&
+			    now_ms() >= retry) {
+				if (flush_pending() < 0) {
+					backoff = backoff ? backoff * 2 : DB_STORE_RETRY_MS;
+					if (backoff > DB_STORE_RETRY_MAX_MS)
+						backoff = DB_STORE_RETRY_MAX_MS;
+					retry = now_ms() + backoff;
+					log(TAG, LOG_WARNING, "batch of %u samples kept, retry in %d ms\n",
+					    npending, backoff);
+				} else {
+					backoff = 0;
+					first = 0;
+					continue;
+				}
+			}
+		}
+		nanosleep(&idle, NULL);
+	}
+
+	do {
+		take_queued();
+	} while ((n = flush_pending()) > 0);
+	if (n < 0) {
+		/* journaled, init_db() replays them on the next start */
+		left = npending;
+		while (queue_pop(queue, &s) == 0) {
+			db_journal_append(&s);
+			left++;
+		}
+		npending = 0;
+		log(TAG, LOG_ERROR, "%u samples not stored, left in the journal\n", left);
+	}
+	db_journal_sync(1);
+	return NULL;
+}
+
+int db_store_start(void)
+{
+	backend = glb->pBackend;
+	if (atomic_load(&running) || backend == NULL)
+		return -1;
+
+	queue = queue_create(DB_STORE_QUEUE, sizeof(STATUS_FAST_T));
+	if (queue == NULL)
+		return -1;
+
+	npending = 0;
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, db_store_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		queue_destroy(queue);
+		queue = NULL;
+		return -1;
+	}
+
+	log(TAG, LOG_INFO, "samples stored to %s\n", backend->name);
+	return 0;
+}
+
+void db_store_stop(void)
+{
+	DB_STORE_STATS_T st;
+
+	if (!atomic_exchange(&running, 0))
+		return;
+
+	pthread_join(thread, NULL);
+	queue_destroy(queue);
+	queue = NULL;
+
+	db_store_stats(&st);
+	log(TAG, LOG_INFO, "stored %llu samples in %llu batches, dropped %llu, failed %llu\n",
+	    (unsigned long long)st.stored, (unsigned long long)st.batches,
+	    (unsigned long long)st.dropped, (unsigned long long)st.failed);
+	db_block_release(&writer);
+	db_rollup_release(&rollup);
+	db = NULL;
+}
+
+int db_store_push(const STATUS_FAST_T *sample)
+{
+	if (!atomic_load_explicit(&running, memory_order_relaxed) || queue_push(queue, sample) != 0) {
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+	atomic_fetch_add_explicit(&queued, 1, memory_order_relaxed);
+	return 0;
+}
+
+void db_store_stats(DB_STORE_STATS_T *st)
+{
+	st->queued = atomic_load(&queued);
+	st->dropped = atomic_load(&dropped);
+	st->stored = atomic_load(&stored);
+	st->failed = atomic_load(&failed);
+	st->batches = atomic_load(&batches);
+}
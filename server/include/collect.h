@@ -0,0 +1,64 @@
+#ifndef __COLLECT_H__
+#define __COLLECT_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Collect scheduler: one thread reads every sensor at its own period.
+ *
+ * Deadlines are absolute CLOCK_MONOTONIC times, deadline n of a sensor
+ * being start + phase + n * period, so a late read never shifts the ones
+ * after it. The thread sleeps in epoll on a single timerfd armed for the
+ * earliest deadline. Sensors on the same bus that leave the phase to
+ * COLLECT_PHASE_AUTO are spread evenly over their period instead of being
+ * read back to back.
+ *
+ * Per sensor the lateness of each read (jitter) is tracked, and a deadline
+ * that passes while the previous read is still due is counted as missed
+ * and skipped, not caught up in a burst.
+ *
+ * Sensors are added before collect_start(); the read callbacks run in the
+ * scheduler thread and should not block. collect_start() adds one more,
+ * "filters", the sweep of the samples the filters hold back (filter.h).
+ */
+
+#define COLLECT_MAX_SENSORS	32
+#define COLLECT_PHASE_AUTO	(-1)
+#define COLLECT_BUS_NONE	(-1)
+
+/* read sensor id now, the return value is not used */
+typedef int (*COLLECT_READ_CB)(int id, void *arg);
+
+typedef struct{
+	uint64_t reads;
+	uint64_t missed;	/* deadlines skipped */
+	int64_t jitterLastUs;
+	int64_t jitterMaxUs;
+	int64_t jitterMeanUs;
+}COLLECT_STATS_T;
+
+/* returns the sensor id, or -1 if full, started or periodMs is 0 */
+int collect_add(const char *name, unsigned periodMs, int phaseMs, int bus,
+		COLLECT_READ_CB read, void *arg);
+
+int collect_start(void);
+/* also forgets the sensors, and stores the samples the filters hold back */
+void collect_stop(void);
+
+/*
+ * a new sample of device dev, from a read callback (or a device callback of
+ * the reactor): it becomes glb->tStatus and the device's state in the
+ * registry, goes to the history and, if the device's filter (filter.h)
+ * finds it worth it, is queued for storage.
+ * Returns the samples queued (0 to 2); those the full storage queue refused
+ * go to *refused, if not NULL.
+ */
+int collect_ingest(uint64_t dev, const STATUS_FAST_T *sample, unsigned *refused);
+
+int collect_stats(int id, COLLECT_STATS_T *stats);
+/* all sensors to the log */
+void collect_dump(void);
+
+#endif
@@ -6,6 +6,8 @@
 #include <string.h>
 #include <sqlite3.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "log.h"
 
 
@@ -19,14 +21,86 @@
  *
  * *********************************/
 #define MAX_SQLITE_CNTS 8
+#define CACHE_LINE_SIZE	64
 
 
-#define CREATE_LOG_DB	"CREATE TABLE COMPANY("  \
-         		"ID INT PRIMARY KEY     NOT NULL," \
+#define DB_NAME_MAIN	"sh_main.db"
+#define DB_NAME_LOG	"sh_log.db"
+#define DB_NAME_DATA	"sh_data.db"
+/* eSQLITE_ARCHIVE has no default, it is on the disk given by -a */
+
+#define DB_STMT_CACHE	16	/* prepared statements kept per database */
+#define MAX_DEVICES	16	/* sensors on a tty/hidraw/RFCOMM node, see device.h */
+
+#define CREATE_LOG_DB	"CREATE TABLE IF NOT EXISTS LOG("  \
+         		"ID INTEGER PRIMARY KEY," \
          		"NAME           TEXT    NOT NULL," \
          		"TIME           CHAR    NOT NULL," \
+			"LEVEL		INT	NOT NULL," \
 			"EVENT		CHAR	NOT NULL);"
-#define CREATE_DATA_DB  "NULL"
+#define CREATE_BLOCK_TABLE "CREATE TABLE IF NOT EXISTS BLOCK(" \
+			"ID INTEGER PRIMARY KEY," \
+			"DEV		INTEGER	NOT NULL," \
+			"START		INTEGER	NOT NULL," \
+			"END		INTEGER	NOT NULL," \
+			"COUNT		INTEGER	NOT NULL," \
+			"SAMPLES	BLOB	NOT NULL);" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_END ON BLOCK(END);"
+/* a sample without a reading has NULL there, older databases are migrated */
+#define DATA_COLUMNS	"DEV		INTEGER	NOT NULL," \
+			"TIME		INTEGER	NOT NULL," \
+			"TEMP		REAL," \
+			"HUM		REAL"
+#define CREATE_DATA_DB  "CREATE TABLE IF NOT EXISTS DATA(" DATA_COLUMNS ");" \
+			"CREATE INDEX IF NOT EXISTS DATA_TIME ON DATA(TIME);" \
+			"CREATE INDEX IF NOT EXISTS DATA_DEV ON DATA(DEV, TIME);" \
+			CREATE_BLOCK_TABLE \
+			"CREATE INDEX IF NOT EXISTS BLOCK_START ON BLOCK(START);" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_DEV ON BLOCK(DEV, START);" \
+			"CREATE TABLE IF NOT EXISTS ROLLUP(" \
+			"DEV		INTEGER	NOT NULL," \
+			"STEP		INTEGER	NOT NULL," \
+			"BUCKET		INTEGER	NOT NULL," \
+			"COUNT		INTEGER	NOT NULL," \
+			"FIRST_TIME	INTEGER	NOT NULL," \
+			"LAST_TIME	INTEGER	NOT NULL," \
+			"TEMP_MIN REAL, TEMP_MAX REAL, TEMP_SUM REAL, TEMP_FIRST REAL, TEMP_LAST REAL," \
+			"HUM_MIN REAL, HUM_MAX REAL, HUM_SUM REAL, HUM_FIRST REAL, HUM_LAST REAL," \
+			"TEMP_COUNT INTEGER, HUM_COUNT INTEGER," \
+			"PRIMARY KEY(DEV, STEP, BUCKET)) WITHOUT ROWID;" \
+			"CREATE INDEX IF NOT EXISTS ROLLUP_BUCKET ON ROLLUP(STEP, BUCKET);" \
+			"CREATE TABLE IF NOT EXISTS JOURNAL(" \
+			"ID INTEGER PRIMARY KEY CHECK(ID = 0)," \
+			"SEQ		INTEGER	NOT NULL);"
+/*
+ * HOT_ID is the ID the block had in the data database: a block copied twice
+ * by an interrupted move is recognised by it and its content, two blocks of
+ * a device may start at the same time. An old archive gets HOT_ID from the
+ * migration of db_sqlite_open(), its blocks have none.
+ */
+#define CREATE_ARCHIVE_DB "CREATE TABLE IF NOT EXISTS BLOCK(" \
+			"ID INTEGER PRIMARY KEY," \
+			"DEV		INTEGER	NOT NULL," \
+			"START		INTEGER	NOT NULL," \
+			"END		INTEGER	NOT NULL," \
+			"COUNT		INTEGER	NOT NULL," \
+			"SAMPLES	BLOB	NOT NULL," \
+			"HOT_ID		INTEGER);" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_END ON BLOCK(END);" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_START ON BLOCK(START);" \
+			"DROP INDEX IF EXISTS BLOCK_DEV;" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_DEV_START ON BLOCK(DEV, START);" \
+			"CREATE INDEX IF NOT EXISTS BLOCK_HOT ON BLOCK(HOT_ID);"
+/* retention: delete at most ?2 rows older than ?1 (time_t), oldest first */
+#define EXPIRE_LOG_SQL	"DELETE FROM LOG WHERE ID IN (SELECT ID FROM LOG ORDER BY ID LIMIT ?2) " \
+			"AND TIME < strftime('%Y-%m-%d %H:%M:%S', ?1, 'unixepoch', 'localtime');"
+#define EXPIRE_BLOCK_SQL "DELETE FROM BLOCK WHERE ID IN " \
+			"(SELECT ID FROM BLOCK WHERE END < ?1 ORDER BY END LIMIT ?2);"
+/* late samples still waiting in DATA, and whole buckets of every rollup tier */
+#define EXPIRE_DATA_SQL	"DELETE FROM DATA WHERE ROWID IN " \
+			"(SELECT ROWID FROM DATA WHERE TIME < ?1 ORDER BY TIME LIMIT ?2);"
+#define EXPIRE_ROLLUP_SQL "DELETE FROM ROLLUP WHERE (DEV, STEP, BUCKET) IN " \
+			"(SELECT DEV, STEP, BUCKET FROM ROLLUP WHERE BUCKET + STEP <= ?1 LIMIT ?2);"
 /***********************************
  * enum
  *
@@ -40,10 +114,11 @@ typedef enum{
 	STATUS_RECORD,
 }STATUS_E;
 
-enum{
+typedef enum{
 	eSQLITE_MAIN = 0,
 	eSQLITE_LOG,
 	eSQLITE_DATA,
+	eSQLITE_ARCHIVE,
 }DB_SQLITE_TYPE_E;
 
 /***********************************
@@ -54,35 +129,90 @@ typedef struct{
 	time_t time;
 	float  fTemp;
 	float  fHum;
+	uint64_t dev;	/* device ID (registry.h), 0 if unknown */
 }STATUS_FAST_T;
 
 
+/* the hot fields of GLOBAL_T, read and written through status.h */
+typedef struct{
+	int 	status;
+	float  	tTemp;
+	STATUS_FAST_T tFastStatus;
+}STATUS_SNAPSHOT_T;
+
+#define STATUS_WORDS	((sizeof(STATUS_SNAPSHOT_T) + 3) / 4)
+
+/* seqlock: the snapshot is stored as words so that readers never race */
+typedef struct{
+	_Atomic uint32_t seq;	/* odd while a writer is inside */
+	_Atomic uint32_t words[STATUS_WORDS];
+}__attribute__((aligned(CACHE_LINE_SIZE))) STATUS_SEQ_T;
+
 typedef struct{
 	STATUS_E status;
 	int 	cycle;
 }PTHREAD_COLLECT_T;
 
 typedef struct{
+	const char *sql;	/* key, usually one of the SQL macros */
+	sqlite3_stmt *stmt;
+	unsigned lastUse;
+}DB_STMT_T;
+
+typedef struct DB_SQLITE_T{
 	char name[64];
 	sqlite3* sqlite;
-	char createSql[256];
+	char createSql[2048];
+	/* brings a database of an older schema up to createSql, before it runs */
+	int (*migrate)(struct DB_SQLITE_T *db);
+
+	/* prepared statements, owned by the thread using the database */
+	DB_STMT_T stmts[DB_STMT_CACHE];
+	unsigned stmtTick;
 
+	/* retention, see db_retain.h: 0 takes the default, < 0 keeps everything */
+	int keepDays;
+	const char *const *expireSql;	/* EXPIRE_ macros, up to a NULL */
 }DB_SQLITE_T;
 
+/* one sensor read by the reactor, see device.h */
+typedef struct{
+	char path[64];		/* /dev/ttyUSB0, /dev/hidraw0, /dev/rfcomm0 ... */
+	int baud;		/* 0 for a node that is not a tty (hidraw) */
+	char proto[16];		/* frame protocol, see frame.h */
+	uint64_t id;		/* device ID in the registry */
+}CONFIG_DEVICE_T;
+
 typedef struct{
 	int isInit;
+	int historyLen;		/* samples kept in memory per sensor */
+	char dbBackend[16];	/* sample storage engine, see db_backend.h */
+	unsigned memSamples;	/* ring size of the memory engine */
+	unsigned registryDevs;	/* devices tracked by the registry */
+	int filterMode;		/* change detection at ingest, see filter.h */
+	float filterTemp;	/* largest error stored samples allow, C */
+	float filterHum;	/* % */
+	int filterSilence;	/* s, heartbeat */
+	char simSpec[128];	/* simulated sensor fleet, see sim.h; empty for none */
+	CONFIG_DEVICE_T devices[MAX_DEVICES];
+	int deviceCount;
 }CONFIG_COMMON_T;;
 
 typedef struct{
-	int 	status;
+	/* glb status: status, tTemp and tFastStatus, on their own cache line */
+	STATUS_SEQ_T tStatus;
+
 	time_t 	tTime;
 	char*	pStrTime[64];//string of time e.g. 2023.01.01 09:00
-	float  	tTemp;
 	
 	/* sqlite3 handle */
 	DB_SQLITE_T db[MAX_SQLITE_CNTS];
-	/* glb status */
-	STATUS_FAST_T tFastStatus;
+	/* recent samples of each registry slot, see history.h */
+	struct HISTORY_T *pHistory;
+	/* latest state of every device, see registry.h */
+	struct REGISTRY_T *pRegistry;
+	/* sample storage engine, opened by init_db() */
+	const struct DB_BACKEND_T *pBackend;
 
 	/* configure*/
 	CONFIG_COMMON_T *pConfig;
@@ -0,0 +1,40 @@
+#ifndef __DB_ARCHIVE_H__
+#define __DB_ARCHIVE_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Hot/cold tiering of the compressed sample blocks.
+ *
+ * Blocks older than DB_ARCHIVE_HOT_DAYS are moved one at a time from the
+ * eSQLITE_DATA database (SD card) to the eSQLITE_ARCHIVE database (SATA
+ * disk), at most DB_ARCHIVE_RATE bytes per second. A move is a read of the
+ * block, a synced insert into the archive and a delete of one row from the
+ * data database, so the storage thread never waits more than one small
+ * transaction. Rollups, the open blocks and the journal stay in eSQLITE_DATA.
+ *
+ * Connections with the archive attached see both tiers in db_block_query().
+ */
+
+#define DB_ARCHIVE_SCHEMA	"archive"
+#define DB_ARCHIVE_HOT_DAYS	7
+#define DB_ARCHIVE_RATE		(256 * 1024)	/* bytes/s */
+#define DB_ARCHIVE_IDLE_S	60		/* between two scans when nothing is due */
+
+typedef struct{
+	uint64_t blocks;
+	uint64_t bytes;
+}DB_ARCHIVE_STATS_T;
+
+/* attach the archive to a connection of eSQLITE_DATA, nothing if there is none */
+int db_archive_attach(DB_SQLITE_T *db);
+
+/* the thread owns glb->db[eSQLITE_ARCHIVE] once started */
+int db_archive_start(void);
+void db_archive_stop(void);
+
+void db_archive_stats(DB_ARCHIVE_STATS_T *stats);
+
+#endif
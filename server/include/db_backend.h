@@ -0,0 +1,49 @@
+#ifndef __DB_BACKEND_H__
+#define __DB_BACKEND_H__
+
+#include <time.h>
+
+#include "common.h"
+#include "db_block.h"
+#include "db_rollup.h"
+
+/*
+ * Sample storage engines.
+ *
+ * parse_config() names the engine in glb->pConfig->dbBackend, init_db()
+ * opens it as glb->pBackend and the storage thread hands it the batches.
+ * The log and main databases are SQLite whatever the engine.
+ *
+ *   sqlite   eSQLITE_DATA with the journal, blocks, rollups and archive
+ *   memory   a ring of glb->pConfig->memSamples samples, nothing on disk;
+ *            the oldest samples are overwritten once it is full; no rollups
+ */
+
+#define DB_BACKEND_DEFAULT	"sqlite"
+#define DB_MEMORY_SAMPLES	(256 * 1024)	/* default ring, 6 MB with 64-bit time_t */
+
+typedef struct DB_BACKEND_T{
+	const char *name;
+
+	int (*open)(void);
+	void (*close)(void);
+	/* store n samples, returns how many were stored or -1; storage thread only */
+	int (*append)(const STATUS_FAST_T *s, unsigned n);
+	/*
+	 * samples of dev (DB_DEV_ALL for every device) with from <= time <= to,
+	 * oldest first for each device, until cb returns non zero; any thread,
+	 * without blocking append for more than a short copy
+	 */
+	int (*query)(uint64_t dev, time_t from, time_t to, DB_SAMPLE_CB cb, void *arg);
+	/* buckets of at most resolution seconds, see db_rollup_query(); NULL without rollups */
+	int (*rollup)(uint64_t dev, time_t from, time_t to, int resolution,
+			DB_ROLLUP_CB cb, void *arg);
+}DB_BACKEND_T;
+
+extern const DB_BACKEND_T db_backend_sqlite;
+extern const DB_BACKEND_T db_backend_memory;
+
+/* NULL if there is no engine of that name */
+const DB_BACKEND_T *db_backend_find(const char *name);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __DB_BLOCK_H__
+#define __DB_BLOCK_H__
+
+#include <sqlite3.h>
+
+#include "common.h"
+#include "ts_block.h"
+
+/*
+ * Compressed sample history in the eSQLITE_DATA database.
+ *
+ * Samples are inserted as DATA rows and also appended to the open block of
+ * their device and DB_BLOCK_SPAN. When a sample of the device falls into a
+ * later span (or the block is full) the block is written to the BLOCK
+ * table and its DATA rows are deleted in the same transaction, so DATA only
+ * holds the open blocks and a crash loses nothing: they are rebuilt from
+ * DATA on load.
+ *
+ * A late sample of an earlier span does not close the open block, it stays
+ * a DATA row (queries read those too). When the open block of its device
+ * closes, the late rows of the device are compacted into one block per
+ * span, so interleaved or delayed samples do not cut the history into
+ * tiny blocks.
+ *
+ * An open block grows its buffer up to DB_BLOCK_BYTES as samples come, so
+ * the writer holds about as much memory as the open blocks hold samples,
+ * not DB_BLOCK_BYTES per device.
+ */
+
+#define DB_BLOCK_SPAN	3600	/* seconds per block */
+#define DB_BLOCK_BYTES	16384	/* a block closes early when full */
+#define DB_BLOCK_MIN_BYTES 256	/* first buffer of an open block */
+
+/* latest time_t, 32 bits on older ARM toolchains */
+#define DB_TIME_MAX	((time_t)(sizeof(time_t) == 4 ? INT32_MAX : INT64_MAX))
+/* a query of every device */
+#define DB_DEV_ALL	0
+
+typedef struct{
+	TS_BLOCK_T blk;
+	uint8_t *buf;			/* blk.size bytes */
+	int64_t span;			/* span of the open block */
+	int64_t start, end;		/* earliest and latest sample time in it */
+	sqlite3_int64 lastRowid;	/* last DATA row in the open block */
+}DB_BLOCK_OPEN_T;
+
+typedef struct{
+	struct DEVMAP_T *open;		/* DB_BLOCK_OPEN_T of each device */
+}DB_BLOCK_WRITER_T;
+
+/* called for each sample of a query, non zero stops it */
+typedef int (*DB_SAMPLE_CB)(const STATUS_FAST_T *s, void *arg);
+
+/*
+ * rebuild the open blocks from the DATA rows; rows of closed spans, e.g.
+ * written before blocks existed, are compressed on the way
+ */
+int db_block_load(DB_BLOCK_WRITER_T *w, DB_SQLITE_T *db);
+/* forget the open blocks, they are still in DATA */
+void db_block_release(DB_BLOCK_WRITER_T *w);
+/* add a sample just inserted as DATA row rowid, inside the caller's transaction */
+int db_block_add(DB_BLOCK_WRITER_T *w, DB_SQLITE_T *db, const STATUS_FAST_T *s,
+		sqlite3_int64 rowid);
+
+/*
+ * samples of dev (DB_DEV_ALL for every device) with from <= time <= to,
+ * oldest first for each device. db is a connection of the calling thread,
+ * readers do not block the storage thread in WAL mode. Archived blocks are
+ * included when the archive is attached to db, see db_archive_attach().
+ */
+int db_block_query(DB_SQLITE_T *db, uint64_t dev, time_t from, time_t to,
+		DB_SAMPLE_CB cb, void *arg);
+
+#endif
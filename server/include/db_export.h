@@ -0,0 +1,35 @@
+#ifndef __DB_EXPORT_H__
+#define __DB_EXPORT_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+
+/*
+ * Export of the sample history as CSV or JSON, for a file or a socket.
+ *
+ * Samples come from the storage engine's query (db_backend.h), which
+ * reads the range piece by piece without holding up the storage thread,
+ * and are formatted into a DB_EXPORT_BUF buffer that is written out
+ * whenever it fills, so memory use does not depend on the range.
+ *
+ * Samples stored after the export started may or may not be included.
+ */
+
+#define DB_EXPORT_BUF		(16 * 1024)	/* bytes per write() */
+
+typedef enum{
+	DB_EXPORT_CSV = 0,	/* time,temp,hum,dev lines under a header */
+	DB_EXPORT_JSON,		/* one array of {"time","temp","hum","dev"} objects */
+}DB_EXPORT_FMT_E;
+
+/*
+ * write the samples of dev (DB_DEV_ALL for every device) with from <= time
+ * <= to to fd, oldest first for each device; returns the number of samples,
+ * or -1 on error (the output is then incomplete). Any thread may call it,
+ * several exports can run at once.
+ */
+int64_t db_export(int fd, uint64_t dev, time_t from, time_t to, DB_EXPORT_FMT_E fmt);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __DB_JOURNAL_H__
+#define __DB_JOURNAL_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Append-only sample journal in front of the eSQLITE_DATA database.
+ *
+ * The storage thread appends every sample it takes from the queue as a
+ * fixed-size, CRC-checked record, and fsyncs the file once
+ * DB_JOURNAL_SYNC_BYTES are pending or DB_JOURNAL_SYNC_MS after the first
+ * pending record: a power cut loses at most that window, for one fsync per
+ * hundreds of samples. The samples are applied to the database later, in
+ * group transactions that also record the last applied sequence number.
+ *
+ * init_db() replays the records past that number, a torn tail is cut off.
+ * Once the journal exceeds DB_JOURNAL_MAX_BYTES and everything is applied,
+ * the WAL is checkpointed to the database file and the journal emptied.
+ *
+ * Used by one thread at a time: init_db(), then the storage thread.
+ */
+
+#define DB_JOURNAL_SYNC_MS	500
+#define DB_JOURNAL_SYNC_BYTES	4096
+#define DB_JOURNAL_MAX_BYTES	(256 * 1024)
+
+typedef struct{
+	uint64_t seq;
+	int64_t time;
+	uint64_t dev;
+	float temp;
+	float hum;
+	uint32_t reserved;
+	uint32_t crc;		/* crc32 of the bytes before it */
+}DB_JOURNAL_REC_T;
+
+int db_journal_open(const char *path);
+/* write and sync what is pending */
+void db_journal_close(void);
+
+/* apply the records the database does not have yet */
+int db_journal_replay(DB_SQLITE_T *db);
+
+/* buffer a record, 0 or -1 if the journal is not open */
+int db_journal_append(const STATUS_FAST_T *s);
+/* write the pending records and fsync them if the policy says so, or if force */
+int db_journal_sync(int force);
+/* sequence number of the last appended record, 0 if none */
+uint64_t db_journal_seq(void);
+
+/* record seq as applied, inside the caller's transaction */
+int db_journal_applied(DB_SQLITE_T *db, uint64_t seq);
+/* empty the journal if it is large, only when all of it is applied */
+int db_journal_checkpoint(DB_SQLITE_T *db);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __DB_LOG_H__
+#define __DB_LOG_H__
+
+#include <stdint.h>
+
+/*
+ * Log sink persisting log events into the eSQLITE_LOG database.
+ *
+ * It is installed with log_set_callback(): messages still go through the
+ * default callback, and those at or below the sink level are also queued to
+ * the sink thread, which inserts them in one transaction per batch. The
+ * calling thread never waits on the database, events are dropped when the
+ * queue is full.
+ */
+
+#define DB_LOG_QUEUE	4096	/* queued events */
+#define DB_LOG_BATCH	256	/* events per transaction */
+#define DB_LOG_FLUSH_MS	1000	/* longest time an event waits for its batch */
+#define DB_LOG_NAME_SZ	32
+#define DB_LOG_EVENT_SZ	256
+
+/* open path, create the LOG table and install the callback */
+int db_log_start(const char *path, int level);
+/*
+ * flush the pending events and restore the default callback, to be called
+ * once the other logging threads are stopped; the counts go to the log
+ */
+void db_log_stop(void);
+
+/* events dropped because the queue was full */
+uint64_t db_log_dropped(void);
+
+#endif
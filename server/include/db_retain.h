@@ -0,0 +1,47 @@
+#ifndef __DB_RETAIN_H__
+#define __DB_RETAIN_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Retention and compaction of the databases in glb->db[].
+ *
+ * Every DB_RETAIN_PERIOD_S a thread goes over the opened databases with a
+ * rule (keepDays > 0 and an expireSql) on a connection of its own. Expired
+ * rows are deleted DB_RETAIN_BATCH at a time, one short transaction each
+ * with a pause in between, so the owner of the database never waits long.
+ * In eSQLITE_DATA that is the blocks, the late samples left in DATA and the
+ * buckets of every rollup tier.
+ * The freed pages are then given back to the file system by incremental
+ * vacuum, DB_RETAIN_VACUUM_PAGES at a time and at most DB_RETAIN_RATE bytes
+ * per second.
+ *
+ * Incremental vacuum needs auto_vacuum=INCREMENTAL, which db_sqlite_tune()
+ * sets on new databases only; an older file keeps its free pages for reuse
+ * until it is VACUUMed once by hand.
+ */
+
+#define DB_RETAIN_PERIOD_S	3600
+#define DB_RETAIN_DELAY_S	60		/* before the first pass, the server starts up meanwhile */
+#define DB_RETAIN_BATCH		500		/* rows per delete */
+#define DB_RETAIN_NAP_MS	50		/* between two deletes */
+#define DB_RETAIN_VACUUM_PAGES	64
+#define DB_RETAIN_RATE		(512 * 1024)	/* bytes/s given back by the vacuum */
+
+typedef struct{
+	uint64_t passes;
+	uint64_t rows;		/* expired rows deleted */
+	uint64_t bytes;		/* file space given back */
+}DB_RETAIN_STATS_T;
+
+int db_retain_start(void);
+void db_retain_stop(void);
+
+/* one pass now, in the calling thread; bytes given back or -1 */
+int64_t db_retain_run(void);
+
+void db_retain_stats(DB_RETAIN_STATS_T *stats);
+
+#endif
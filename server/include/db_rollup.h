@@ -0,0 +1,90 @@
+#ifndef __DB_ROLLUP_H__
+#define __DB_ROLLUP_H__
+
+#include <stdint.h>
+
+#include "common.h"
+#include "db_block.h"
+
+/*
+ * Rollups of the samples in the eSQLITE_DATA database: per 1 min, 1 h and
+ * 1 day bucket the count, min, max, sum, first and last of temperature and
+ * humidity, kept in the ROLLUP table with a retention per tier. A sample
+ * without a reading (NaN) counts for the bucket but not for that field:
+ * each field has its own count, the mean is its sum / its count, and a
+ * field no sample of the bucket had is NaN with a count of 0.
+ *
+ * Buckets are per device. The storage thread keeps the open bucket of
+ * every tier of every device in memory, adds each sample to those of its
+ * device and writes them back once per transaction, so a chart over a
+ * month reads ~720 hourly rows instead of every sample.
+ *
+ * The storage thread prunes a tier past its keep as the samples come in;
+ * the retention pass (db_retain.h) deletes the buckets of every tier past
+ * the keepDays of the database, also when no sample comes any more.
+ */
+
+#define DB_ROLLUP_TIERS	3
+
+typedef struct{
+	int step;		/* seconds per bucket */
+	int keep;		/* seconds of retention, 0 for the keepDays of the database */
+}DB_ROLLUP_TIER_T;
+
+extern const DB_ROLLUP_TIER_T db_rollup_tiers[DB_ROLLUP_TIERS];
+
+typedef struct{
+	float min;
+	float max;
+	float first;
+	float last;
+	double sum;
+	uint32_t count;		/* samples with a reading */
+	int64_t firstTime;	/* of first and last, in memory only */
+	int64_t lastTime;
+}DB_AGG_T;
+
+/* one bucket, a raw sample is a bucket of step 0 and count 1 */
+typedef struct{
+	uint64_t dev;
+	int64_t start;
+	int step;
+	uint32_t count;
+	int64_t firstTime;
+	int64_t lastTime;
+	DB_AGG_T temp;
+	DB_AGG_T hum;
+}DB_ROLLUP_T;
+
+/* the open buckets of one device */
+typedef struct{
+	DB_ROLLUP_T open[DB_ROLLUP_TIERS];
+	int dirty[DB_ROLLUP_TIERS];
+}DB_ROLLUP_OPEN_T;
+
+typedef struct{
+	struct DEVMAP_T *devs;	/* DB_ROLLUP_OPEN_T of each device */
+	int64_t pruned;		/* bucket of the coarsest tier at the last prune */
+}DB_ROLLUP_WRITER_T;
+
+typedef int (*DB_ROLLUP_CB)(const DB_ROLLUP_T *r, void *arg);
+
+/* forget the open buckets, also backfills an empty ROLLUP table from the history */
+int db_rollup_load(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db);
+/* forget the open buckets, without writing them */
+void db_rollup_release(DB_ROLLUP_WRITER_T *w);
+/* add a sample, inside the caller's transaction */
+int db_rollup_add(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db, const STATUS_FAST_T *s);
+/* write the open buckets, before the caller commits */
+int db_rollup_flush(DB_ROLLUP_WRITER_T *w, DB_SQLITE_T *db);
+
+/*
+ * buckets of dev (DB_DEV_ALL for every device) overlapping [from, to] from
+ * the coarsest tier whose step is not larger than resolution (seconds), or
+ * raw samples below one minute. When that tier no longer keeps from, the
+ * next coarser tier that does is used instead.
+ */
+int db_rollup_query(DB_SQLITE_T *db, uint64_t dev, time_t from, time_t to, int resolution,
+		DB_ROLLUP_CB cb, void *arg);
+
+#endif
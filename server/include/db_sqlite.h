@@ -0,0 +1,67 @@
+#ifndef __DB_SQLITE_H__
+#define __DB_SQLITE_H__
+
+#include <sqlite3.h>
+
+#include "common.h"
+
+/*
+ * SQLite storage layer behind init_db()/deinit_db().
+ *
+ * Every database in glb->db[] is opened in WAL mode with the pragmas below,
+ * its createSql is run once, and the statements it runs are prepared once
+ * and kept in the DB_SQLITE_T. A database and its statements belong to a
+ * single thread, nothing here is locked.
+ */
+
+/*
+ * WAL: readers do not block the writer and a commit is one append to the
+ * WAL file. synchronous=NORMAL only syncs at checkpoints, a power loss may
+ * lose the last transactions but never corrupts the database.
+ */
+#define DB_SQLITE_PRAGMAS	"PRAGMA synchronous=NORMAL;" \
+				"PRAGMA cache_size=-2048;" \
+				"PRAGMA mmap_size=16777216;" \
+				"PRAGMA temp_store=MEMORY;" \
+				"PRAGMA wal_autocheckpoint=1000;"
+#define DB_SQLITE_BUSY_MS	2000
+
+/* WAL mode and pragmas on an open connection, also used by the log sink */
+int db_sqlite_tune(sqlite3 *sqlite, const char *name);
+
+/* whether table has column (1 or 0, -1 on error) and, if notNull, whether it is NOT NULL */
+int db_sqlite_column(sqlite3 *sqlite, const char *table, const char *column, int *notNull);
+
+/* open db->name, run db->migrate and db->createSql, 0 on success */
+int db_sqlite_open(DB_SQLITE_T *db);
+/* finalize the cached statements and close */
+void db_sqlite_close(DB_SQLITE_T *db);
+
+/*
+ * cached statement for sql, prepared on first use. It comes back reset with
+ * its bindings cleared; call sqlite3_reset() after the last step so that no
+ * read transaction is left open. sql is matched by pointer first, so passing
+ * the same macro or literal is the fast path. NULL on error.
+ */
+sqlite3_stmt *db_sqlite_stmt(DB_SQLITE_T *db, const char *sql);
+
+/* run a statement without results through the cache */
+int db_sqlite_exec(DB_SQLITE_T *db, const char *sql);
+
+/* SQLite stores NaN as NULL: a missing reading goes in as NULL and comes back as NaN */
+static inline void db_sqlite_bind_real(sqlite3_stmt *stmt, int col, double v)
+{
+	if (v != v)
+		sqlite3_bind_null(stmt, col);
+	else
+		sqlite3_bind_double(stmt, col, v);
+}
+
+static inline double db_sqlite_column_real(sqlite3_stmt *stmt, int col)
+{
+	if (sqlite3_column_type(stmt, col) == SQLITE_NULL)
+		return __builtin_nan("");
+	return sqlite3_column_double(stmt, col);
+}
+
+#endif
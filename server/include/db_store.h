@@ -0,0 +1,54 @@
+#ifndef __DB_STORE_H__
+#define __DB_STORE_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Storage thread: sensor samples are queued by the collect thread, written
+ * to the journal (db_journal.h) when there is one and handed in batches to
+ * the storage engine of glb->pBackend (db_backend.h), a batch being closed
+ * when DB_STORE_BATCH samples are pending or the oldest one waited
+ * DB_STORE_FLUSH_MS. Pushing never waits on the disk, a sample is dropped
+ * when the queue is full. A batch the engine fails to store stays pending
+ * and is retried after DB_STORE_RETRY_MS, doubled on each failure; at stop
+ * it is left in the journal for the next start. The SQLite engine stores a
+ * batch as one group transaction and keeps the samples compressed, see
+ * db_block.h.
+ *
+ * Once started the thread owns glb->db[eSQLITE_DATA] and its statements.
+ */
+
+#define DB_STORE_QUEUE		8192	/* queued samples, a burst of several minutes */
+#define DB_STORE_BATCH		256	/* samples per transaction */
+#define DB_STORE_FLUSH_MS	1000	/* longest time a sample waits for its batch */
+#define DB_STORE_RETRY_MS	100	/* first wait after a failed batch */
+#define DB_STORE_RETRY_MAX_MS	5000	/* longest wait between retries */
+
+typedef struct{
+	uint64_t queued;
+	uint64_t dropped;	/* queue full */
+	uint64_t stored;
+	uint64_t failed;	/* refused in a stored batch */
+	uint64_t batches;
+}DB_STORE_STATS_T;
+
+int db_store_start(void);
+/* commit the pending samples and stop the thread, the producers stop first */
+void db_store_stop(void);
+
+/* 0 if queued, -1 if dropped */
+int db_store_push(const STATUS_FAST_T *sample);
+
+void db_store_stats(DB_STORE_STATS_T *stats);
+
+/*
+ * store n samples in eSQLITE_DATA in one transaction that also records the
+ * journal sequence seq (if not 0); used by the SQLite engine and by the
+ * journal replay.
+ * Returns the samples stored, -1 if the transaction failed.
+ */
+int db_store_apply(DB_SQLITE_T *db, const STATUS_FAST_T *s, unsigned n, uint64_t seq);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Sensors on a serial (tty), USB (hidraw) or Bluetooth (RFCOMM) node.
+ *
+ * Each configured device (CONFIG_DEVICE_T, in glb->pConfig->devices) is
+ * opened and added to the reactor with its frame protocol (frame.h); every
+ * frame it sends is decoded with frame_sample() and goes to
+ * collect_ingest() under the device's ID, in the reactor thread. A device
+ * that hangs up is logged and stays closed until the next start.
+ *
+ * A device is described by a spec string, -d on the command line (once per
+ * device), e.g.
+ *	path=/dev/ttyUSB0,baud=9600,proto=modbus-th,id=17
+ *
+ *	path	the node; a spec without '=' in its first item takes it as path
+ *	baud	tty speed (DEVICE_DEFAULT_BAUD), 0 to leave the node as it is
+ *	proto	frame protocol (DEVICE_DEFAULT_PROTO)
+ *	id	device ID in the registry, not 0
+ */
+
+#define DEVICE_DEFAULT_BAUD	9600
+#define DEVICE_DEFAULT_PROTO	"shbin"
+
+/* spec to dev, returns 0 or -1 */
+int device_parse(const char *spec, CONFIG_DEVICE_T *dev);
+
+/* open and add count devices, after reactor_start(); returns how many run */
+int device_start(const CONFIG_DEVICE_T *devs, int count);
+/* before reactor_stop(): takes them out of the reactor, with their stats */
+void device_stop(void);
+
+#endif
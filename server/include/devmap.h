@@ -0,0 +1,29 @@
+#ifndef __DEVMAP_H__
+#define __DEVMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-device records of one thread, keyed by device ID: the open blocks
+ * and rollup buckets of the storage thread. Open addressing on the ID,
+ * grown to stay at most half full. Records are allocated zeroed on first
+ * use and never move, a pointer stays valid until devmap_clear(). Not
+ * locked, one thread at a time.
+ */
+
+typedef struct DEVMAP_T DEVMAP_T;
+
+/* records of size bytes */
+DEVMAP_T *devmap_create(size_t size);
+void devmap_destroy(DEVMAP_T *m);
+
+/* record of id; a new zeroed one if create, otherwise NULL if there is none */
+void *devmap_get(DEVMAP_T *m, uint64_t id, int create);
+/* call cb for each record until it returns non zero, which is returned */
+int devmap_each(DEVMAP_T *m, int (*cb)(uint64_t id, void *rec, void *arg), void *arg);
+/* free every record */
+void devmap_clear(DEVMAP_T *m);
+unsigned devmap_count(DEVMAP_T *m);
+
+#endif
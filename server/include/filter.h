@@ -0,0 +1,84 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Change detection at ingest: which samples of a device are worth storing.
+ *
+ * Thermostat-like sensors mostly repeat themselves within their noise, so
+ * collect_ingest() passes every sample through the device's filter and
+ * queues only what carries information:
+ *
+ *	FILTER_DEADBAND	a sample is stored when temp or hum moved more than
+ *			the deadband from the last stored one; holding the last
+ *			stored value is never off by more than the deadband.
+ *	FILTER_SWING	swinging door: a sample is held back as long as the
+ *			straight line from the last stored sample to it passes
+ *			within temp/hum of every sample in between; when a new
+ *			sample breaks that, the held one is stored and a new
+ *			door starts from it. Interpolating linearly between
+ *			stored samples is never off by more than temp/hum.
+ *
+ * With either, a sample is stored anyway once silence seconds passed since
+ * the last stored one (heartbeat), so a quiet device still shows as alive.
+ * That is only checked when the device sends again: for a device that
+ * went silent, the collect thread sweeps the slots every FILTER_SWEEP_MS
+ * and stores the samples held for silence seconds, so a held sample waits
+ * at most silence plus one sweep. NaN is a value of its own: a reading
+ * appearing or disappearing is always stored.
+ *
+ * The state is per registry slot (registry.h), devices past the registry
+ * capacity are not filtered. The filter functions have one caller at a
+ * time: collect_ingest() and the sweep of the collect thread.
+ */
+
+typedef enum{
+	FILTER_NONE = 0,
+	FILTER_DEADBAND,
+	FILTER_SWING,
+}FILTER_MODE_E;
+
+#define FILTER_DEFAULT_MODE	FILTER_SWING
+#define FILTER_DEFAULT_TEMP	0.1f	/* C */
+#define FILTER_DEFAULT_HUM	0.5f	/* % */
+#define FILTER_DEFAULT_SILENCE	300	/* s */
+#define FILTER_SWEEP_MS		1000
+
+typedef struct{
+	int mode;		/* FILTER_MODE_E */
+	float temp;		/* largest error on the temperature, C */
+	float hum;		/* on the humidity, % */
+	int silence;		/* s without a stored sample before a heartbeat, 0 for never */
+}FILTER_PARAM_T;
+
+typedef struct{
+	uint64_t in;
+	uint64_t stored;
+	uint64_t heartbeats;	/* stored only for the silence */
+	uint64_t flushed;	/* held samples stored by the sweep or at stop */
+}FILTER_STATS_T;
+
+/* state for slots 0 .. devs - 1, each starting with par */
+int filter_init(unsigned devs, const FILTER_PARAM_T *par);
+void filter_deinit(void);
+
+/* parameters of one device, restarting its filter */
+int filter_set(int slot, const FILTER_PARAM_T *par);
+
+/*
+ * next sample of slot: the samples to store, oldest first, go to out and
+ * their number (0, 1 or 2) is returned. A slot < 0 is not filtered.
+ */
+unsigned filter_apply(int slot, const STATUS_FAST_T *s, STATUS_FAST_T out[2]);
+/* the sample slot holds back, if any; returns 0 or 1 */
+unsigned filter_flush(int slot, STATUS_FAST_T *out);
+/* same, only if it was held for the slot's silence at time now */
+unsigned filter_sweep(int slot, time_t now, STATUS_FAST_T *out);
+
+void filter_stats(FILTER_STATS_T *stats);
+void filter_dump(void);
+
+#endif
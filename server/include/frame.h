@@ -0,0 +1,126 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "common.h"
+
+/*
+ * Framing of sensor byte streams (UART, RS485, USB serial).
+ *
+ * Each device has a FRAME_PARSER_T: a power-of-two ring that frame_read()
+ * fills with one readv() of all the free space, and a protocol table that
+ * frame_parse() uses to find sync bytes, lengths and checksums in place.
+ * A complete frame is handed over as a FRAME_VIEW_T pointing into the
+ * ring; only a frame that wraps around the end of the ring is copied, once
+ * per lap, to make it contiguous. The view is valid during the callback.
+ *
+ * Protocols are FRAME_PROTO_T tables: the sync bytes, where the length is
+ * (or a fixed length), the checksum and up to FRAME_MAX_FIELDS fields mapped
+ * to STATUS_FAST_T, so a new sensor is a table and not a decoder. Garbage,
+ * a bad length or a bad checksum skips one byte and the parser resyncs on
+ * the next sync bytes.
+ */
+
+#define FRAME_MAX_LEN		255	/* longest frame of any protocol */
+#define FRAME_MAX_FIELDS	4
+#define FRAME_RING_DEFAULT	4096
+#define FRAME_LEN_FIXED		0xff	/* lenOff value: every frame is minLen long */
+
+typedef enum{
+	FRAME_CSUM_NONE = 0,
+	FRAME_CSUM_SUM8,	/* sum of the bytes, mod 256 */
+	FRAME_CSUM_XOR8,
+	FRAME_CSUM_CRC16_MODBUS,	/* stored little endian */
+}FRAME_CSUM_E;
+
+typedef enum{
+	FRAME_U8 = 0,
+	FRAME_S8,
+	FRAME_U16_BE,
+	FRAME_S16_BE,
+	FRAME_U16_LE,
+	FRAME_S16_LE,
+	FRAME_U32_BE,
+	FRAME_U32_LE,
+}FRAME_TYPE_E;
+
+typedef enum{
+	FRAME_FIELD_NONE = 0,
+	FRAME_FIELD_TEMP,
+	FRAME_FIELD_HUM,
+	FRAME_FIELD_TIME,	/* without it a sample is stamped on receipt */
+}FRAME_FIELD_E;
+
+typedef struct{
+	uint8_t field;		/* FRAME_FIELD_E */
+	uint8_t type;		/* FRAME_TYPE_E */
+	uint8_t off;		/* from the start of the frame */
+	float scale;		/* value = raw * scale + add */
+	float add;
+}FRAME_FIELD_T;
+
+typedef struct{
+	const char *name;
+	uint8_t sync[4];
+	uint8_t syncLen;
+	uint8_t lenOff;		/* offset of the length byte, or FRAME_LEN_FIXED */
+	uint8_t lenAdd;		/* frame length = length byte + lenAdd */
+	uint8_t minLen;
+	uint8_t maxLen;		/* at least minLen */
+	uint8_t csum;		/* FRAME_CSUM_E, over [csumFrom, end - csum size) */
+	uint8_t csumFrom;
+	FRAME_FIELD_T fields[FRAME_MAX_FIELDS];
+}FRAME_PROTO_T;
+
+/* built-in protocols, NULL terminated */
+extern const FRAME_PROTO_T *const frame_protos[];
+/* NULL if there is no protocol of that name */
+const FRAME_PROTO_T *frame_proto_find(const char *name);
+
+typedef struct{
+	const FRAME_PROTO_T *proto;
+	const uint8_t *data;	/* into the ring, or its scratch copy */
+	unsigned len;
+}FRAME_VIEW_T;
+
+typedef struct{
+	uint64_t bytes;
+	uint64_t frames;
+	uint64_t badCsum;
+	uint64_t skipped;	/* bytes of garbage */
+	uint64_t wrapped;	/* frames copied for crossing the end of the ring */
+}FRAME_STATS_T;
+
+typedef struct{
+	const FRAME_PROTO_T *proto;
+	uint8_t *ring;
+	uint32_t mask;		/* size - 1 */
+	uint32_t head;		/* free running, write position */
+	uint32_t tail;		/* free running, first byte not parsed */
+	uint8_t scratch[FRAME_MAX_LEN];
+	FRAME_STATS_T st;
+}FRAME_PARSER_T;
+
+/* called for each frame, non zero stops frame_parse() */
+typedef int (*FRAME_CB)(const FRAME_VIEW_T *view, void *arg);
+
+/* size is rounded up to a power of two, at least 2 * FRAME_MAX_LEN */
+int frame_parser_init(FRAME_PARSER_T *p, const FRAME_PROTO_T *proto, unsigned size);
+void frame_parser_free(FRAME_PARSER_T *p);
+
+/* one readv() into the free space: bytes read, 0 at EOF, -1 with errno */
+ssize_t frame_read(FRAME_PARSER_T *p, int fd);
+/* copy bytes in, e.g. from a recording; returns how many fitted */
+size_t frame_feed(FRAME_PARSER_T *p, const void *data, size_t len);
+/* hand over the complete frames buffered, returns how many */
+unsigned frame_parse(FRAME_PARSER_T *p, FRAME_CB cb, void *arg);
+/* throw away everything buffered, counted as skipped; returns the bytes */
+uint32_t frame_drop(FRAME_PARSER_T *p);
+
+/* decode the fields of a frame; time is used when the frame has none, NaN for a missing reading */
+void frame_sample(const FRAME_VIEW_T *view, time_t time, STATUS_FAST_T *s);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Recent samples of each sensor kept in memory.
+ *
+ * One fixed ring per registry slot (registry.h), allocated on the first
+ * sample of the device, so memory follows the devices actually seen and
+ * not the registry capacity. A ring keeps the time and values only, the
+ * device ID once.
+ *
+ * One writer, the collect thread, and any number of readers (GUI, upload,
+ * web). Readers never lock nor retry: they copy the window and then drop
+ * the oldest samples the writer may have overwritten meanwhile, so what
+ * they get is always a consistent run of samples, at worst a few shorter
+ * than asked.
+ */
+
+#define HISTORY_DEFAULT_LEN	600	/* 10 min of 1 s samples */
+
+typedef struct HISTORY_T HISTORY_T;
+
+/* rings for slots 0 .. slots - 1, len is rounded up to a power of two */
+HISTORY_T *history_create(unsigned slots, unsigned len);
+void history_destroy(HISTORY_T *h);
+
+/* writer only, a slot out of range or without memory for its ring is not kept */
+void history_push(HISTORY_T *h, int slot, const STATUS_FAST_T *s);
+
+/* copy the last max samples of slot, oldest first, returns how many */
+unsigned history_read(HISTORY_T *h, int slot, STATUS_FAST_T *out, unsigned max);
+/* same, limited to the samples with time >= since */
+unsigned history_since(HISTORY_T *h, int slot, time_t since, STATUS_FAST_T *out, unsigned max);
+
+/* samples of slot pushed so far */
+uint64_t history_count(HISTORY_T *h, int slot);
+unsigned history_len(HISTORY_T *h);
+
+#endif
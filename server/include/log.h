@@ -22,6 +22,7 @@
 #define __LOG_H__
 
 #include <stdarg.h>
+#include <stdint.h>
 
 /**
  * @addtogroup lavu_log
@@ -115,7 +116,63 @@
  * @param fmt The format string (printf-compatible) that specifies how
  *        subsequent arguments are converted to output.
  */
-void log(void *name, int level, const char *fmt, ...) printf_format(3, 4);
+void (log)(void *name, int level, const char *fmt, ...) printf_format(3, 4);
+
+/**
+ * Messages with a level above LOG_BUILD_LEVEL are removed at compile time by
+ * the log() macro, arguments included. Set with LOG_MIN_LEVEL in the Makefile.
+ */
+#ifndef LOG_BUILD_LEVEL
+#define LOG_BUILD_LEVEL LOG_MAX_OFFSET
+#endif
+
+/**
+ * Use the global level for a TAG again.
+ * @see log_set_tag_level
+ */
+#define LOG_TAG_DEFAULT (-0x10000)
+
+/**
+ * Level of a message without the LOG_C() tint.
+ */
+#define LOG_LEVEL_BASE(level) ((level) >= 0 ? (level) & 0xff : (level))
+
+/**
+ * Registry entry for one TAG, interned once per call site by log().
+ */
+typedef struct LogTag {
+    const char *name;
+    int level;          ///< effective level, read and written atomically
+    int override;       ///< level was set with log_set_tag_level()
+} LogTag;
+
+static inline int log_tag_enabled(const LogTag *tag, int level)
+{
+    return LOG_LEVEL_BASE(level) <= __atomic_load_n(&tag->level, __ATOMIC_RELAXED);
+}
+
+LogTag *log_tag_site(LogTag **site, const char *name);
+void log_tag_emit(const LogTag *tag, int level, const char *fmt, ...) printf_format(3, 4);
+
+/**
+ * Per call site front end of log().
+ *
+ * The TAG is looked up once and cached in a static of the call site, so name
+ * must be the same every time a given call site runs (a TAG macro or NULL).
+ * The arguments are only evaluated when the message is enabled, and not
+ * compiled at all when level is a constant above LOG_BUILD_LEVEL. level may
+ * be evaluated more than once.
+ */
+#define log(name, level, ...) do {                                              \
+    if (LOG_LEVEL_BASE(level) <= LOG_BUILD_LEVEL) {                             \
+        static LogTag *log_site_tag;                                            \
+        LogTag *log_tag_ = __atomic_load_n(&log_site_tag, __ATOMIC_ACQUIRE);    \
+        if (!log_tag_)                                                          \
+            log_tag_ = log_tag_site(&log_site_tag, (name));                     \
+        if (log_tag_enabled(log_tag_, (level)))                                 \
+            log_tag_emit(log_tag_, (level), __VA_ARGS__);                       \
+    }                                                                           \
+} while (0)
 
 /**
  * Send the specified message to the log once with the initial_level and then with
@@ -173,6 +230,33 @@ int log_get_level(void);
  */
 void log_set_level(int level);
 
+/**
+ * Set the level of one TAG, independently of the global level.
+ *
+ * Takes effect immediately for all threads, without taking the logging
+ * mutex.
+ *
+ * @param name  TAG as passed to log()
+ * @param level Logging level, or LOG_TAG_DEFAULT to follow log_set_level()
+ *              again
+ * @return 0 on success, a negative error code if the registry is full
+ */
+int log_set_tag_level(const char *name, int level);
+
+/**
+ * Get the level currently in effect for a TAG.
+ */
+int log_get_tag_level(const char *name);
+
+/**
+ * Set levels from a string such as "info,common=trace,main=warning".
+ * An item without '=' sets the global level; levels are names ("error",
+ * "debug", ..., "default") or numbers.
+ *
+ * @return 0 on success, a negative error code if an item was invalid
+ */
+int log_parse_levels(const char *spec);
+
 /**
  * Set the logging callback
  *
@@ -188,7 +272,9 @@ void log_set_callback(void (*callback)(void *, int, const char*, va_list));
 /**
  * Default logging callback
  *
- * It prints the message to stderr, optionally colorizing it.
+ * It prints the message to stderr, optionally colorizing it. The level is
+ * not checked again, log() and vlog() filter messages with the per-TAG
+ * levels before calling it.
  *
  * @param level The importance level of the message expressed using a @ref
  *        lavu_log_constants "Logging Constant".
@@ -243,9 +329,118 @@ int log_format_line2(void *name, int level, const char *fmt, va_list vl,
  */
 #define LOG_PRINT_LEVEL 2
 
+/**
+ * In asynchronous mode, only capture the format string and the raw arguments
+ * on the calling thread; formatting is done by the log thread, or offline by
+ * tools/logdecode when a binary log file is open.
+ * @see log_async_start
+ * @see log_binary_open
+ */
+#define LOG_BINARY 4
+
+/**
+ * Write messages to the file opened with log_file_open() instead of stderr.
+ * @see log_file_open
+ */
+#define LOG_TO_FILE 8
+
+/**
+ * Rate limit every call site, identified by its TAG and format string, with
+ * a token bucket. Suppressed messages are counted and reported as
+ * "suppressed N messages from TAG in the last T s" once the site may log
+ * again, by the log thread once they are a few seconds old, and at
+ * log_async_stop() and exit. LOG_PANIC and LOG_FATAL are never suppressed.
+ * @see log_set_rate_limit
+ */
+#define LOG_RATE_LIMIT 16
+
 void log_set_flags(int arg);
 int log_get_flags(void);
 
+/**
+ * Set the token bucket of LOG_RATE_LIMIT.
+ *
+ * @param burst   messages a call site may log back to back
+ * @param per_sec messages per second a call site may log in the long run
+ */
+void log_set_rate_limit(int burst, int per_sec);
+
+/**
+ * Drop the message when the ring of the calling thread is full.
+ */
+#define LOG_OVERFLOW_DROP  0
+
+/**
+ * Wait for the log thread to make room when the ring of the calling thread
+ * is full.
+ */
+#define LOG_OVERFLOW_BLOCK 1
+
+/**
+ * Switch the default callback to asynchronous mode and start the log thread.
+ *
+ * Each logging thread formats its messages into its own lock-free ring, the
+ * log thread drains all rings in batches and does the terminal I/O, so
+ * callers never wait on the logging mutex or on stderr.
+ *
+ * @param ring_size size in bytes of each per-thread ring, rounded up to a
+ *                  power of two
+ * @param overflow  LOG_OVERFLOW_DROP or LOG_OVERFLOW_BLOCK
+ * @return 0 on success, a negative error code otherwise
+ */
+int log_async_start(unsigned ring_size, int overflow);
+
+/**
+ * Flush the pending messages, stop the log thread and go back to
+ * synchronous mode. Callers already pushing a message when it is called
+ * are waited for, their messages are not lost.
+ */
+void log_async_stop(void);
+
+/**
+ * @return number of messages dropped because a ring was full
+ */
+uint64_t log_async_dropped(void);
+
+/**
+ * Write LOG_BINARY records to a binary log file instead of formatting them.
+ * Format strings and TAGs are stored once, the file is decoded by
+ * tools/logdecode. They must therefore be string literals or otherwise stay
+ * valid until log_binary_close().
+ *
+ * @param path file to create, truncated if it exists
+ * @return 0 on success, a negative error code otherwise
+ */
+int log_binary_open(const char *path);
+
+/**
+ * Close the binary log file, LOG_BINARY records are formatted again.
+ */
+void log_binary_close(void);
+
+/**
+ * Open the log file used with the LOG_TO_FILE flag.
+ *
+ * Lines are appended into a memory-mapped segment of segment_size bytes,
+ * prefixed with the time. When a segment is full it rolls over to path.1,
+ * path.2, ... keeping at most segments files. Dirty data is synced every
+ * sync_ms, and at once for LOG_ERROR and above. After a crash the active
+ * segment may end with zero padding, it is trimmed at the next open.
+ *
+ * sync_ms is checked when a line is written and by the log thread of
+ * log_async_start(). Without the log thread, lines written before a quiet
+ * period are synced by the next line or log_file_close() only, whatever
+ * sync_ms is.
+ *
+ * @return 0 on success, a negative error code otherwise
+ */
+int log_file_open(const char *path, unsigned segment_size, int segments, int sync_ms);
+
+/**
+ * Sync and close the log file, messages go to stderr again.
+ */
+void log_file_close(void);
+
 /**
  * @}
  */
@@ -0,0 +1,85 @@
+#ifndef __LOG_BINARY_H__
+#define __LOG_BINARY_H__
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/*
+ * Deferred-formatting binary log records.
+ *
+ * The calling thread only captures the format pointer, the TAG, the level, a
+ * timestamp and the raw arguments; the printf work is done later by the log
+ * thread or offline by tools/logdecode from a binary log file.
+ *
+ * Arguments are stored in the order of the format string without any type
+ * information, the format string itself describes them:
+ *   - integers, pointers and '*' width/precision: 8 bytes
+ *   - floating point: 8 bytes (double, long double is narrowed)
+ *   - strings: 2 bytes length (0xffff for NULL) followed by the bytes
+ * Files are written in host byte order.
+ */
+
+#define LOG_BIN_MAGIC		"SHLOGBIN"
+#define LOG_BIN_VERSION		1
+
+#define LOG_BIN_MAX_ARGS	512	/* captured argument bytes per record */
+#define LOG_BIN_MAX_STR		256	/* longest %s argument kept */
+#define LOG_BIN_NULL_STR	0xffff
+
+/* record as queued in the log rings */
+typedef struct{
+	const char *fmt;
+	const char *name;
+	int64_t time;		/* us since the epoch */
+	int32_t level;		/* including LOG_C() tint */
+	uint16_t print_prefix;
+	uint16_t size;		/* bytes of args */
+	uint8_t args[];
+}LOG_BIN_REC_T;
+
+/* file entries, each one starts with a kind byte */
+#define LOG_BIN_STRING	1
+#define LOG_BIN_EVENT	2
+
+typedef struct{
+	uint8_t kind;		/* LOG_BIN_STRING */
+	uint8_t reserved;
+	uint16_t len;
+	uint32_t id;
+	/* followed by len bytes, not 0-terminated */
+}LOG_BIN_STRING_T;
+
+typedef struct{
+	uint8_t kind;		/* LOG_BIN_EVENT */
+	uint8_t reserved;
+	uint16_t size;
+	int32_t level;
+	int64_t time;
+	uint32_t fmt_id;
+	uint32_t name_id;	/* 0 when the TAG is NULL */
+	/* followed by size bytes of arguments */
+}LOG_BIN_EVENT_T;
+
+/*
+ * Capture the arguments of fmt into dst.
+ * Returns the number of bytes used, or -1 if the format cannot be deferred
+ * (%n, wide strings, too many arguments), the caller has to format it itself.
+ */
+int log_bin_capture(uint8_t *dst, unsigned room, const char *fmt, va_list vl);
+
+/*
+ * Format captured arguments, snprintf() semantics: returns the length the
+ * full line would have, dst is always 0-terminated when size > 0.
+ */
+int log_bin_format(char *dst, int size, const char *fmt,
+		const uint8_t *args, unsigned len);
+
+typedef struct LOG_BIN_FILE_T LOG_BIN_FILE_T;
+
+LOG_BIN_FILE_T *log_bin_file_open(const char *path);
+/* append a record, the fmt/TAG strings are written once per pointer */
+int log_bin_file_write(LOG_BIN_FILE_T *file, const LOG_BIN_REC_T *rec);
+int log_bin_file_flush(LOG_BIN_FILE_T *file);
+void log_bin_file_close(LOG_BIN_FILE_T *file);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __LOG_MMAP_H__
+#define __LOG_MMAP_H__
+
+/*
+ * Rotating memory-mapped log file.
+ *
+ * Lines are appended with a memcpy into a preallocated, mapped segment; when
+ * the segment is full it is trimmed to its used size and renamed, keeping
+ * path, path.1, ... path.<segments-1>. Dirty pages are synced every sync_ms
+ * or on demand. There is no timer: sync_ms is only checked by
+ * log_mmap_write() and log_mmap_poll(), so a file nobody writes or polls
+ * stays dirty until the next write or log_mmap_close().
+ *
+ * After a crash the active segment ends with zero padding up to the segment
+ * size; it is trimmed when the file is opened again.
+ *
+ * Not thread safe, the logger calls it with its mutex held.
+ */
+
+typedef struct LOG_MMAP_T LOG_MMAP_T;
+
+LOG_MMAP_T *log_mmap_open(const char *path, unsigned segment_size,
+		int segments, int sync_ms);
+/* append len bytes, sync immediately if sync is set */
+int log_mmap_write(LOG_MMAP_T *f, const char *buf, unsigned len, int sync);
+/* sync if dirty and the last sync is older than sync_ms; call it periodically */
+void log_mmap_poll(LOG_MMAP_T *f);
+void log_mmap_close(LOG_MMAP_T *f);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __LOG_RING_H__
+#define __LOG_RING_H__
+
+#include <stdint.h>
+
+/*
+ * Per-thread lock-free log rings.
+ *
+ * Every logging thread owns one single-producer/single-consumer byte ring.
+ * Producers reserve a record, fill it and commit it without any lock; the
+ * log thread is the only consumer and drains all rings in batches.
+ */
+
+#define LOG_REC_PAD	0	/* filler up to the end of the ring */
+#define LOG_REC_TEXT	1	/* pre-formatted line */
+#define LOG_REC_BINARY	2	/* LOG_BIN_REC_T, formatted by the consumer */
+
+typedef struct LOG_RING_T LOG_RING_T;
+
+/* ring of the calling thread, created with size bytes on first use */
+LOG_RING_T *log_ring_local(unsigned size);
+
+/* reserve room for a record of size bytes, NULL if the ring is full */
+void *log_ring_reserve(LOG_RING_T *ring, unsigned size, unsigned type);
+/* publish the record returned by the last log_ring_reserve() */
+void log_ring_commit(LOG_RING_T *ring);
+/* account for a record that was dropped because the ring was full */
+void log_ring_drop(LOG_RING_T *ring);
+
+/*
+ * Consume at most batch records from every ring, calling cb for each.
+ * Returns the number of records consumed. Only one thread may drain.
+ */
+int log_ring_drain(int batch,
+		void (*cb)(void *opaque, unsigned type, const void *data, unsigned size),
+		void *opaque);
+
+/* total records dropped on all rings */
+uint64_t log_ring_dropped(void);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue of fixed-size
+ * elements. Push and pop never block, they fail when the queue is full or
+ * empty and leave the policy to the caller.
+ */
+
+typedef struct QUEUE_T QUEUE_T;
+
+/* capacity is rounded up to a power of two */
+QUEUE_T *queue_create(unsigned capacity, unsigned elem_size);
+void queue_destroy(QUEUE_T *q);
+
+/* 0 on success, -1 if the queue is full */
+int queue_push(QUEUE_T *q, const void *elem);
+/* 0 on success, -1 if the queue is empty */
+int queue_pop(QUEUE_T *q, void *elem);
+
+/* number of queued elements, only a hint while other threads run */
+unsigned queue_count(QUEUE_T *q);
+unsigned queue_capacity(QUEUE_T *q);
+
+#endif
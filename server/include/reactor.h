@@ -0,0 +1,68 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "frame.h"
+
+/*
+ * Device I/O reactor: one thread and one epoll set for every serial, USB
+ * (hidraw), Bluetooth (RFCOMM) or network device, instead of a blocking
+ * reader thread and its stack per device.
+ *
+ * Device fds are made non-blocking and watched level-triggered. A readable
+ * device gets at most REACTOR_READS_PER_EVENT reads per turn, so a chatty
+ * one cannot starve the others. The bytes go to the device's receive
+ * buffer and its frame callback is handed everything buffered; what it
+ * does not consume, an incomplete frame, stays for the next read. A full
+ * buffer that the callback consumes nothing of is dropped and counted.
+ * Devices speaking a protocol of frame.h are added with reactor_add_frames()
+ * instead: they read into a frame ring and get the frames as views. A
+ * frame callback returning non zero only defers the rest of the frames to
+ * the next read; a ring that fills up meanwhile is parsed on, and dropped
+ * if that still frees nothing, the device stays open.
+ *
+ * Devices may be added and removed from any thread, the callbacks run in
+ * the reactor thread. Hang-up, errors and reactor_remove() all end in the
+ * close callback, then the reactor closes the fd.
+ */
+
+#define REACTOR_MAX_DEVS	64
+#define REACTOR_RX_BUF		512	/* bytes buffered per device, a few frames */
+#define REACTOR_READS_PER_EVENT	4
+
+/* returns how many bytes of data it consumed */
+typedef size_t (*REACTOR_FRAME_CB)(int id, const uint8_t *data, size_t len, void *arg);
+/* the device is gone, its fd is closed after this returns */
+typedef void (*REACTOR_CLOSE_CB)(int id, void *arg);
+
+typedef struct{
+	uint64_t rxBytes;
+	uint64_t reads;
+	uint64_t dropped;	/* bytes thrown away: full buffer, or garbage between frames */
+	uint64_t frames;	/* reactor_add_frames() devices */
+	uint64_t badFrames;	/* checksum errors */
+}REACTOR_STATS_T;
+
+int reactor_start(void);
+/* closes every device */
+void reactor_stop(void);
+
+/* the reactor owns fd from now on, returns the device id or -1 */
+int reactor_add(const char *name, int fd, REACTOR_FRAME_CB frame, REACTOR_CLOSE_CB closed, void *arg);
+/* same, the stream is cut into frames of proto, see frame.h */
+int reactor_add_frames(const char *name, int fd, const FRAME_PROTO_T *proto,
+		FRAME_CB frame, REACTOR_CLOSE_CB closed, void *arg);
+int reactor_remove(int id);
+
+/* non-blocking, returns the bytes written (maybe fewer than len) or -1 */
+ssize_t reactor_write(int id, const void *data, size_t len);
+
+/* open a tty (or a pty stand-in) raw at baud for reactor_add(), the fd or -1 */
+int reactor_open_tty(const char *path, int baud);
+
+int reactor_stats(int id, REACTOR_STATS_T *stats);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "common.h"
+
+/*
+ * Device registry: the latest state of every device, for fleets of
+ * thousands where GLOBAL_T only knows one sensor.
+ *
+ * The state is kept as a struct of arrays indexed by slot: sample time,
+ * temperature, humidity, status and last seen, each field contiguous, so
+ * that a scan over the fleet ("every room above 28 C") walks one dense
+ * array instead of striding over whole device records. Device IDs map to
+ * slots through an open addressing hash with linear probing, kept at most
+ * half full, so finding a device is O(1) whatever the fleet size.
+ *
+ * Like the history, there is one writer at a time (collect_ingest()) and
+ * any number of lock-free readers. Slots are handed out in order and never
+ * reused, so slots 0 .. registry_count() - 1 are always valid; a per-slot
+ * sequence lets registry_get() return a consistent device, while the scans
+ * read the arrays directly and may mix two updates of one device.
+ */
+
+#define REGISTRY_DEFAULT_DEVS	4096
+#define REGISTRY_ID_NONE	0	/* not a device ID */
+
+typedef struct{
+	_Atomic uint64_t id;	/* REGISTRY_ID_NONE while free */
+	uint32_t slot;
+}REGISTRY_HASH_T;
+
+typedef struct REGISTRY_T{
+	uint32_t cap;
+	_Atomic uint32_t count;
+
+	/* per slot */
+	uint64_t *ids;
+	time_t *time;		/* of the last sample */
+	float *temp;
+	float *hum;
+	int32_t *status;	/* STATUS_E */
+	int64_t *lastSeen;	/* CLOCK_MONOTONIC ms of the last update */
+	_Atomic uint32_t *seq;	/* odd while the slot is written */
+
+	REGISTRY_HASH_T *hash;
+	uint32_t hashMask;
+}REGISTRY_T;
+
+/* one device, as returned by registry_get() */
+typedef struct{
+	uint64_t id;
+	STATUS_FAST_T sample;
+	int32_t status;
+	int64_t lastSeen;
+}REGISTRY_DEV_T;
+
+REGISTRY_T *registry_create(unsigned cap);
+void registry_destroy(REGISTRY_T *r);
+
+/* slot of id, -1 if unknown */
+int registry_find(REGISTRY_T *r, uint64_t id);
+
+/* writer only: slot of id, added if new; -1 if full */
+int registry_add(REGISTRY_T *r, uint64_t id);
+/* writer only: new sample of id, its status becomes STATUS_READ; returns its slot or -1 */
+int registry_update(REGISTRY_T *r, uint64_t id, const STATUS_FAST_T *s);
+void registry_set_status(REGISTRY_T *r, int slot, int status);
+
+/* consistent copy of a slot, -1 if not a valid slot */
+int registry_get(REGISTRY_T *r, int slot, REGISTRY_DEV_T *dev);
+
+static inline unsigned registry_count(REGISTRY_T *r)
+{
+	return atomic_load_explicit(&r->count, memory_order_acquire);
+}
+
+/* slots with lo <= temp <= hi, at most max, returns how many */
+unsigned registry_scan_temp(REGISTRY_T *r, float lo, float hi, uint32_t *slots, unsigned max);
+/* slots not updated for ageMs */
+unsigned registry_scan_stale(REGISTRY_T *r, int64_t ageMs, uint32_t *slots, unsigned max);
+
+int64_t registry_now_ms(void);
+
+#endif
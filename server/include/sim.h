@@ -0,0 +1,70 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Simulated sensor fleet, to load the server without hardware.
+ *
+ * The fleet is one sensor of the collect scheduler ticking every
+ * SIM_TICK_MS; each tick injects the samples due at the target rate through
+ * collect_ingest(), round robin over the virtual sensors, exactly as the
+ * real drivers do. Each virtual sensor follows a waveform (sine, square,
+ * ramp or random walk, phase shifted per sensor) plus noise, or replays a
+ * recorded trace in the CSV of db_export(), each from another offset.
+ * Sensors can drop out for a while, and the rate can burst periodically.
+ * Virtual sensor i is device i + 1 in the registry.
+ *
+ * The fleet is described by a spec string, from the config (simSpec) or
+ * -s on the command line, e.g.
+ *	sensors=5000,rate=20000,wave=sine,noise=0.2,drop=5,burst=30,burstx=4
+ *
+ *	sensors	virtual sensors (SIM_DEFAULT_SENSORS)
+ *	rate	samples/s over the fleet (SIM_DEFAULT_RATE)
+ *	wave	sine | square | ramp | walk
+ *	period	of the waveform in s
+ *	amp	temperature swing in C, the humidity swings twice as much
+ *	noise	uniform noise in C/%
+ *	drop	per mille of samples after which the sensor goes silent for
+ *		SIM_DROP_SAMPLES of its samples
+ *	burst	every that many s the rate is multiplied by burstx for 1 s
+ *	trace	CSV file to replay instead of the waveform
+ *	report	s between two reports in the log (SIM_REPORT_S)
+ *
+ * Ingest throughput is what the store accepted and committed per second,
+ * after the filters of collect_ingest() dropped what carried nothing new;
+ * lag is the time from injecting a sample to its commit, so it assumes the
+ * fleet is the only producer. Samples refused by a full storage queue are
+ * counted as dropped: a growing lag or any drop means the target rate is
+ * over the server's capacity.
+ */
+
+#define SIM_TICK_MS		10
+#define SIM_REPORT_S		5
+#define SIM_MAX_SENSORS		100000
+#define SIM_DEFAULT_SENSORS	1000
+#define SIM_DEFAULT_RATE	1000
+#define SIM_DROP_SAMPLES	20
+#define SIM_MARKS		1024	/* injection times kept to measure the lag */
+
+typedef struct{
+	uint64_t generated;	/* samples due, dropouts included */
+	uint64_t silent;	/* not sent, the sensor was out */
+	uint64_t injected;	/* queued for storage */
+	uint64_t filtered;	/* not worth storing, see filter.h */
+	uint64_t refused;	/* storage queue full */
+	uint64_t stored;	/* committed (or failed) since the start */
+	int64_t lagLastMs;
+	int64_t lagMaxMs;
+}SIM_STATS_T;
+
+/* parse spec and register the fleet, before collect_start() */
+int sim_start(const char *spec);
+/* after collect_stop(): final report */
+void sim_stop(void);
+
+void sim_stats(SIM_STATS_T *stats);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "common.h"
+
+/*
+ * Seqlock access to glb->tStatus.
+ *
+ * A writer makes the sequence odd, stores the words and makes it even
+ * again; a reader copies the words and retries if the sequence was odd or
+ * moved meanwhile. Readers never write the shared line, so any number of
+ * them costs the writer nothing. Writers exclude each other with a CAS on
+ * the sequence, the collect thread is normally the only one.
+ */
+
+static inline void status_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static inline uint32_t status_lock(STATUS_SEQ_T *s)
+{
+	uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+
+	for (;;) {
+		if (seq & 1) {
+			status_pause();
+			seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+		} else if (atomic_compare_exchange_weak_explicit(&s->seq, &seq, seq + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			break;
+		}
+	}
+	/* the words must not become visible before the odd sequence */
+	atomic_thread_fence(memory_order_release);
+	return seq + 1;
+}
+
+static inline void status_unlock(STATUS_SEQ_T *s, uint32_t seq)
+{
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+static inline void status_load_words(STATUS_SEQ_T *s, STATUS_SNAPSHOT_T *v)
+{
+	uint32_t w[STATUS_WORDS];
+	unsigned i;
+
+	for (i = 0; i < STATUS_WORDS; i++)
+		w[i] = atomic_load_explicit(&s->words[i], memory_order_relaxed);
+	memcpy(v, w, sizeof(*v));
+}
+
+static inline void status_store_words(STATUS_SEQ_T *s, const STATUS_SNAPSHOT_T *v)
+{
+	uint32_t w[STATUS_WORDS] = { 0 };
+	unsigned i;
+
+	memcpy(w, v, sizeof(*v));
+	for (i = 0; i < STATUS_WORDS; i++)
+		atomic_store_explicit(&s->words[i], w[i], memory_order_relaxed);
+}
+
+/* consistent copy of status, tTemp and tFastStatus */
+static inline void status_get(STATUS_SEQ_T *s, STATUS_SNAPSHOT_T *v)
+{
+	uint32_t seq0, seq1;
+
+	for (;;) {
+		seq0 = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if (seq0 & 1) {
+			status_pause();
+			continue;
+		}
+		status_load_words(s, v);
+		atomic_thread_fence(memory_order_acquire);
+		seq1 = atomic_load_explicit(&s->seq, memory_order_relaxed);
+		if (seq0 == seq1)
+			return;
+	}
+}
+
+static inline void status_set(STATUS_SEQ_T *s, const STATUS_SNAPSHOT_T *v)
+{
+	uint32_t seq = status_lock(s);
+
+	status_store_words(s, v);
+	status_unlock(s, seq);
+}
+
+/* new sample from the collect thread, tTemp follows it */
+static inline void status_set_fast(STATUS_SEQ_T *s, const STATUS_FAST_T *fast)
+{
+	STATUS_SNAPSHOT_T v;
+	uint32_t seq = status_lock(s);
+
+	status_load_words(s, &v);
+	v.tFastStatus = *fast;
+	v.tTemp = fast->fTemp;
+	status_store_words(s, &v);
+	status_unlock(s, seq);
+}
+
+static inline void status_set_state(STATUS_SEQ_T *s, int status)
+{
+	STATUS_SNAPSHOT_T v;
+	uint32_t seq = status_lock(s);
+
+	status_load_words(s, &v);
+	v.status = status;
+	status_store_words(s, &v);
+	status_unlock(s, seq);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __TS_BLOCK_H__
+#define __TS_BLOCK_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Gorilla-style compression of STATUS_FAST_T samples.
+ *
+ * The first sample is stored raw. Then a timestamp is the delta of its delta
+ * (one bit for a steady period), and a float is XOR'ed with the previous
+ * value of the same field: one bit when it did not change, otherwise only
+ * the meaningful bits, reusing the previous leading/trailing zero window
+ * when they fit in it.
+ *
+ * The bit stream does not record how many samples it holds, the count is
+ * kept next to it.
+ */
+
+/* upper bound of one encoded sample, the first one is 64 + 2 * 32 bits */
+#define TS_SAMPLE_MAX_BITS	128
+
+typedef struct{
+	uint32_t prev;
+	uint8_t lead;	/* window of the previous XOR, lead > 31 if none */
+	uint8_t trail;
+}TS_XOR_T;
+
+typedef struct{
+	uint8_t *buf;
+	uint32_t size;		/* bytes */
+	uint32_t bits;		/* written, or read when decoding */
+	uint32_t count;		/* samples written, or left to read */
+	int64_t first;		/* time of the first sample */
+	int64_t time;		/* time of the previous sample */
+	int64_t delta;
+	TS_XOR_T temp;
+	TS_XOR_T hum;
+}TS_BLOCK_T;
+
+/* start an empty block in buf */
+void ts_block_init(TS_BLOCK_T *b, uint8_t *buf, uint32_t size);
+/* 0, or -1 if the block is full or the time jump does not fit */
+int ts_block_append(TS_BLOCK_T *b, const STATUS_FAST_T *s);
+/* bytes used by the encoded samples */
+uint32_t ts_block_bytes(const TS_BLOCK_T *b);
+
+/* read count samples back from an encoded block */
+void ts_block_open(TS_BLOCK_T *b, const uint8_t *buf, uint32_t size, uint32_t count);
+/* 0, or -1 at the end or if the block is truncated */
+int ts_block_next(TS_BLOCK_T *b, STATUS_FAST_T *s);
+
+#endif
@@ -33,8 +33,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "common.h"
+#include "db_log.h"
+#include "db_store.h"
+#include "db_archive.h"
+#include "db_retain.h"
+#include "history.h"
+#include "registry.h"
+#include "filter.h"
+#include "collect.h"
+#include "reactor.h"
+#include "sim.h"
+#include "device.h"
 
 #define TAG "main"
 
@@ -54,20 +68,79 @@ int init(void)
 int main(int argc, char **argv)
 {
 	int ret = 0;
+	int opt, sig;
+	sigset_t stopSigs;
+	FILTER_PARAM_T filter;
+	const char *archive = NULL;
+	const char *backend = NULL;
+	const char *sim = NULL;
+	const char *devs[MAX_DEVICES];
+	int devCount = 0, i;
+
+	/* init log */
+	log_set_flags(LOG_SKIP_REPEATED | LOG_PRINT_LEVEL | LOG_RATE_LIMIT);//跳过重复的信息 + 显示打印级别 + 限流
+	log_set_level(LOG_MAX_OFFSET);
 
 	/* parse cmd */
 	//解析命令行参数，包含日志等级===>在配置文件尚未弄好之前使用当前方式
+	while ((opt = getopt(argc, argv, "l:f:a:b:s:d:")) != -1) {
+		switch (opt) {
+		case 'l':
+			//e.g. -l info,common=trace
+			if (log_parse_levels(optarg) != 0)
+				log(TAG, LOG_WARNING, "invalid log levels: %s\n", optarg);
+			break;
+		case 'f':
+			//日志写文件：4MB一个分段，保留8个，1s同步一次
+			if (log_file_open(optarg, 4 * 1024 * 1024, 8, 1000) == 0)
+				log_set_flags(log_get_flags() | LOG_TO_FILE);
+			else
+				log(TAG, LOG_WARNING, "open log file %s failed\n", optarg);
+			break;
+		case 'a':
+			//冷数据归档库，一般放在SATA盘上
+			archive = optarg;
+			break;
+		case 'b':
+			//样本存储引擎：sqlite/memory，覆盖配置文件
+			backend = optarg;
+			break;
+		case 's':
+			//模拟传感器群，没有硬件时压测: -s sensors=5000,rate=20000,wave=sine
+			sim = optarg;
+			break;
+		case 'd':
+			//串口/hidraw/蓝牙传感器，每个设备一个-d: -d path=/dev/ttyUSB0,baud=9600,proto=modbus-th,id=17
+			if (devCount < MAX_DEVICES)
+				devs[devCount++] = optarg;
+			else
+				log(TAG, LOG_WARNING, "too many devices, %s ignored\n", optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l level[,tag=level...]] [-f logfile] [-a archive.db] [-b sqlite|memory] [-s sim-spec] [-d device-spec]...\n", argv[0]);
+			return -1;
+		}
+	}
+	/* SIGINT/SIGTERM在所有线程中屏蔽(子线程继承)，只由主线程sigwait同步接收，不会丢失 */
+	sigemptyset(&stopSigs);
+	sigaddset(&stopSigs, SIGINT);
+	sigaddset(&stopSigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSigs, NULL);
 
-	/* init log */
-	log_set_flags(LOG_SKIP_REPEATED | LOG_PRINT_LEVEL);//跳过重复的信息 + 显示打印级别
-	log_set_level(LOG_MAX_OFFSET);
+	/* init log thread用于记录实时数据，以及错误信息等*/
+	log_async_start(64 * 1024, LOG_OVERFLOW_DROP);
 
 	if (glb != NULL) free(glb);
-	glb = (GLOBAL_T *)malloc(sizeof(GLOBAL_T));
+	//tStatus独占cache line，glb需要按cache line对齐
+	if (posix_memalign((void **)&glb, CACHE_LINE_SIZE, sizeof(GLOBAL_T)) != 0)
+		glb = NULL;
 	if (glb == NULL) {
 		log(TAG, LOG_ERROR, "malloc glb failed!\n");
+		log_async_stop();
+		log_file_close();
 		return -1;
 	}
+	memset(glb, 0, sizeof(GLOBAL_T));
 
 	do {
 		/* init */
@@ -84,6 +157,41 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		if (archive)
+			snprintf(glb->db[eSQLITE_ARCHIVE].name, sizeof(glb->db[eSQLITE_ARCHIVE].name), "%s", archive);
+		if (backend)
+			snprintf(glb->pConfig->dbBackend, sizeof(glb->pConfig->dbBackend), "%s", backend);
+		if (sim)
+			snprintf(glb->pConfig->simSpec, sizeof(glb->pConfig->simSpec), "%s", sim);
+		for (i = 0; i < devCount; i++) {
+			if (device_parse(devs[i], &glb->pConfig->devices[glb->pConfig->deviceCount]) == 0)
+				glb->pConfig->deviceCount++;
+		}
+
+		/* 内存中保留每个设备最近的采样，供GUI/上报/web读取 */
+		glb->pHistory = history_create(glb->pConfig->registryDevs, glb->pConfig->historyLen);
+		if (glb->pHistory == NULL) {
+			log(TAG, LOG_ERROR,"history_create failed!\n");
+			ret = -1;
+			break;
+		}
+
+		/* 每个设备的最新状态(按字段连续存放)，设备多时GUI/web按此扫描 */
+		glb->pRegistry = registry_create(glb->pConfig->registryDevs);
+		if (glb->pRegistry == NULL) {
+			log(TAG, LOG_ERROR,"registry_create failed!\n");
+			ret = -1;
+			break;
+		}
+
+		/* 按设备过滤：死区/旋转门 + 心跳，只存有变化的样本 */
+		filter.mode = glb->pConfig->filterMode;
+		filter.temp = glb->pConfig->filterTemp;
+		filter.hum = glb->pConfig->filterHum;
+		filter.silence = glb->pConfig->filterSilence;
+		if (filter_init(glb->pConfig->registryDevs, &filter) != 0)
+			log(TAG, LOG_WARNING, "samples will not be filtered\n");
+
 		/* init db thread */
 		//确认使用数据库方式
 		ret = init_db();
@@ -92,19 +200,71 @@ int main(int argc, char **argv)
 			goto err_init_db;
 		}
 
+		/* 日志事件批量写入日志数据库 */
+		if (db_log_start(glb->db[eSQLITE_LOG].name, LOG_INFO) != 0)
+			log(TAG, LOG_WARNING, "log events will not be persisted\n");
+
+		/* 存储线程：采样数据按批提交到数据库 */
+		ret = db_store_start();
+		if (ret != 0) {
+			log(TAG, LOG_ERROR,"db_store_start failed!\n");
+			break;
+		}
+
+		/* 旧数据块限速迁移到归档库(SD卡 -> SATA) */
+		if (archive && db_archive_start() != 0)
+			log(TAG, LOG_WARNING, "blocks will not be archived\n");
+
+		/* 过期数据分批删除 + 增量vacuum，防止SD卡被写满 */
+		if (db_retain_start() != 0)
+			log(TAG, LOG_WARNING, "expired data will not be deleted\n");
+
 		/* 1.打开定时器 */
 		/* 2.开辟fifo，用于调试 */
 
 
 
-		/* init log thread用于记录实时数据，以及错误信息等*/
+		/* 串口/USB/蓝牙设备共用一个epoll线程，不再每个设备一个阻塞读线程 */
+		if (reactor_start() != 0)
+			log(TAG, LOG_WARNING, "devices will not be read\n");
+		/* 配置的传感器加入reactor，每帧解码后经collect_ingest入库 */
+		else if (device_start(glb->pConfig->devices, glb->pConfig->deviceCount) < glb->pConfig->deviceCount)
+			log(TAG, LOG_WARNING, "some devices will not be read\n");
+
+		/* 模拟传感器作为一个采集项注册，需在collect_start之前 */
+		if (glb->pConfig->simSpec[0] && sim_start(glb->pConfig->simSpec) != 0)
+			log(TAG, LOG_WARNING, "no simulated sensors\n");
+
 		/* init collect thread */
+		//各传感器按各自周期/相位采集，传感器由驱动在此之前注册
+		if (collect_start() != 0)
+			log(TAG, LOG_WARNING, "sensors will not be read\n");
 		/* init upload thread */
 
+		/* 运行直到收到SIGINT/SIGTERM，启动期间到达的信号保持pending，这里立即返回 */
+		if (sigwait(&stopSigs, &sig) == 0)
+			log(TAG, LOG_INFO, "server exit on signal %d\n", sig);
+
 	} while(0);
 
 err_init_db:
+	device_stop();
+	collect_stop();
+	sim_stop();
+	reactor_stop();
+	db_retain_stop();
+	db_archive_stop();
+	db_store_stop();
+	db_log_stop();
 	deinit_db();	
+	filter_deinit();
+	registry_destroy(glb->pRegistry);
+	history_destroy(glb->pHistory);
+	free(glb->pConfig);
+	free(glb);
+	glb = NULL;
+	log_async_stop();
+	log_file_close();
 	return ret;
 }
 
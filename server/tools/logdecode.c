@@ -0,0 +1,140 @@
+/*
+ * logdecode: print a binary log file written with log_binary_open()
+ *
+ * usage: logdecode <file.bin>
+ *
+ * The file is in the byte order of the machine that wrote it, decode it on a
+ * machine with the same endianness (the Pi and x86 hosts are both little
+ * endian).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_binary.h"
+
+static char **strs;
+static unsigned nb_strs;
+
+static const char *level_str(int level)
+{
+	switch (level & 0xff) {
+	case LOG_PANIC:		return "panic";
+	case LOG_FATAL:		return "fatal";
+	case LOG_ERROR:		return "error";
+	case LOG_WARNING:	return "warning";
+	case LOG_INFO:		return "info";
+	case LOG_VERBOSE:	return "verbose";
+	case LOG_DEBUG:		return "debug";
+	case LOG_TRACE:		return "trace";
+	default:		return "";
+	}
+}
+
+static int add_string(FILE *fp, const LOG_BIN_STRING_T *def)
+{
+	char *str;
+	char **tmp;
+
+	if (def->id >= nb_strs) {
+		tmp = realloc(strs, (def->id + 1) * sizeof(*strs));
+		if (tmp == NULL)
+			return -1;
+		memset(tmp + nb_strs, 0, (def->id + 1 - nb_strs) * sizeof(*strs));
+		strs = tmp;
+		nb_strs = def->id + 1;
+	}
+
+	str = malloc(def->len + 1);
+	if (str == NULL || fread(str, 1, def->len, fp) != def->len) {
+		free(str);
+		return -1;
+	}
+	str[def->len] = 0;
+	free(strs[def->id]);
+	strs[def->id] = str;
+	return 0;
+}
+
+static const char *get_string(uint32_t id)
+{
+	return id && id < nb_strs && strs[id] ? strs[id] : NULL;
+}
+
+static int print_event(FILE *fp, const LOG_BIN_EVENT_T *ev)
+{
+	uint8_t args[LOG_BIN_MAX_ARGS];
+	char msg[4096], date[32];
+	const char *fmt, *name;
+	struct tm tm;
+	time_t sec;
+
+	if (ev->size > sizeof(args) || fread(args, 1, ev->size, fp) != ev->size)
+		return -1;
+
+	fmt = get_string(ev->fmt_id);
+	name = get_string(ev->name_id);
+	if (fmt == NULL)
+		fmt = "<unknown format>\n";
+	log_bin_format(msg, sizeof(msg), fmt, args, ev->size);
+
+	sec = ev->time / 1000000;
+	localtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+	printf("%s.%06d ", date, (int)(ev->time % 1000000));
+	if (name)
+		printf("[%s] ", name);
+	printf("[%s] %s", level_str(ev->level), msg);
+	if (!*msg || msg[strlen(msg) - 1] != '\n')
+		putchar('\n');
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	LOG_BIN_STRING_T def;
+	LOG_BIN_EVENT_T ev;
+	char magic[8];
+	uint32_t version;
+	FILE *fp;
+	int kind, ret = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <file.bin>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, LOG_BIN_MAGIC, 8) ||
+	    fread(&version, sizeof(version), 1, fp) != 1 || version != LOG_BIN_VERSION) {
+		fprintf(stderr, "%s: not a binary log file\n", argv[1]);
+		fclose(fp);
+		return 1;
+	}
+
+	while ((kind = fgetc(fp)) != EOF) {
+		ungetc(kind, fp);
+		if (kind == LOG_BIN_STRING) {
+			if (fread(&def, sizeof(def), 1, fp) != 1 || add_string(fp, &def))
+				break;
+		} else if (kind == LOG_BIN_EVENT) {
+			if (fread(&ev, sizeof(ev), 1, fp) != 1 || print_event(fp, &ev))
+				break;
+		} else {
+			fprintf(stderr, "%s: corrupt entry at offset %ld\n", argv[1], ftell(fp));
+			ret = 1;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return ret;
+}